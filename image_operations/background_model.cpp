@@ -0,0 +1,118 @@
+#include "background_model.h"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "pixel_kernels.h"
+#include "profiler.h"
+#include "thread_pool.h"
+
+namespace {
+
+const char checkpoint_magic[8] = {'B', 'G', 'M', 'O', 'D', 'E', 'L', '1'};
+
+// followed by height rows of width native-endian 8.8 averages
+struct CheckpointHeader {
+	char magic[8];
+	uint32_t width;
+	uint32_t height;
+	uint64_t frames;
+};
+
+}
+
+BackgroundModel::BackgroundModel(int rate_shift, int threshold)
+	: rate_shift_(rate_shift < 0 ? 0 : (rate_shift > 8 ? 8 : rate_shift)), threshold_(threshold)
+{
+}
+
+void BackgroundModel::update(const Image8& frame, Image8& mask) {
+	int width = frame.width();
+	size_t pixels = static_cast<size_t>(width) * frame.height();
+	ProfileScope scope("background_update", pixels, 6 * pixels);
+	mask.resize(width, frame.height());
+	if (frames_ == 0 || model_.width() != width || model_.height() != frame.height()) {
+		model_.resize(width, frame.height());
+		parallel_rows(frame.height(), [&](int begin, int end) {
+			for (int y = begin; y < end; ++y) {
+				const uint8_t* source = frame[y];
+				uint16_t* average = model_[y];
+				for (int x = 0; x < width; ++x)
+					average[x] = static_cast<uint16_t>(source[x] << 8);
+				std::memset(mask[y], 0, width);
+			}
+		});
+		frames_ = 1;
+		return;
+	}
+	const PixelKernels& kernels = pixel_kernels();
+	parallel_rows(frame.height(), [&](int begin, int end) {
+		for (int y = begin; y < end; ++y)
+			kernels.background_row(model_[y], frame[y], mask[y], width, rate_shift_, threshold_);
+	});
+	++frames_;
+}
+
+void BackgroundModel::background(Image8& out) const {
+	int width = model_.width();
+	out.resize(width, model_.height());
+	parallel_rows(model_.height(), [&](int begin, int end) {
+		for (int y = begin; y < end; ++y) {
+			const uint16_t* average = model_[y];
+			uint8_t* destination = out[y];
+			for (int x = 0; x < width; ++x)
+				destination[x] = static_cast<uint8_t>((average[x] + 128) >> 8);
+		}
+	});
+}
+
+int BackgroundModel::save(const char* path) const {
+	std::string temporary = std::string(path) + ".tmp";
+	FILE* file = std::fopen(temporary.c_str(), "wb");
+	if (!file) {
+		std::cerr << "[BackgroundModel::save] File " << temporary << " could not be opened for writing" << std::endl;
+		return 1;
+	}
+	CheckpointHeader header;
+	std::memcpy(header.magic, checkpoint_magic, sizeof(header.magic));
+	header.width = static_cast<uint32_t>(model_.width());
+	header.height = static_cast<uint32_t>(model_.height());
+	header.frames = frames_;
+	bool written = std::fwrite(&header, sizeof(header), 1, file) == 1;
+	for (int y = 0; written && y < model_.height(); ++y)
+		written = std::fwrite(model_[y], sizeof(uint16_t), model_.width(), file) == static_cast<size_t>(model_.width());
+	if (std::fclose(file) != 0 || !written || std::rename(temporary.c_str(), path) != 0) {
+		std::cerr << "[BackgroundModel::save] Writing " << path << " failed" << std::endl;
+		std::remove(temporary.c_str());
+		return 1;
+	}
+	return 0;
+}
+
+int BackgroundModel::load(const char* path) {
+	FILE* file = std::fopen(path, "rb");
+	if (!file)
+		return 1;
+	CheckpointHeader header;
+	if (std::fread(&header, sizeof(header), 1, file) != 1 || std::memcmp(header.magic, checkpoint_magic, sizeof(header.magic)) != 0
+		|| header.width > 1u << 20 || header.height > 1u << 20)
+	{
+		std::cerr << "[BackgroundModel::load] File " << path << " is not a background model checkpoint" << std::endl;
+		std::fclose(file);
+		return 2;
+	}
+	Image16 model(static_cast<int>(header.width), static_cast<int>(header.height));
+	bool read = true;
+	for (int y = 0; read && y < model.height(); ++y)
+		read = std::fread(model[y], sizeof(uint16_t), model.width(), file) == static_cast<size_t>(model.width());
+	std::fclose(file);
+	if (!read) {
+		std::cerr << "[BackgroundModel::load] File " << path << " is truncated" << std::endl;
+		return 2;
+	}
+	swap(model_, model);
+	frames_ = header.frames;
+	return 0;
+}
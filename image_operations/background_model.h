@@ -0,0 +1,46 @@
+#ifndef BACKGROUND_MODEL_H
+#define BACKGROUND_MODEL_H
+
+#include <cstdint>
+
+#include "image.h"
+
+// The running average of a sequence of frames that grayscale_learn_average
+// keeps, held in 8.8 fixed point so that slow rates still creep towards
+// small changes instead of rounding them away. Each frame is compared with
+// the model and then folded into it in place, a row at a time through
+// pixel_kernels(), so a stream of equal sized frames allocates nothing.
+class BackgroundModel {
+public:
+	// each frame moves the model 1/2^rate_shift of the way towards itself,
+	// so the default 4 is grayscale_learn_average's 1/16; pixels at least
+	// threshold from the model are foreground
+	explicit BackgroundModel(int rate_shift = 4, int threshold = 24);
+
+	// Writes the foreground of frame to mask, 1 or 0 per pixel, and updates
+	// the model. The first frame, or one of another size, starts the model
+	// afresh and has an empty mask.
+	void update(const Image8& frame, Image8& mask);
+
+	// the model rounded to 8 bits
+	void background(Image8& out) const;
+
+	uint64_t frames() const { return frames_; }
+	int rate_shift() const { return rate_shift_; }
+	int threshold() const { return threshold_; }
+
+	// Checkpoints: the model and its frame count, written to path.tmp and
+	// renamed over path, so a crash leaves the previous checkpoint whole.
+	// save returns 0 on success; load returns 0 on success, 1 if path cannot
+	// be read and 2 if it is not a checkpoint, leaving the model untouched.
+	int save(const char* path) const;
+	int load(const char* path);
+
+private:
+	Image16 model_;
+	int rate_shift_;
+	int threshold_;
+	uint64_t frames_ = 0;
+};
+
+#endif
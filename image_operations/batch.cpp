@@ -0,0 +1,186 @@
+#include "batch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <dirent.h>
+#include <glob.h>
+#include <iostream>
+#include <memory>
+#include <sys/stat.h>
+#include <thread>
+
+#include "bounded_queue.h"
+#include "frame_io.h"
+#include "profiler.h"
+#include "thread_pool.h"
+
+namespace {
+
+struct BatchFrame {
+	std::string input;
+	size_t index = 0;
+	bool decoded = false;
+	int width = 0;
+	int height = 0;
+	int stride = 0;
+	int number_of_passes = 0;
+	png_byte color_type = 0;
+	png_byte bit_depth = 0;
+	Image8 image;
+	Image8 scratch;
+};
+
+bool ends_with(const std::string& text, const std::string& suffix) {
+	return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+std::string base_name(const std::string& path) {
+	size_t slash = path.find_last_of('/');
+	return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+double file_size(const std::string& path) {
+	struct stat status;
+	return stat(path.c_str(), &status) == 0 ? static_cast<double>(status.st_size) : 0.0;
+}
+
+}
+
+std::vector<std::string> batch_inputs(const std::string& source) {
+	std::vector<std::string> inputs;
+	struct stat status;
+	if (source == "-") {
+		std::string line;
+		while (std::getline(std::cin, line))
+			if (!line.empty())
+				inputs.push_back(line);
+	} else if (stat(source.c_str(), &status) == 0 && S_ISDIR(status.st_mode)) {
+		DIR* directory = opendir(source.c_str());
+		if (!directory) {
+			std::cerr << "[batch_inputs] Directory " << source << " could not be opened" << std::endl;
+			return inputs;
+		}
+		while (dirent* entry = readdir(directory)) {
+			std::string name = entry->d_name;
+			if (ends_with(name, ".png") || ends_with(name, ".PNG") || frame_format(name.c_str()) != FrameFormat::png)
+				inputs.push_back(source + "/" + name);
+		}
+		closedir(directory);
+	} else {
+		glob_t matches;
+		if (glob(source.c_str(), 0, NULL, &matches) == 0) {
+			for (size_t index = 0; index < matches.gl_pathc; ++index)
+				inputs.push_back(matches.gl_pathv[index]);
+		}
+		globfree(&matches);
+	}
+	std::sort(inputs.begin(), inputs.end());
+	return inputs;
+}
+
+BatchReport run_batch(const std::vector<std::string>& inputs, const std::string& output_directory,
+	const BatchProcess& process, GrayWeights weights, int coders, bool in_order)
+{
+	if (coders <= 0)
+		coders = std::max(1, thread_count() / 2);
+	// enough frames for every coder to hold one with one queued either side
+	int frame_count = 2 * coders + 2;
+	std::vector<std::unique_ptr<BatchFrame>> frames;
+	BoundedQueue<BatchFrame*> free_frames(frame_count);
+	BoundedQueue<BatchFrame*> decoded(frame_count);
+	BoundedQueue<BatchFrame*> processed(frame_count);
+	for (int index = 0; index < frame_count; ++index) {
+		frames.emplace_back(new BatchFrame);
+		free_frames.push(frames.back().get());
+	}
+
+	std::atomic<size_t> next_input(0);
+	std::atomic<int> decoders_running(coders);
+	std::atomic<int> images(0);
+	std::atomic<int> failed(0);
+	std::atomic<long long> pixel_bytes(0);
+	auto start = std::chrono::steady_clock::now();
+
+	std::vector<std::thread> threads;
+	for (int decoder = 0; decoder < coders; ++decoder) {
+		threads.emplace_back([&]() {
+			BatchFrame* frame;
+			while (free_frames.pop(frame)) {
+				size_t index = next_input++;
+				if (index >= inputs.size()) {
+					free_frames.push(frame);
+					break;
+				}
+				frame->input = inputs[index];
+				frame->index = index;
+				frame->decoded = read_gray_frame(frame->input.c_str(), frame->width, frame->height, frame->color_type,
+					frame->bit_depth, frame->number_of_passes, frame->stride, weights, frame->image) == 0;
+				if (frame->decoded)
+					pixel_bytes += static_cast<long long>(frame->width) * frame->height * ((frame->stride * frame->bit_depth + 7) / 8);
+				else
+					++failed;
+				// failures go through too, so the processing thread can count them off in order
+				decoded.push(frame);
+			}
+			if (--decoders_running == 0)
+				decoded.close();
+		});
+	}
+	for (int encoder = 0; encoder < coders; ++encoder) {
+		threads.emplace_back([&]() {
+			BatchFrame* frame;
+			while (processed.pop(frame)) {
+				std::string output = output_directory.empty() ? std::string() : output_directory + "/" + base_name(frame->input);
+				if (!output.empty() && write_gray_frame(output.c_str(), frame->image) != 0)
+					++failed;
+				else
+					++images;
+				free_frames.push(frame);
+			}
+		});
+	}
+
+	// Out of order arrivals wait for the frames before them. The next frame
+	// is always already held by a decoder, which needs no other frame to
+	// finish it, so the wait cannot starve the decoders.
+	std::vector<BatchFrame*> waiting;
+	size_t next = 0;
+	BatchFrame* frame;
+	while (decoded.pop(frame)) {
+		waiting.push_back(frame);
+		while (!waiting.empty()) {
+			auto ready = waiting.begin();
+			if (in_order) {
+				ready = std::find_if(waiting.begin(), waiting.end(), [next](const BatchFrame* waiter) { return waiter->index == next; });
+				if (ready == waiting.end())
+					break;
+				++next;
+			}
+			frame = *ready;
+			waiting.erase(ready);
+			if (!frame->decoded) {
+				free_frames.push(frame);
+				continue;
+			}
+			if (process) {
+				ProfileScope scope("batch process", static_cast<size_t>(frame->width) * frame->height);
+				process(frame->image, frame->scratch);
+			}
+			processed.push(frame);
+		}
+	}
+	processed.close();
+	free_frames.close();
+	for (std::thread& thread : threads)
+		thread.join();
+
+	BatchReport report;
+	report.images = images;
+	report.failed = failed;
+	report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	report.pixel_bytes = static_cast<double>(pixel_bytes);
+	for (const std::string& input : inputs)
+		report.file_bytes += file_size(input);
+	return report;
+}
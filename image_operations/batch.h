@@ -0,0 +1,40 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "gray_conversion.h"
+#include "image.h"
+
+// Processes one grayscale frame in place. scratch is a second buffer that
+// keeps its allocation from frame to frame, for operators that need one.
+typedef std::function<void(Image8& image, Image8& scratch)> BatchProcess;
+
+struct BatchReport {
+	int images = 0;
+	int failed = 0;
+	double seconds = 0.0;
+	double file_bytes = 0.0;
+	double pixel_bytes = 0.0;
+};
+
+// The .png, .pgm, .ppm, .pnm and .raw files in a directory, the paths listed
+// one per line on stdin for "-", or else the matches of a glob pattern;
+// sorted.
+std::vector<std::string> batch_inputs(const std::string& source);
+
+// Decodes, converts to grayscale, processes and encodes every input, each
+// into output_directory under its own file name, and so in its own format,
+// or nowhere when output_directory is empty. Decoding and encoding each run
+// on coders threads and processing on the calling thread, connected by
+// bounded queues of recycled frames, so the stages overlap, memory stays
+// bounded and image buffers are allocated only while frames grow. coders 0
+// picks half the thread count. Frames reach process in whatever order they
+// finish decoding, or in the order of inputs when in_order is set, for
+// processes that keep state from one frame to the next.
+BatchReport run_batch(const std::vector<std::string>& inputs, const std::string& output_directory,
+	const BatchProcess& process, GrayWeights weights = GrayWeights::equal, int coders = 0, bool in_order = false);
+
+#endif
@@ -0,0 +1,628 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "background_model.h"
+#include "binary_image.h"
+#include "connected_components.h"
+#include "convolution.h"
+#include "cpu_dispatch.h"
+#include "distance_transform.h"
+#include "edge_detection.h"
+#include "frame_io.h"
+#include "gray_conversion.h"
+#include "histogram.h"
+#include "image.h"
+#include "integral_image.h"
+#include "morphology.h"
+#include "neighbourhood_operations.h"
+#include "pipeline.h"
+#include "pixel_kernels.h"
+#include "png_encoder.h"
+#include "png_io.h"
+#include "png_stream.h"
+#include "point_operations.h"
+#include "rank_filter.h"
+#include "thread_pool.h"
+
+// Reproducible throughput for every operator on synthetic images generated
+// in process. Each case reports its best run in pixels per cycle, where
+// cycles are time stamp counter ticks, and can be checked against a saved
+// baseline:
+//   bench_suite [--size WxH] [--density d] [--repetitions n] [--filter text]
+//               [--threads n] [--isa level] [--save-baseline file]
+//               [--baseline file] [--tolerance fraction] [--validate]
+// With --baseline the exit status is 1 if any case is slower than its
+// baseline by more than the tolerance (default 0.1). Every run first checks
+// each instruction set level's kernels against the scalar ones and fails if
+// any differ; --validate stops after that.
+
+// the inputs every case draws on, made once per run
+struct BenchInput {
+	int width = 0;
+	int height = 0;
+	double density = 0.0;
+	Image8 gray;
+	Image8 rgb;
+	// 0/1 with density of the pixels set, for the morphology operators
+	Image8 mask;
+	BinaryImage bits;
+	std::string png_path;
+};
+
+// prepares a case's buffers and returns the body to time
+typedef std::function<std::function<void()>(BenchInput&)> BenchPrepare;
+typedef void (*NeighbourhoodFn)(Image8&, const Image8&, int, int);
+typedef void (*BinaryFn)(BinaryImage&, const BinaryImage&);
+
+struct BenchCase {
+	std::string name;
+	BenchPrepare prepare;
+};
+
+std::vector<BenchCase>& bench_cases() {
+	static std::vector<BenchCase> cases;
+	return cases;
+}
+
+void add_case(const std::string& name, BenchPrepare prepare) {
+	bench_cases().push_back(BenchCase{name, prepare});
+}
+
+uint64_t cycle_count() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Smooth value noise: random values on a coarse grid, interpolated. Pixels
+// where the noise is below density are foreground, so density sets the
+// fraction of foreground and the noise gives it blob structure the way
+// thresholded scans have, rather than salt and pepper.
+void make_synthetic_image(Image8& gray, Image8& mask, int width, int height, double density, unsigned int seed) {
+	const int cell = 16;
+	int grid_width = width / cell + 2;
+	int grid_height = height / cell + 2;
+	std::mt19937 generator(seed);
+	std::uniform_real_distribution<double> unit(0.0, 1.0);
+	std::vector<double> grid(static_cast<size_t>(grid_width) * grid_height);
+	for (double& value : grid)
+		value = unit(generator);
+
+	gray.resize(width, height);
+	mask.resize(width, height);
+	std::uniform_int_distribution<int> grain(0, 127);
+	for (int y = 0; y < height; ++y) {
+		int gy = y / cell;
+		double fy = static_cast<double>(y % cell) / cell;
+		for (int x = 0; x < width; ++x) {
+			int gx = x / cell;
+			double fx = static_cast<double>(x % cell) / cell;
+			const double* top = &grid[static_cast<size_t>(gy) * grid_width + gx];
+			const double* bottom = top + grid_width;
+			double noise = (top[0] * (1 - fx) + top[1] * fx) * (1 - fy) + (bottom[0] * (1 - fx) + bottom[1] * fx) * fy;
+			bool foreground = noise < density;
+			mask[y][x] = foreground ? 1 : 0;
+			gray[y][x] = static_cast<uint8_t>((foreground ? 128 : 0) + grain(generator));
+		}
+	}
+}
+
+void make_rgb(Image8& rgb, const Image8& gray) {
+	rgb.resize(gray.width(), gray.height(), 3);
+	for (int y = 0; y < gray.height(); ++y) {
+		const uint8_t* source = gray[y];
+		uint8_t* destination = rgb[y];
+		for (int x = 0; x < gray.width(); ++x) {
+			destination[3 * x] = source[x];
+			destination[3 * x + 1] = static_cast<uint8_t>(source[x] ^ 0x55);
+			destination[3 * x + 2] = static_cast<uint8_t>(255 - source[x]);
+		}
+	}
+}
+
+template <typename Fn>
+void add_point_case(const std::string& name, Fn fn) {
+	add_case(name, [fn](BenchInput& input) -> std::function<void()> {
+		std::shared_ptr<Image8> image = std::make_shared<Image8>(input.gray);
+		return [fn, image]() { single_channel_apply(fn, *image); };
+	});
+}
+
+template <typename Fn>
+void add_binary_point_case(const std::string& name, Fn fn) {
+	add_case(name, [fn](BenchInput& input) -> std::function<void()> {
+		std::shared_ptr<Image8> image = std::make_shared<Image8>(input.gray);
+		const Image8* other = &input.mask;
+		return [fn, image, other]() { single_channel_apply(fn, *image, *other); };
+	});
+}
+
+void add_kernel_case(const std::string& name, NeighbourhoodFn fn) {
+	add_case(name, [fn](BenchInput& input) -> std::function<void()> {
+		std::shared_ptr<Image8> out = std::make_shared<Image8>(input.width, input.height);
+		const Image8* mask = &input.mask;
+		return [fn, out, mask]() { single_channel_kernel(fn, *out, *mask); };
+	});
+}
+
+void add_packed_case(const std::string& name, BinaryFn fn) {
+	add_case(name, [fn](BenchInput& input) -> std::function<void()> {
+		std::shared_ptr<BinaryImage> out = std::make_shared<BinaryImage>();
+		const BinaryImage* bits = &input.bits;
+		return [fn, out, bits]() { fn(*out, *bits); };
+	});
+}
+
+// includes copying the input back in for every run
+void add_pipeline_case(const std::string& spec) {
+	add_case("pipeline " + spec, [spec](BenchInput& input) -> std::function<void()> {
+		std::shared_ptr<Pipeline> pipeline = std::make_shared<Pipeline>();
+		parse_pipeline(spec, *pipeline);
+		std::shared_ptr<Image8> image = std::make_shared<Image8>();
+		std::shared_ptr<PipelineBuffers> buffers = std::make_shared<PipelineBuffers>();
+		const Image8* gray = &input.gray;
+		return [pipeline, image, buffers, gray]() {
+			*image = *gray;
+			run_pipeline(*pipeline, *image, *buffers);
+		};
+	});
+}
+
+void add_label_case(const std::string& name, Connectivity connectivity, bool measure) {
+	add_case(name, [connectivity, measure](BenchInput& input) -> std::function<void()> {
+		std::shared_ptr<Image32> labels = std::make_shared<Image32>(input.width, input.height);
+		std::shared_ptr<BlobStats> stats = std::make_shared<BlobStats>();
+		const Image8* mask = &input.mask;
+		return [connectivity, measure, labels, stats, mask]() {
+			label_components(*labels, *mask, connectivity, measure ? stats.get() : nullptr);
+		};
+	});
+}
+
+void add_distance_case(const std::string& name, DistanceMetric metric) {
+	add_case(name, [metric](BenchInput& input) -> std::function<void()> {
+		std::shared_ptr<Image32> out = std::make_shared<Image32>(input.width, input.height);
+		const Image8* mask = &input.mask;
+		return [metric, out, mask]() { distance_transform(*out, *mask, metric); };
+	});
+}
+
+void add_distance_erode_case(const std::string& name, int radius) {
+	add_case(name, [radius](BenchInput& input) -> std::function<void()> {
+		std::shared_ptr<Image8> out = std::make_shared<Image8>(input.width, input.height);
+		const Image8* mask = &input.mask;
+		return [radius, out, mask]() { distance_erode(*out, *mask, radius); };
+	});
+}
+
+void add_morphology_case(const std::string& name, int radius, StructuringElement shape) {
+	add_case(name, [radius, shape](BenchInput& input) -> std::function<void()> {
+		std::shared_ptr<Image8> out = std::make_shared<Image8>(input.width, input.height);
+		const Image8* gray = &input.gray;
+		return [radius, shape, out, gray]() { grayscale_erode(*out, *gray, radius, shape); };
+	});
+}
+
+void add_median_case(const std::string& name, int radius) {
+	add_case(name, [radius](BenchInput& input) -> std::function<void()> {
+		std::shared_ptr<Image8> out = std::make_shared<Image8>(input.width, input.height);
+		const Image8* gray = &input.gray;
+		return [radius, out, gray]() { grayscale_median(*out, *gray, radius); };
+	});
+}
+
+void add_canny_case(const std::string& name, GradientOperator gradient, bool l2) {
+	add_case(name, [gradient, l2](BenchInput& input) -> std::function<void()> {
+		std::shared_ptr<Image8> out = std::make_shared<Image8>(input.width, input.height);
+		const Image8* gray = &input.gray;
+		CannyOptions options;
+		options.gradient = gradient;
+		options.l2 = l2;
+		return [options, out, gray]() { canny(*out, *gray, options); };
+	});
+}
+
+void add_convolve_case(const std::string& name, ConvolutionKernel kernel, ConvolutionPath path) {
+	add_case(name, [kernel, path](BenchInput& input) -> std::function<void()> {
+		std::shared_ptr<Image8> out = std::make_shared<Image8>(input.width, input.height);
+		const Image8* gray = &input.gray;
+		ConvolutionOptions options;
+		options.path = path;
+		return [kernel, options, out, gray]() { grayscale_convolve(*out, *gray, kernel, options); };
+	});
+}
+
+// a single strip is the serial encoder; mask is the 0/255 display of input.mask
+void add_png_case(const std::string& name, const std::string& preset, bool mask) {
+	add_case(name, [preset, mask](BenchInput& input) -> std::function<void()> {
+		std::string path = input.png_path + ".out";
+		PngOptions options;
+		parse_png_preset(preset, options);
+		std::shared_ptr<Image8> image = std::make_shared<Image8>(mask ? input.mask : input.gray);
+		if (mask)
+			apply_point_lut(make_point_lut(bit_display), *image);
+		else
+			options.strip_rows = image->height();
+		return [path, options, image]() { write_png_parallel(path.c_str(), PNG_COLOR_TYPE_GRAY, 8, *image, options); };
+	});
+}
+
+// input of channels samples of bit_depth bits, from the rgb image's bytes
+void add_gray_case(const std::string& name, int channels, int bit_depth, GrayWeights weights) {
+	add_case(name, [channels, bit_depth, weights](BenchInput& input) -> std::function<void()> {
+		std::shared_ptr<Image8> pixels = std::make_shared<Image8>(input.width, input.height, channels * bit_depth / 8);
+		for (int y = 0; y < input.height; ++y) {
+			const uint8_t* source = input.rgb[y];
+			uint8_t* destination = (*pixels)[y];
+			for (size_t offset = 0; offset < pixels->row_bytes(); ++offset)
+				destination[offset] = source[offset % input.rgb.row_bytes()];
+		}
+		std::shared_ptr<Image8> out = std::make_shared<Image8>(input.width, input.height);
+		return [pixels, out, channels, bit_depth, weights]() {
+			for (int y = 0; y < out->height(); ++y)
+				gray_row((*out)[y], (*pixels)[y], out->width(), channels, bit_depth, weights);
+		};
+	});
+}
+
+void register_cases() {
+	add_point_case("grayscale_set", [](int value){return grayscale_set(value, 100);});
+	add_point_case("grayscale_brighten", [](int value){return grayscale_brighten(value, 100);});
+	add_point_case("grayscale_stretch", [](int value){return grayscale_stretch(value, 5, -100);});
+	add_point_case("grayscale_invert", grayscale_invert);
+	add_point_case("grayscale_threshold", [](int value){return grayscale_threshold(value, 100);});
+	add_point_case("grayscale_invert_threshold", [](int value){return grayscale_invert_threshold(value, 100);});
+	add_point_case("bit_display", bit_display);
+	add_point_case("bit_invert_display", bit_invert_display);
+	add_point_case("bit_not", bit_not);
+	add_point_case("bit_invert", bit_invert);
+	add_binary_point_case("grayscale_copy", grayscale_copy);
+	add_binary_point_case("grayscale_add", grayscale_add);
+	add_binary_point_case("grayscale_average", grayscale_average);
+	add_binary_point_case("grayscale_learn_average", grayscale_learn_average);
+	add_binary_point_case("bit_and", bit_and);
+	add_case("BackgroundModel update", [](BenchInput& input) -> std::function<void()> {
+		// the model starts from the first frame, so every timed run is an update
+		std::shared_ptr<BackgroundModel> model = std::make_shared<BackgroundModel>();
+		std::shared_ptr<Image8> mask = std::make_shared<Image8>();
+		const Image8* gray = &input.gray;
+		model->update(*gray, *mask);
+		return [model, mask, gray]() { model->update(*gray, *mask); };
+	});
+	add_case("apply_point_lut stretch,threshold,display", [](BenchInput& input) -> std::function<void()> {
+		std::shared_ptr<Image8> image = std::make_shared<Image8>(input.gray);
+		PointLut chain = make_point_chain(
+			[](int value){return grayscale_stretch(value, 5, -100);},
+			[](int value){return grayscale_threshold(value, 100);},
+			bit_display);
+		return [chain, image]() { apply_point_lut(chain, *image); };
+	});
+
+	add_kernel_case("shrink", shrink);
+	add_kernel_case("expand", expand);
+	add_kernel_case("edge", edge);
+	add_kernel_case("salt", salt);
+	add_kernel_case("pepper", pepper);
+	add_kernel_case("noise", noise);
+	add_kernel_case("noize", noize);
+	add_case("shrink extended reflect", [](BenchInput& input) -> std::function<void()> {
+		std::shared_ptr<Image8> out = std::make_shared<Image8>(input.width, input.height);
+		const Image8* mask = &input.mask;
+		NeighbourhoodOptions options;
+		options.extend = true;
+		options.border = BorderMode::reflect;
+		return [out, mask, options]() { neighbourhood_apply<ShrinkNeighbourhood>(*out, *mask, options); };
+	});
+	add_case("binary_threshold", [](BenchInput& input) -> std::function<void()> {
+		std::shared_ptr<BinaryImage> bits = std::make_shared<BinaryImage>();
+		const Image8* gray = &input.gray;
+		return [bits, gray]() { binary_threshold(*bits, *gray, 128); };
+	});
+	add_packed_case("binary_shrink", binary_shrink);
+	add_packed_case("binary_expand", binary_expand);
+	add_packed_case("binary_edge", binary_edge);
+	add_packed_case("binary_salt", binary_salt);
+	add_packed_case("binary_pepper", binary_pepper);
+	add_packed_case("binary_noise", binary_noise);
+	add_packed_case("binary_noize", binary_noize);
+
+	add_convolve_case("grayscale_convolve box 3x3", box_kernel(3, 3), ConvolutionPath::automatic);
+	add_convolve_case("grayscale_convolve box 3x3 direct", box_kernel(3, 3), ConvolutionPath::direct);
+	add_convolve_case("grayscale_convolve gaussian 13x13", gaussian_kernel(2.0f), ConvolutionPath::automatic);
+	add_convolve_case("grayscale_convolve gaussian 13x13 direct", gaussian_kernel(2.0f), ConvolutionPath::direct);
+	add_convolve_case("grayscale_convolve gaussian 37x37 fft", gaussian_kernel(6.0f), ConvolutionPath::fft);
+	for (int radius : {8, 64}) {
+		add_case("box_blur radius " + std::to_string(radius), [radius](BenchInput& input) -> std::function<void()> {
+			std::shared_ptr<Image8> out = std::make_shared<Image8>(input.width, input.height);
+			const Image8* gray = &input.gray;
+			return [radius, out, gray]() { box_blur(*out, *gray, radius, radius); };
+		});
+	}
+	add_case("adaptive_threshold radius 15", [](BenchInput& input) -> std::function<void()> {
+		std::shared_ptr<Image8> out = std::make_shared<Image8>(input.width, input.height);
+		const Image8* gray = &input.gray;
+		return [out, gray]() { adaptive_threshold(*out, *gray, 15, 5); };
+	});
+	add_case("grayscale_histogram", [](BenchInput& input) -> std::function<void()> {
+		std::shared_ptr<Histogram> histogram = std::make_shared<Histogram>();
+		const Image8* gray = &input.gray;
+		return [histogram, gray]() { grayscale_histogram(*histogram, *gray); };
+	});
+	add_case("single_channel_apply stretch", [](BenchInput& input) -> std::function<void()> {
+		// the pass a histogram should cost well under
+		std::shared_ptr<Image8> image = std::make_shared<Image8>(input.gray);
+		return [image]() { single_channel_apply([](int value){return grayscale_stretch(value, 1.0f, 0);}, *image); };
+	});
+	add_label_case("label_components four", Connectivity::four, false);
+	add_label_case("label_components eight", Connectivity::eight, false);
+	add_label_case("label_components eight with stats", Connectivity::eight, true);
+	add_case("shrink until stable", [](BenchInput& input) -> std::function<void()> {
+		// includes copying the mask back in for every run
+		std::shared_ptr<Image8> image = std::make_shared<Image8>(input.width, input.height);
+		const Image8* mask = &input.mask;
+		return [image, mask]() { *image = *mask; iterate_until_stable(shrink, *image); };
+	});
+	add_morphology_case("grayscale_erode square radius 8", 8, StructuringElement::square);
+	add_morphology_case("grayscale_erode diamond radius 8", 8, StructuringElement::diamond);
+	add_morphology_case("grayscale_erode disc radius 8", 8, StructuringElement::disc);
+	add_morphology_case("grayscale_erode disc radius 32", 32, StructuringElement::disc);
+	add_distance_case("distance_transform euclidean", DistanceMetric::euclidean);
+	add_distance_case("distance_transform chamfer", DistanceMetric::chamfer);
+	add_distance_case("distance_transform city_block", DistanceMetric::city_block);
+	add_distance_erode_case("distance_erode radius 8", 8);
+	add_distance_erode_case("distance_erode radius 32", 32);
+	add_kernel_case("median", median);
+	add_median_case("grayscale_median radius 1", 1);
+	add_median_case("grayscale_median radius 2", 2);
+	add_median_case("grayscale_median radius 3", 3);
+	add_median_case("grayscale_median radius 8", 8);
+	add_median_case("grayscale_median radius 32", 32);
+	add_median_case("grayscale_median radius 128", 128);
+	add_canny_case("canny sobel", GradientOperator::sobel, false);
+	add_canny_case("canny sobel l2", GradientOperator::sobel, true);
+	add_canny_case("canny scharr", GradientOperator::scharr, false);
+
+	add_gray_case("gray_row rgb equal", 3, 8, GrayWeights::equal);
+	add_gray_case("gray_row rgb bt601", 3, 8, GrayWeights::bt601);
+	add_gray_case("gray_row rgba bt709", 4, 8, GrayWeights::bt709);
+	add_gray_case("gray_row gray alpha equal", 2, 8, GrayWeights::equal);
+	add_gray_case("gray_row rgb16 bt601", 3, 16, GrayWeights::bt601);
+	add_case("write_png_file gray", [](BenchInput& input) -> std::function<void()> {
+		std::string path = input.png_path + ".out";
+		const Image8* gray = &input.gray;
+		return [path, gray]() { write_png_file(path.c_str(), PNG_COLOR_TYPE_GRAY, 8, *gray); };
+	});
+	add_png_case("write_png_parallel gray one strip", "default", false);
+	add_png_case("write_png_parallel mask", "default", true);
+	add_png_case("write_png_parallel mask fast", "fast", true);
+	add_case("read_png_file gray", [](BenchInput& input) -> std::function<void()> {
+		std::shared_ptr<Image8> image = std::make_shared<Image8>();
+		std::string path = input.png_path;
+		return [image, path]() {
+			int width, height, passes, stride;
+			png_byte color_type, bit_depth;
+			read_png_file(path.c_str(), width, height, color_type, bit_depth, passes, stride, *image);
+		};
+	});
+	add_case("read_png_gray rgb bt601", [](BenchInput& input) -> std::function<void()> {
+		std::shared_ptr<Image8> image = std::make_shared<Image8>();
+		std::string path = input.png_path + ".rgb";
+		write_png_file(path.c_str(), PNG_COLOR_TYPE_RGB, 8, input.rgb);
+		return [image, path]() {
+			int width, height, passes, stride;
+			png_byte color_type, bit_depth;
+			read_png_gray(path.c_str(), width, height, color_type, bit_depth, passes, stride, GrayWeights::bt601, *image);
+		};
+	});
+	add_case("write_pnm_file gray", [](BenchInput& input) -> std::function<void()> {
+		std::string path = input.png_path + ".pgm";
+		const Image8* gray = &input.gray;
+		return [path, gray]() { write_pnm_file(path.c_str(), *gray); };
+	});
+	add_case("read_mapped_gray pgm", [](BenchInput& input) -> std::function<void()> {
+		// mapping only; the pages fault in as the first operator touches them
+		std::shared_ptr<Image8> image = std::make_shared<Image8>();
+		std::string path = input.png_path + ".pgm";
+		write_pnm_file(path.c_str(), input.gray);
+		return [image, path]() {
+			int width, height, channels, bit_depth;
+			read_mapped_gray(path.c_str(), width, height, channels, bit_depth, GrayWeights::equal, *image);
+		};
+	});
+	add_case("read_mapped_gray pgm and histogram", [](BenchInput& input) -> std::function<void()> {
+		std::shared_ptr<Image8> image = std::make_shared<Image8>();
+		std::shared_ptr<Histogram> histogram = std::make_shared<Histogram>();
+		std::string path = input.png_path + ".pgm";
+		write_pnm_file(path.c_str(), input.gray);
+		return [image, histogram, path]() {
+			int width, height, channels, bit_depth;
+			read_mapped_gray(path.c_str(), width, height, channels, bit_depth, GrayWeights::equal, *image);
+			grayscale_histogram(*histogram, *image);
+		};
+	});
+	add_pipeline_case("threshold:100,shrink*3,display");
+	add_pipeline_case("otsu,display");
+	add_pipeline_case("equalize");
+}
+
+struct BenchResult {
+	double seconds;
+	double pixels_per_cycle;
+};
+
+// the best of repetitions runs, after one untimed warm-up run
+BenchResult run_case(const std::function<void()>& body, size_t pixels, int repetitions) {
+	body();
+	BenchResult best = {1e30, 0.0};
+	for (int repetition = 0; repetition < repetitions; ++repetition) {
+		auto start = std::chrono::steady_clock::now();
+		uint64_t start_cycles = cycle_count();
+		body();
+		uint64_t cycles = cycle_count() - start_cycles;
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (seconds < best.seconds) {
+			best.seconds = seconds;
+			best.pixels_per_cycle = cycles ? static_cast<double>(pixels) / cycles : 0.0;
+		}
+	}
+	return best;
+}
+
+// Baselines are lines of "name<tab>pixels per cycle"; # lines are comments.
+int load_baseline(const char* path, std::map<std::string, double>& baseline) {
+	std::ifstream file(path);
+	if (!file) {
+		std::cerr << "[load_baseline] File " << path << " could not be opened for reading" << std::endl;
+		return 1;
+	}
+	std::string line;
+	while (std::getline(file, line)) {
+		if (line.empty() || line[0] == '#')
+			continue;
+		size_t tab = line.rfind('\t');
+		if (tab == std::string::npos)
+			continue;
+		baseline[line.substr(0, tab)] = std::atof(line.c_str() + tab + 1);
+	}
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	int width = 1920;
+	int height = 1080;
+	double density = 0.3;
+	int repetitions = 10;
+	double tolerance = 0.1;
+	std::string filter;
+	const char* baseline_path = nullptr;
+	const char* save_path = nullptr;
+	bool validate_only = false;
+	for (int index = 1; index < argc; ++index) {
+		std::string argument = argv[index];
+		bool has_value = index + 1 < argc;
+		if (argument == "--size" && has_value) {
+			if (std::sscanf(argv[++index], "%dx%d", &width, &height) != 2 || width < 3 || height < 3) {
+				std::cerr << "[main] Bad size " << argv[index] << std::endl;
+				return 2;
+			}
+		} else if (argument == "--density" && has_value) {
+			density = std::atof(argv[++index]);
+		} else if (argument == "--repetitions" && has_value) {
+			repetitions = std::max(1, std::atoi(argv[++index]));
+		} else if (argument == "--filter" && has_value) {
+			filter = argv[++index];
+		} else if (argument == "--threads" && has_value) {
+			set_thread_count(std::atoi(argv[++index]));
+		} else if (argument == "--isa" && has_value) {
+			IsaLevel level;
+			if (!parse_isa_level(argv[++index], level)) {
+				std::cerr << "[main] Unknown instruction set level " << argv[index] << std::endl;
+				return 2;
+			}
+			set_isa_level(level);
+		} else if (argument == "--validate") {
+			validate_only = true;
+		} else if (argument == "--baseline" && has_value) {
+			baseline_path = argv[++index];
+		} else if (argument == "--save-baseline" && has_value) {
+			save_path = argv[++index];
+		} else if (argument == "--tolerance" && has_value) {
+			tolerance = std::atof(argv[++index]);
+		} else {
+			std::cerr << "[main] Unknown argument " << argv[index] << std::endl;
+			return 2;
+		}
+	}
+
+	int failures = validate_pixel_kernels();
+	std::printf("kernels validated against scalar up to %s: %d differ\n", isa_level_name(detected_isa_level()), failures);
+	if (failures > 0 || validate_only)
+		return failures > 0 ? 1 : 0;
+
+	std::map<std::string, double> baseline;
+	if (baseline_path && load_baseline(baseline_path, baseline) != 0)
+		return 2;
+
+	BenchInput input;
+	input.width = width;
+	input.height = height;
+	input.density = density;
+	make_synthetic_image(input.gray, input.mask, width, height, density, 1);
+	make_rgb(input.rgb, input.gray);
+	binary_from_image(input.bits, input.mask);
+	char png_path[] = "/tmp/bench_suite_XXXXXX";
+	int descriptor = mkstemp(png_path);
+	if (descriptor < 0) {
+		std::cerr << "[main] Could not create a temporary file" << std::endl;
+		return 2;
+	}
+	close(descriptor);
+	input.png_path = png_path;
+	write_png_file(png_path, PNG_COLOR_TYPE_GRAY, 8, input.gray);
+
+	register_cases();
+	size_t pixels = static_cast<size_t>(width) * height;
+	std::printf("%dx%d, density %.2f, %d threads, %s kernels, best of %d\n", width, height, density, thread_count(),
+		isa_level_name(isa_level()), repetitions);
+	std::printf("%-44s %10s %12s %10s %10s\n", "case", "ms", "Mpixel/s", "pixel/cyc", "baseline");
+
+	FILE* save = save_path ? std::fopen(save_path, "w") : nullptr;
+	if (save_path && !save) {
+		std::cerr << "[main] File " << save_path << " could not be opened for writing" << std::endl;
+		return 2;
+	}
+	if (save)
+		std::fprintf(save, "# %dx%d density %.2f threads %d isa %s\n", width, height, density, thread_count(), isa_level_name(isa_level()));
+
+	int regressions = 0;
+	for (const BenchCase& bench : bench_cases()) {
+		if (!filter.empty() && bench.name.find(filter) == std::string::npos)
+			continue;
+		std::function<void()> body = bench.prepare(input);
+		BenchResult result = run_case(body, pixels, repetitions);
+		std::printf("%-44s %10.3f %12.1f %10.4f", bench.name.c_str(), result.seconds * 1e3,
+			pixels / result.seconds * 1e-6, result.pixels_per_cycle);
+		auto found = baseline.find(bench.name);
+		if (found != baseline.end() && found->second > 0.0) {
+			double ratio = result.pixels_per_cycle / found->second;
+			bool regressed = ratio < 1.0 - tolerance;
+			std::printf(" %9.2fx%s", ratio, regressed ? "  REGRESSION" : "");
+			if (regressed)
+				++regressions;
+		}
+		std::printf("\n");
+		if (save)
+			std::fprintf(save, "%s\t%.6f\n", bench.name.c_str(), result.pixels_per_cycle);
+	}
+	if (save)
+		std::fclose(save);
+	std::remove(png_path);
+	std::remove((input.png_path + ".out").c_str());
+	std::remove((input.png_path + ".rgb").c_str());
+	std::remove((input.png_path + ".pgm").c_str());
+
+	if (regressions > 0) {
+		std::printf("%d cases regressed by more than %.0f%%\n", regressions, tolerance * 100);
+		return 1;
+	}
+	return 0;
+}
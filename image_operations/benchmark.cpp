@@ -0,0 +1,322 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <thread>
+
+#include "binary_image.h"
+#include "convolution.h"
+#include "fft_convolution.h"
+#include "image.h"
+#include "integral_image.h"
+#include "neighbourhood_operations.h"
+#include "point_operations.h"
+#include "thread_pool.h"
+
+// the std::function engine single_channel_apply used to be, kept as the baseline
+void function_single_channel_apply(std::function<int(int)> fn, Image8& image) {
+	for (int y = 0; y < image.height(); ++y) {
+		uint8_t* row = image[y];
+		for (int x = 0; x < image.width(); ++x) {
+			row[x] = std::max(0, std::min(255, fn(row[x])));
+		}
+	}
+}
+
+void fill_random(Image8& image, unsigned int seed) {
+	std::mt19937 generator(seed);
+	std::uniform_int_distribution<int> distribution(0, 255);
+	for (int y = 0; y < image.height(); ++y) {
+		uint8_t* row = image[y];
+		for (size_t x = 0; x < image.row_elements(); ++x)
+			row[x] = static_cast<uint8_t>(distribution(generator));
+	}
+}
+
+// best of several runs, in seconds
+template <typename Fn>
+double time_best(Fn fn, int repetitions) {
+	double best = 1e30;
+	for (int repetition = 0; repetition < repetitions; ++repetition) {
+		auto start = std::chrono::steady_clock::now();
+		fn();
+		auto stop = std::chrono::steady_clock::now();
+		best = std::min(best, std::chrono::duration<double>(stop - start).count());
+	}
+	return best;
+}
+
+void report(const char* name, double seconds, double baseline_seconds, size_t pixels) {
+	std::printf("%-36s %10.3f ms %10.1f Mpixel/s %8.2fx\n",
+		name, seconds * 1e3, pixels / seconds * 1e-6, baseline_seconds / seconds);
+}
+
+template <typename Fn>
+void benchmark_point_operation(const char* name, Fn fn, Image8& image, int repetitions) {
+	size_t pixels = static_cast<size_t>(image.width()) * image.height();
+	PointLut lut = make_point_lut(fn);
+
+	double function_seconds = time_best([&]{ function_single_channel_apply(fn, image); }, repetitions);
+	double template_seconds = time_best([&]{ single_channel_apply(fn, image); }, repetitions);
+	double lut_scalar_seconds = time_best([&]{
+		for (int y = 0; y < image.height(); ++y)
+			apply_point_lut_row_scalar(lut, image[y], image.row_elements());
+	}, repetitions);
+	double lut_seconds = time_best([&]{ apply_point_lut(lut, image); }, repetitions);
+
+	std::printf("%s\n", name);
+	report("  std::function", function_seconds, function_seconds, pixels);
+	report("  template", template_seconds, function_seconds, pixels);
+	report("  lut scalar", lut_scalar_seconds, function_seconds, pixels);
+	report("  lut shuffle", lut_seconds, function_seconds, pixels);
+}
+
+// stretch -> threshold -> display as three passes against one fused table
+void benchmark_point_chain(Image8& image, int repetitions) {
+	size_t pixels = static_cast<size_t>(image.width()) * image.height();
+	auto stretch = [](int value){return grayscale_stretch(value, 5, -100);};
+	auto threshold = [](int value){return grayscale_threshold(value, 100);};
+	auto display = [](int value){return bit_display(value);};
+	PointLut stretch_lut = make_point_lut(stretch);
+	PointLut threshold_lut = make_point_lut(threshold);
+	PointLut display_lut = make_point_lut(display);
+	PointLut chain = make_point_chain(stretch, threshold, display);
+
+	double function_seconds = time_best([&]{
+		function_single_channel_apply(stretch, image);
+		function_single_channel_apply(threshold, image);
+		function_single_channel_apply(display, image);
+	}, repetitions);
+	double template_seconds = time_best([&]{
+		single_channel_apply(stretch, image);
+		single_channel_apply(threshold, image);
+		single_channel_apply(display, image);
+	}, repetitions);
+	double lut_seconds = time_best([&]{
+		apply_point_lut(stretch_lut, image);
+		apply_point_lut(threshold_lut, image);
+		apply_point_lut(display_lut, image);
+	}, repetitions);
+	double chain_seconds = time_best([&]{ apply_point_lut(chain, image); }, repetitions);
+
+	std::printf("stretch -> threshold -> bit_display\n");
+	report("  std::function, 3 passes", function_seconds, function_seconds, pixels);
+	report("  template, 3 passes", template_seconds, function_seconds, pixels);
+	report("  lut, 3 passes", lut_seconds, function_seconds, pixels);
+	report("  fused chain, 1 pass", chain_seconds, function_seconds, pixels);
+}
+
+// byte-per-pixel single_channel_kernel against the packed word-parallel operator
+void benchmark_binary_operation(const char* name,
+	void (*byte_operation)(Image8&, const Image8&, int, int),
+	void (*binary_operation)(BinaryImage&, const BinaryImage&),
+	const Image8& image, int repetitions)
+{
+	size_t pixels = static_cast<size_t>(image.width()) * image.height();
+	Image8 bytes = image;
+	single_channel_apply([](int value){return grayscale_threshold(value, 128);}, bytes);
+	Image8 byte_out(image.width(), image.height());
+	BinaryImage bits;
+	BinaryImage bit_out;
+	binary_threshold(bits, image, 128);
+
+	double byte_seconds = time_best([&]{ single_channel_kernel(byte_operation, byte_out, bytes); }, repetitions);
+	double binary_seconds = time_best([&]{ binary_operation(bit_out, bits); }, repetitions);
+
+	std::printf("%s\n", name);
+	report("  bytes, single_channel_kernel", byte_seconds, byte_seconds, pixels);
+	report("  packed bits", binary_seconds, byte_seconds, pixels);
+}
+
+// the fixed 3x3 per-pixel convolution grayscale_convolve used to be, kept as the baseline
+void legacy_grayscale_convolve(Image8& out, const Image8& in, int x_in, int y_in, const float* kernel) {
+	if (x_in - 1 < 0 || y_in - 1 < 0 || x_in + 1 > in.width() - 1 || y_in + 1 > in.height() - 1) {
+		out[y_in][x_in] = in[y_in][x_in];
+		return;
+	}
+	int kernel_index = 0;
+	float value = 0.0f;
+	for (int y = y_in - 1; y < y_in + 2; ++y) {
+		for (int x = x_in - 1; x < x_in + 2; ++x) {
+			value += static_cast<float>(in[y][x]) * kernel[kernel_index++];
+		}
+	}
+	out[y_in][x_in] = static_cast<int>(value);
+}
+
+void benchmark_convolution(const Image8& image, int repetitions) {
+	size_t pixels = static_cast<size_t>(image.width()) * image.height();
+	Image8 out(image.width(), image.height());
+	float box[9] = {1/9.0, 1/9.0, 1/9.0, 1/9.0, 1/9.0, 1/9.0, 1/9.0, 1/9.0, 1/9.0};
+
+	double legacy_seconds = time_best([&]{
+		single_channel_kernel([&](Image8& lhs, const Image8& rhs, int x_in, int y_in){legacy_grayscale_convolve(lhs, rhs, x_in, y_in, box);}, out, image);
+	}, repetitions);
+	double box_seconds = time_best([&]{ grayscale_convolve(out, image, box_kernel(3, 3)); }, repetitions);
+	std::printf("3x3 box blur\n");
+	report("  per-pixel std::function", legacy_seconds, legacy_seconds, pixels);
+	report("  grayscale_convolve", box_seconds, legacy_seconds, pixels);
+
+	for (float sigma : {1.0f, 3.0f, 6.0f}) {
+		ConvolutionKernel kernel = gaussian_kernel(sigma);
+		ConvolutionOptions options;
+		options.path = ConvolutionPath::direct;
+		options.fixed_point = false;
+		double direct_seconds = time_best([&]{ grayscale_convolve(out, image, kernel, options); }, repetitions);
+		options.path = ConvolutionPath::separable;
+		double separable_float_seconds = time_best([&]{ grayscale_convolve(out, image, kernel, options); }, repetitions);
+		options.fixed_point = true;
+		double separable_fixed_seconds = time_best([&]{ grayscale_convolve(out, image, kernel, options); }, repetitions);
+
+		std::printf("gaussian sigma %.0f, %dx%d\n", sigma, kernel.width, kernel.height);
+		report("  direct float", direct_seconds, direct_seconds, pixels);
+		report("  separable float", separable_float_seconds, direct_seconds, pixels);
+		report("  separable fixed point", separable_fixed_seconds, direct_seconds, pixels);
+	}
+
+	// discs are not separable, which is where the FFT path pays off
+	for (int radius : {4, 8, 15}) {
+		int size = 2 * radius + 1;
+		std::vector<float> values(size * size, 0.0f);
+		int count = 0;
+		for (int y = -radius; y <= radius; ++y)
+			for (int x = -radius; x <= radius; ++x)
+				if (x * x + y * y <= radius * radius)
+					++count;
+		for (int y = -radius; y <= radius; ++y)
+			for (int x = -radius; x <= radius; ++x)
+				if (x * x + y * y <= radius * radius)
+					values[(y + radius) * size + x + radius] = 1.0f / count;
+		ConvolutionKernel kernel = make_kernel(size, size, values.data());
+		ConvolutionOptions options;
+		options.path = ConvolutionPath::direct;
+		double direct_seconds = time_best([&]{ grayscale_convolve(out, image, kernel, options); }, repetitions);
+		options.path = ConvolutionPath::fft;
+		double fft_seconds = time_best([&]{ grayscale_convolve(out, image, kernel, options); }, repetitions);
+		bool fft_chosen = fft_cost_per_pixel(size, size, image.width(), image.height()) < size * size;
+
+		std::printf("disc radius %d, %dx%d, automatic picks %s\n", radius, size, size, fft_chosen ? "fft" : "direct");
+		report("  direct fixed point", direct_seconds, direct_seconds, pixels);
+		report("  fft overlap-save", fft_seconds, direct_seconds, pixels);
+	}
+}
+
+void benchmark_box_filter(const Image8& image, int repetitions) {
+	size_t pixels = static_cast<size_t>(image.width()) * image.height();
+	Image8 out(image.width(), image.height());
+	for (int radius : {1, 4, 16, 64}) {
+		ConvolutionKernel kernel = box_kernel(2 * radius + 1, 2 * radius + 1);
+		ConvolutionOptions options;
+		options.path = ConvolutionPath::separable;
+		double convolve_seconds = time_best([&]{ grayscale_convolve(out, image, kernel, options); }, repetitions);
+		double running_seconds = time_best([&]{ box_blur(out, image, radius, radius); }, repetitions);
+		double adaptive_seconds = time_best([&]{ adaptive_threshold(out, image, radius, 5); }, repetitions);
+
+		std::printf("box radius %d\n", radius);
+		report("  separable convolution", convolve_seconds, convolve_seconds, pixels);
+		report("  box_blur running sums", running_seconds, convolve_seconds, pixels);
+		report("  adaptive_threshold", adaptive_seconds, convolve_seconds, pixels);
+	}
+}
+
+bool same_pixels(const Image8& lhs, const Image8& rhs) {
+	for (int y = 0; y < lhs.height(); ++y)
+		for (int x = 0; x < lhs.width(); ++x)
+			if (lhs[y][x] != rhs[y][x])
+				return false;
+	return true;
+}
+
+// 1, 2, 4, ... up to max_threads, each checked against the single-threaded
+// result. Returns the number of thread counts whose output differs.
+int benchmark_thread_scaling(const Image8& image, int max_threads, int repetitions) {
+	size_t pixels = static_cast<size_t>(image.width()) * image.height();
+	auto stretch = [](int value){return grayscale_stretch(value, 5, -100);};
+	Image8 mask = image;
+	single_channel_apply([](int value){return grayscale_threshold(value, 128);}, mask);
+
+	set_thread_count(1);
+	Image8 serial_kernel(image.width(), image.height());
+	single_channel_kernel(shrink, serial_kernel, mask);
+	Image8 serial_apply = image;
+	single_channel_apply(stretch, serial_apply);
+
+	std::vector<int> counts;
+	for (int threads = 1; threads < max_threads; threads *= 2)
+		counts.push_back(threads);
+	counts.push_back(max_threads);
+
+	double kernel_baseline = 0.0;
+	double apply_baseline = 0.0;
+	int differing = 0;
+	std::printf("thread scaling\n");
+	for (int threads : counts) {
+		set_thread_count(threads);
+		Image8 kernel_out(image.width(), image.height());
+		double kernel_seconds = time_best([&]{ single_channel_kernel(shrink, kernel_out, mask); }, repetitions);
+		Image8 apply_out = image;
+		single_channel_apply(stretch, apply_out);
+		bool identical = same_pixels(kernel_out, serial_kernel) && same_pixels(apply_out, serial_apply);
+		Image8 scratch = image;
+		double apply_seconds = time_best([&]{ single_channel_apply(stretch, scratch); }, repetitions);
+		if (threads == 1) {
+			kernel_baseline = kernel_seconds;
+			apply_baseline = apply_seconds;
+		}
+
+		char name[64];
+		std::snprintf(name, sizeof(name), "  shrink kernel, %d threads", threads);
+		report(name, kernel_seconds, kernel_baseline, pixels);
+		std::snprintf(name, sizeof(name), "  stretch apply, %d threads", threads);
+		report(name, apply_seconds, apply_baseline, pixels);
+		if (!identical) {
+			std::printf("  output with %d threads differs from the serial output\n", threads);
+			++differing;
+		}
+	}
+	set_thread_count(0);
+	return differing;
+}
+
+int main(int argc, char** argv) {
+	int width = argc > 1 ? std::atoi(argv[1]) : 3840;
+	int height = argc > 2 ? std::atoi(argv[2]) : 2160;
+	int repetitions = argc > 3 ? std::atoi(argv[3]) : 10;
+	int max_threads = argc > 4 ? std::atoi(argv[4]) : static_cast<int>(std::thread::hardware_concurrency());
+	if (max_threads < 1)
+		max_threads = 1;
+
+	std::printf("Point operations on %dx%d 8-bit grayscale, best of %d\n", width, height, repetitions);
+	Image8 image(width, height);
+	fill_random(image, 1);
+
+	benchmark_point_operation("grayscale_threshold", [](int value){return grayscale_threshold(value, 100);}, image, repetitions);
+	benchmark_point_operation("grayscale_invert", [](int value){return grayscale_invert(value);}, image, repetitions);
+	benchmark_point_operation("grayscale_brighten", [](int value){return grayscale_brighten(value, 100);}, image, repetitions);
+	benchmark_point_operation("grayscale_stretch", [](int value){return grayscale_stretch(value, 5, -100);}, image, repetitions);
+	benchmark_point_chain(image, repetitions);
+
+	fill_random(image, 1);
+	size_t pixels = static_cast<size_t>(width) * height;
+	Image8 bytes = image;
+	BinaryImage bits;
+	double byte_threshold_seconds = time_best([&]{ single_channel_apply([](int value){return grayscale_threshold(value, 128);}, bytes); }, repetitions);
+	double binary_threshold_seconds = time_best([&]{ binary_threshold(bits, image, 128); }, repetitions);
+	std::printf("grayscale_threshold to a mask\n");
+	report("  bytes", byte_threshold_seconds, byte_threshold_seconds, pixels);
+	report("  packed bits", binary_threshold_seconds, byte_threshold_seconds, pixels);
+	benchmark_binary_operation("shrink", shrink, binary_shrink, image, repetitions);
+	benchmark_binary_operation("expand", expand, binary_expand, image, repetitions);
+	benchmark_binary_operation("edge", edge, binary_edge, image, repetitions);
+	benchmark_binary_operation("noize", noize, binary_noize, image, repetitions);
+
+	benchmark_convolution(image, repetitions);
+	benchmark_box_filter(image, repetitions);
+
+	// any difference between thread counts is a bug, not noise
+	if (benchmark_thread_scaling(image, max_threads, repetitions) != 0)
+		return 1;
+	return 0;
+}
@@ -0,0 +1,135 @@
+#include "binary_image.h"
+
+#include "thread_pool.h"
+
+#include <cstring>
+
+#include "pixel_kernels.h"
+
+namespace {
+
+void match_size(BinaryImage& out, const BinaryImage& in) {
+	if (out.width() != in.width() || out.height() != in.height())
+		out.resize(in.width(), in.height());
+}
+
+// the interior goes through the dispatched row kernel; edge alone clears the
+// border rather than keeping it
+void binary_neighbourhood(BinaryRule rule, BinaryImage& out, const BinaryImage& in) {
+	match_size(out, in);
+	bool clear_border = rule == BinaryRule::edge;
+	const PixelKernels& kernels = pixel_kernels();
+	int width = in.width();
+	int height = in.height();
+	int words = in.words_per_row();
+	if (words == 0)
+		return;
+	int first_word = 0;
+	int last_word = (width - 1) >> 6;
+	uint64_t first_bit = 1;
+	uint64_t last_bit = uint64_t(1) << ((width - 1) & 63);
+
+	parallel_rows(height, [&](int begin, int end) {
+		for (int y = begin; y < end; ++y) {
+			const uint64_t* centre = in.row(y);
+			uint64_t* destination = out.row(y);
+			if (y == 0 || y == height - 1) {
+				if (clear_border)
+					std::memset(destination, 0, words * sizeof(uint64_t));
+				else
+					std::memcpy(destination, centre, words * sizeof(uint64_t));
+				continue;
+			}
+			const uint64_t* above = in.row(y - 1);
+			const uint64_t* below = in.row(y + 1);
+
+			kernels.binary_row(rule, destination, above, centre, below, words);
+
+			// the first and last columns are border pixels
+			uint64_t first = clear_border ? 0 : centre[first_word] & first_bit;
+			destination[first_word] = (destination[first_word] & ~first_bit) | first;
+			uint64_t last = clear_border ? 0 : centre[last_word] & last_bit;
+			destination[last_word] = (destination[last_word] & ~last_bit) | last;
+			destination[words - 1] &= in.tail_mask();
+		}
+	});
+}
+
+}
+
+void binary_threshold(BinaryImage& out, const Image8& in, int threshold) {
+	int width = in.width();
+	int height = in.height();
+	if (out.width() != width || out.height() != height)
+		out.resize(width, height);
+	const PixelKernels& kernels = pixel_kernels();
+	parallel_rows(height, [&](int begin, int end) {
+		for (int y = begin; y < end; ++y)
+			kernels.threshold_row(out.row(y), in[y], width, threshold);
+	});
+}
+
+void binary_from_image(BinaryImage& out, const Image8& in) {
+	binary_threshold(out, in, 1);
+}
+
+void binary_to_image(Image8& out, const BinaryImage& in, uint8_t one) {
+	int width = in.width();
+	if (out.width() != width || out.height() != in.height() || out.channels() != 1)
+		out.resize(width, in.height());
+	for (int y = 0; y < in.height(); ++y) {
+		const uint64_t* source = in.row(y);
+		uint8_t* destination = out[y];
+		for (int x = 0; x < width; ++x)
+			destination[x] = ((source[x >> 6] >> (x & 63)) & 1) ? one : 0;
+	}
+}
+
+void binary_not(BinaryImage& image) {
+	int words = image.words_per_row();
+	for (int y = 0; y < image.height(); ++y) {
+		uint64_t* row = image.row(y);
+		for (int j = 0; j < words; ++j)
+			row[j] = ~row[j];
+		if (words > 0)
+			row[words - 1] &= image.tail_mask();
+	}
+}
+
+void binary_and(BinaryImage& lhs, const BinaryImage& rhs) {
+	int words = lhs.words_per_row();
+	for (int y = 0; y < lhs.height(); ++y) {
+		uint64_t* lhs_row = lhs.row(y);
+		const uint64_t* rhs_row = rhs.row(y);
+		for (int j = 0; j < words; ++j)
+			lhs_row[j] &= rhs_row[j];
+	}
+}
+
+void binary_shrink(BinaryImage& out, const BinaryImage& in) {
+	binary_neighbourhood(BinaryRule::shrink, out, in);
+}
+
+void binary_expand(BinaryImage& out, const BinaryImage& in) {
+	binary_neighbourhood(BinaryRule::expand, out, in);
+}
+
+void binary_edge(BinaryImage& out, const BinaryImage& in) {
+	binary_neighbourhood(BinaryRule::edge, out, in);
+}
+
+void binary_salt(BinaryImage& out, const BinaryImage& in) {
+	binary_neighbourhood(BinaryRule::salt, out, in);
+}
+
+void binary_pepper(BinaryImage& out, const BinaryImage& in) {
+	binary_neighbourhood(BinaryRule::pepper, out, in);
+}
+
+void binary_noise(BinaryImage& out, const BinaryImage& in) {
+	binary_neighbourhood(BinaryRule::noise, out, in);
+}
+
+void binary_noize(BinaryImage& out, const BinaryImage& in) {
+	binary_neighbourhood(BinaryRule::noize, out, in);
+}
@@ -0,0 +1,90 @@
+#ifndef BINARY_IMAGE_H
+#define BINARY_IMAGE_H
+
+#include <cstdint>
+
+#include "image.h"
+
+// One bit per pixel: pixel x of a row is bit x % 64 of word x / 64. Bits past
+// the width are always zero, and every row has a zero guard word on either
+// side so the neighbourhood operators can read word -1 and word
+// words_per_row() without bounds checks.
+class BinaryImage {
+public:
+	BinaryImage() {}
+
+	BinaryImage(int width, int height) {
+		resize(width, height);
+	}
+
+	void resize(int width, int height) {
+		width_ = width;
+		height_ = height;
+		words_per_row_ = (width + 63) / 64;
+		words_.resize(words_per_row_ + 2, height);
+		words_.fill(0);
+	}
+
+	uint64_t* row(int y) { return words_.row(y) + 1; }
+	const uint64_t* row(int y) const { return words_.row(y) + 1; }
+
+	bool get(int x, int y) const {
+		return (row(y)[x >> 6] >> (x & 63)) & 1;
+	}
+
+	void set(int x, int y, bool value) {
+		uint64_t bit = uint64_t(1) << (x & 63);
+		if (value)
+			row(y)[x >> 6] |= bit;
+		else
+			row(y)[x >> 6] &= ~bit;
+	}
+
+	// mask of the valid bits in the last word of a row
+	uint64_t tail_mask() const {
+		return width_ % 64 == 0 ? ~uint64_t(0) : (uint64_t(1) << (width_ % 64)) - 1;
+	}
+
+	int width() const { return width_; }
+	int height() const { return height_; }
+	int words_per_row() const { return words_per_row_; }
+
+	void swap(BinaryImage& other) noexcept {
+		words_.swap(other.words_);
+		int width = width_; width_ = other.width_; other.width_ = width;
+		int height = height_; height_ = other.height_; other.height_ = height;
+		int words_per_row = words_per_row_; words_per_row_ = other.words_per_row_; other.words_per_row_ = words_per_row;
+	}
+
+private:
+	Image<uint64_t> words_;
+	int width_ = 0;
+	int height_ = 0;
+	int words_per_row_ = 0;
+};
+
+inline void swap(BinaryImage& lhs, BinaryImage& rhs) noexcept {
+	lhs.swap(rhs);
+}
+
+// grayscale_threshold straight into packed bits: 1 where value >= threshold
+void binary_threshold(BinaryImage& out, const Image8& in, int threshold);
+// nonzero bytes become set bits
+void binary_from_image(BinaryImage& out, const Image8& in);
+// set bits become one, e.g. 1 for further byte processing or 255 for bit_display
+void binary_to_image(Image8& out, const BinaryImage& in, uint8_t one = 1);
+
+void binary_not(BinaryImage& image);
+void binary_and(BinaryImage& lhs, const BinaryImage& rhs);
+
+// word-parallel equivalents of the 3x3 operators in neighbourhood_operations.h,
+// with the same border behaviour
+void binary_shrink(BinaryImage& out, const BinaryImage& in);
+void binary_expand(BinaryImage& out, const BinaryImage& in);
+void binary_edge(BinaryImage& out, const BinaryImage& in);
+void binary_salt(BinaryImage& out, const BinaryImage& in);
+void binary_pepper(BinaryImage& out, const BinaryImage& in);
+void binary_noise(BinaryImage& out, const BinaryImage& in);
+void binary_noize(BinaryImage& out, const BinaryImage& in);
+
+#endif
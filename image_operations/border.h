@@ -0,0 +1,35 @@
+#ifndef BORDER_H
+#define BORDER_H
+
+// How operators with a footprint larger than one pixel read past the edge:
+// replicate repeats the edge pixel (aa|abcd), reflect mirrors about it
+// (cb|abcd) and constant reads a fixed value.
+enum class BorderMode {
+	replicate,
+	reflect,
+	constant
+};
+
+// maps a row or column index into [0, size), or -1 for a constant border
+inline int border_index(int index, int size, BorderMode border) {
+	if (index >= 0 && index < size)
+		return index;
+	switch (border) {
+	case BorderMode::replicate:
+		return index < 0 ? 0 : size - 1;
+	case BorderMode::reflect: {
+		if (size == 1)
+			return 0;
+		int period = 2 * (size - 1);
+		index %= period;
+		if (index < 0)
+			index += period;
+		return index < size ? index : period - index;
+	}
+	case BorderMode::constant:
+		break;
+	}
+	return -1;
+}
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+// A blocking queue of at most capacity items between threads. push waits for
+// room and pop waits for an item; after close, push fails and pop drains what
+// is left before failing.
+template <typename T>
+class BoundedQueue {
+public:
+	explicit BoundedQueue(size_t capacity) : capacity_(capacity) {}
+
+	bool push(const T& value) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		not_full_.wait(lock, [this]{ return items_.size() < capacity_ || closed_; });
+		if (closed_)
+			return false;
+		items_.push_back(value);
+		lock.unlock();
+		not_empty_.notify_one();
+		return true;
+	}
+
+	bool pop(T& value) {
+		std::unique_lock<std::mutex> lock(mutex_);
+		not_empty_.wait(lock, [this]{ return !items_.empty() || closed_; });
+		if (items_.empty())
+			return false;
+		value = items_.front();
+		items_.pop_front();
+		lock.unlock();
+		not_full_.notify_one();
+		return true;
+	}
+
+	void close() {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			closed_ = true;
+		}
+		not_full_.notify_all();
+		not_empty_.notify_all();
+	}
+
+private:
+	size_t capacity_;
+	std::deque<T> items_;
+	bool closed_ = false;
+	std::mutex mutex_;
+	std::condition_variable not_full_;
+	std::condition_variable not_empty_;
+};
+
+#endif
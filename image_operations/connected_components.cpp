@@ -0,0 +1,315 @@
+#include "connected_components.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include "profiler.h"
+#include "thread_pool.h"
+
+namespace {
+
+uint32_t find_root(std::vector<uint32_t>& parent, uint32_t label) {
+	while (parent[label] != label) {
+		parent[label] = parent[parent[label]];
+		label = parent[label];
+	}
+	return label;
+}
+
+// the smaller root becomes the root of both, so a set's root is its first label
+void merge(std::vector<uint32_t>& parent, uint32_t a, uint32_t b) {
+	a = find_root(parent, a);
+	b = find_root(parent, b);
+	if (a < b)
+		parent[b] = a;
+	else if (b < a)
+		parent[a] = b;
+}
+
+// one row of pixels as 0/1, padded with a zero either side, so row[x + 1] is pixel x
+void load_row(std::vector<uint8_t>& row, const Image8& in, int y) {
+	std::fill(row.begin(), row.end(), 0);
+	if (y < 0 || y >= in.height())
+		return;
+	const uint8_t* source = in[y];
+	for (int x = 0; x < in.width(); ++x)
+		row[x + 1] = source[x] != 0;
+}
+
+struct Run {
+	uint32_t label;
+	int y;
+	int x0;
+	int x1;
+};
+
+// sum of 0^2 .. n^2
+uint64_t sum_of_squares(int64_t n) {
+	return n < 0 ? 0 : static_cast<uint64_t>(n * (n + 1) * (2 * n + 1) / 6);
+}
+
+class Labeler {
+public:
+	Labeler(const Image8& in, Connectivity connectivity)
+		: in_(in), block_(connectivity == Connectivity::eight ? 2 : 1)
+	{
+		blocks_x_ = (in.width() + block_ - 1) / block_;
+		blocks_y_ = (in.height() + block_ - 1) / block_;
+		block_labels_.assign(static_cast<size_t>(blocks_x_) * blocks_y_, 0);
+		parent_.resize(block_labels_.size() + 1);
+	}
+
+	int blocks_y() const { return blocks_y_; }
+
+	// Provisional labels for the block rows [begin, end), numbered from the
+	// band's first block so bands never share a label. Returns the count.
+	uint32_t label_band(int begin, int end) {
+		uint32_t first = static_cast<uint32_t>(static_cast<size_t>(begin) * blocks_x_) + 1;
+		uint32_t next = first;
+		Rows rows(in_.width());
+		for (int by = begin; by < end; ++by) {
+			rows.load(in_, by * block_, block_, by > begin);
+			uint32_t* labels = &block_labels_[static_cast<size_t>(by) * blocks_x_];
+			const uint32_t* above = by > begin ? labels - blocks_x_ : nullptr;
+			for (int bx = 0; bx < blocks_x_; ++bx) {
+				if (!rows.set(bx, block_))
+					continue;
+				uint32_t label = 0;
+				auto join = [&](uint32_t other) {
+					if (!label)
+						label = other;
+					else
+						merge(parent_, label, other);
+				};
+				if (bx > 0 && rows.left(bx, block_))
+					join(labels[bx - 1]);
+				if (above)
+					join_above(rows, bx, above, join);
+				if (!label) {
+					label = next++;
+					parent_[label] = label;
+				}
+				labels[bx] = label;
+			}
+		}
+		return next - first;
+	}
+
+	// unions across the edge above block row by
+	void merge_edge(int by) {
+		Rows rows(in_.width());
+		rows.load(in_, by * block_, block_, true);
+		const uint32_t* labels = &block_labels_[static_cast<size_t>(by) * blocks_x_];
+		const uint32_t* above = labels - blocks_x_;
+		for (int bx = 0; bx < blocks_x_; ++bx) {
+			if (!rows.set(bx, block_))
+				continue;
+			uint32_t label = labels[bx];
+			join_above(rows, bx, above, [&](uint32_t other) { merge(parent_, label, other); });
+		}
+	}
+
+	// final labels in order of the provisional ones; returns the count
+	uint32_t resolve(const std::vector<int>& band_begin, const std::vector<uint32_t>& band_count) {
+		final_.assign(parent_.size(), 0);
+		uint32_t count = 0;
+		for (size_t band = 0; band < band_count.size(); ++band) {
+			uint32_t first = static_cast<uint32_t>(static_cast<size_t>(band_begin[band]) * blocks_x_) + 1;
+			for (uint32_t label = first; label < first + band_count[band]; ++label) {
+				uint32_t root = find_root(parent_, label);
+				final_[label] = root == label ? ++count : final_[root];
+			}
+		}
+		return count;
+	}
+
+	// writes the final labels of block rows [begin, end) and their runs
+	void write_band(Image32& out, int begin, int end, std::vector<Run>* runs) const {
+		int width = in_.width();
+		for (int y = begin * block_; y < std::min(end * block_, in_.height()); ++y) {
+			const uint8_t* source = in_[y];
+			const uint32_t* labels = &block_labels_[static_cast<size_t>(y / block_) * blocks_x_];
+			uint32_t* destination = out[y];
+			for (int x = 0; x < width; ++x)
+				destination[x] = source[x] ? final_[labels[x / block_]] : 0;
+			if (!runs)
+				continue;
+			for (int x = 0; x < width;) {
+				uint32_t label = destination[x];
+				int x0 = x;
+				while (x < width && destination[x] == label)
+					++x;
+				if (label)
+					runs->push_back(Run{label, y, x0, x - 1});
+			}
+		}
+	}
+
+private:
+	// the pixel rows of one block row and the row just above it
+	struct Rows {
+		explicit Rows(int width) : above(width + 3), top(width + 3), bottom(width + 3) {}
+
+		void load(const Image8& in, int y, int block, bool with_above) {
+			load_row(above, in, with_above ? y - 1 : -1);
+			load_row(top, in, y);
+			load_row(bottom, in, block == 2 ? y + 1 : -1);
+		}
+
+		// pixel x is at x + 1
+		bool set(int bx, int block) const {
+			int x = bx * block + 1;
+			return top[x] || bottom[x] || (block == 2 && (top[x + 1] || bottom[x + 1]));
+		}
+
+		// the block's left column touches the block to its left
+		bool left(int bx, int block) const {
+			int x = bx * block + 1;
+			return (top[x] || bottom[x]) && (top[x - 1] || bottom[x - 1]);
+		}
+
+		std::vector<uint8_t> above;
+		std::vector<uint8_t> top;
+		std::vector<uint8_t> bottom;
+	};
+
+	// the upper left, upper and upper right blocks the top row touches; a
+	// single pixel only touches the one above under four-connectivity
+	template <typename Join>
+	void join_above(const Rows& rows, int bx, const uint32_t* above, Join join) const {
+		int x = bx * block_ + 1;
+		const std::vector<uint8_t>& top = rows.top;
+		const std::vector<uint8_t>& up = rows.above;
+		if (block_ == 1) {
+			if (top[x] && up[x])
+				join(above[bx]);
+			return;
+		}
+		if (top[x] && up[x - 1])
+			join(above[bx - 1]);
+		if ((top[x] || top[x + 1]) && (up[x] || up[x + 1]))
+			join(above[bx]);
+		if (top[x + 1] && up[x + 2])
+			join(above[bx + 1]);
+	}
+
+	const Image8& in_;
+	int block_;
+	int blocks_x_ = 0;
+	int blocks_y_ = 0;
+	std::vector<uint32_t> block_labels_;
+	std::vector<uint32_t> parent_;
+	std::vector<uint32_t> final_;
+};
+
+}
+
+void BlobStats::resize(size_t blobs) {
+	area.assign(blobs, 0);
+	min_x.assign(blobs, 0);
+	min_y.assign(blobs, 0);
+	max_x.assign(blobs, 0);
+	max_y.assign(blobs, 0);
+	sum_x.assign(blobs, 0);
+	sum_y.assign(blobs, 0);
+	sum_xx.assign(blobs, 0);
+	sum_xy.assign(blobs, 0);
+	sum_yy.assign(blobs, 0);
+}
+
+double BlobStats::mu20(size_t blob) const {
+	double x = centroid_x(blob);
+	return static_cast<double>(sum_xx[blob]) / area[blob] - x * x;
+}
+
+double BlobStats::mu02(size_t blob) const {
+	double y = centroid_y(blob);
+	return static_cast<double>(sum_yy[blob]) / area[blob] - y * y;
+}
+
+double BlobStats::mu11(size_t blob) const {
+	return static_cast<double>(sum_xy[blob]) / area[blob] - centroid_x(blob) * centroid_y(blob);
+}
+
+int label_components(Image32& labels, const Image8& in, Connectivity connectivity, BlobStats* stats) {
+	if (labels.width() != in.width() || labels.height() != in.height() || labels.channels() != 1)
+		labels.resize(in.width(), in.height());
+	size_t pixels = static_cast<size_t>(in.width()) * in.height();
+	ProfileScope scope("label_components", pixels, 5 * pixels);
+	if (stats)
+		stats->resize(0);
+	if (pixels == 0)
+		return 0;
+
+	Labeler labeler(in, connectivity);
+	// a couple of bands per thread, none shorter than 16 block rows
+	int block_rows = labeler.blocks_y();
+	int bands = std::max(1, std::min(2 * thread_count(), block_rows / 16));
+	std::vector<int> band_begin(bands + 1);
+	for (int band = 0; band <= bands; ++band)
+		band_begin[band] = static_cast<int>(static_cast<int64_t>(block_rows) * band / bands);
+	std::vector<uint32_t> band_count(bands);
+	default_thread_pool().parallel_for(0, bands, 1, [&](int begin, int end) {
+		for (int band = begin; band < end; ++band)
+			band_count[band] = labeler.label_band(band_begin[band], band_begin[band + 1]);
+	});
+	for (int band = 1; band < bands; ++band)
+		labeler.merge_edge(band_begin[band]);
+	uint32_t count = labeler.resolve(band_begin, band_count);
+
+	std::vector<std::vector<Run>> runs(stats ? bands : 0);
+	default_thread_pool().parallel_for(0, bands, 1, [&](int begin, int end) {
+		for (int band = begin; band < end; ++band)
+			labeler.write_band(labels, band_begin[band], band_begin[band + 1], stats ? &runs[band] : nullptr);
+	});
+
+	if (stats) {
+		stats->resize(count);
+		for (const std::vector<Run>& band : runs) {
+			for (const Run& run : band) {
+				size_t blob = run.label - 1;
+				uint64_t length = run.x1 - run.x0 + 1;
+				uint64_t xs = static_cast<uint64_t>(run.x0 + run.x1) * length / 2;
+				uint64_t y = run.y;
+				if (stats->area[blob] == 0) {
+					stats->min_x[blob] = run.x0;
+					stats->min_y[blob] = run.y;
+					stats->max_x[blob] = run.x1;
+					stats->max_y[blob] = run.y;
+				}
+				stats->area[blob] += static_cast<uint32_t>(length);
+				stats->min_x[blob] = std::min(stats->min_x[blob], run.x0);
+				stats->max_x[blob] = std::max(stats->max_x[blob], run.x1);
+				stats->max_y[blob] = std::max(stats->max_y[blob], run.y);
+				stats->sum_x[blob] += xs;
+				stats->sum_y[blob] += length * y;
+				stats->sum_xx[blob] += sum_of_squares(run.x1) - sum_of_squares(run.x0 - 1);
+				stats->sum_xy[blob] += xs * y;
+				stats->sum_yy[blob] += length * y * y;
+			}
+		}
+	}
+	return static_cast<int>(count);
+}
+
+int write_blob_stats(const char* path, const BlobStats& stats) {
+	FILE* file = std::fopen(path, "w");
+	if (!file) {
+		std::cerr << "[write_blob_stats] File " << path << " could not be opened for writing" << std::endl;
+		return 1;
+	}
+	std::fprintf(file, "label,area,min_x,min_y,max_x,max_y,centroid_x,centroid_y,mu20,mu02,mu11\n");
+	for (size_t blob = 0; blob < stats.size(); ++blob) {
+		std::fprintf(file, "%zu,%u,%d,%d,%d,%d,%.3f,%.3f,%.3f,%.3f,%.3f\n", blob + 1, stats.area[blob],
+			stats.min_x[blob], stats.min_y[blob], stats.max_x[blob], stats.max_y[blob],
+			stats.centroid_x(blob), stats.centroid_y(blob), stats.mu20(blob), stats.mu02(blob), stats.mu11(blob));
+	}
+	int result = std::ferror(file) ? 1 : 0;
+	if (std::fclose(file) != 0 || result != 0) {
+		std::cerr << "[write_blob_stats] Writing " << path << " failed" << std::endl;
+		return 1;
+	}
+	return 0;
+}
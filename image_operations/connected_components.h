@@ -0,0 +1,54 @@
+#ifndef CONNECTED_COMPONENTS_H
+#define CONNECTED_COMPONENTS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "image.h"
+
+enum class Connectivity {
+	four,
+	eight
+};
+
+// Measurements of every blob, one array per quantity indexed by label - 1.
+// The moments are raw sums over the blob's pixel coordinates, so the
+// measurements of two pieces of a blob add up to those of the whole.
+struct BlobStats {
+	std::vector<uint32_t> area;
+	std::vector<int> min_x;
+	std::vector<int> min_y;
+	std::vector<int> max_x;
+	std::vector<int> max_y;
+	std::vector<uint64_t> sum_x;
+	std::vector<uint64_t> sum_y;
+	std::vector<uint64_t> sum_xx;
+	std::vector<uint64_t> sum_xy;
+	std::vector<uint64_t> sum_yy;
+
+	size_t size() const { return area.size(); }
+	void resize(size_t blobs);
+
+	double centroid_x(size_t blob) const { return static_cast<double>(sum_x[blob]) / area[blob]; }
+	double centroid_y(size_t blob) const { return static_cast<double>(sum_y[blob]) / area[blob]; }
+	// second moments about the centroid, per pixel
+	double mu20(size_t blob) const;
+	double mu02(size_t blob) const;
+	double mu11(size_t blob) const;
+};
+
+// Labels the connected sets of nonzero pixels in in: labels[y][x] is 0 on
+// the background and 1 to the returned count on the blobs. Two-pass union
+// find over row bands in parallel, with the bands' labels merged along their
+// shared edges in between. For eight-connectivity the unit is a 2x2 block,
+// whose set pixels are always connected to each other, so the first pass
+// does a quarter of the unions. The second pass writes the final labels and,
+// when stats is given, collects the runs of each band for the measurements.
+int label_components(Image32& labels, const Image8& in, Connectivity connectivity = Connectivity::eight,
+	BlobStats* stats = nullptr);
+
+// the stats as CSV, one line per blob; returns 0 on success
+int write_blob_stats(const char* path, const BlobStats& stats);
+
+#endif
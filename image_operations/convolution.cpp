@@ -0,0 +1,389 @@
+#include "convolution.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "fft_convolution.h"
+#include "integral_image.h"
+#include "pixel_kernels.h"
+#include "thread_pool.h"
+
+ConvolutionKernel make_kernel(int width, int height, const float* values) {
+	ConvolutionKernel kernel;
+	kernel.width = width;
+	kernel.height = height;
+	kernel.values.assign(values, values + width * height);
+	return kernel;
+}
+
+ConvolutionKernel box_kernel(int width, int height) {
+	ConvolutionKernel kernel;
+	kernel.width = width;
+	kernel.height = height;
+	kernel.values.assign(width * height, 1.0f / (width * height));
+	return kernel;
+}
+
+ConvolutionKernel gaussian_kernel(float sigma, int radius) {
+	if (radius <= 0)
+		radius = std::max(1, static_cast<int>(std::ceil(3.0f * sigma)));
+	std::vector<double> profile(2 * radius + 1);
+	double total = 0.0;
+	for (int i = -radius; i <= radius; ++i) {
+		profile[i + radius] = std::exp(-0.5 * i * i / (static_cast<double>(sigma) * sigma));
+		total += profile[i + radius];
+	}
+	ConvolutionKernel kernel;
+	kernel.width = 2 * radius + 1;
+	kernel.height = 2 * radius + 1;
+	kernel.values.resize(kernel.width * kernel.height);
+	for (int y = 0; y < kernel.height; ++y)
+		for (int x = 0; x < kernel.width; ++x)
+			kernel.values[y * kernel.width + x] = static_cast<float>(profile[x] * profile[y] / (total * total));
+	return kernel;
+}
+
+ConvolutionKernel flip_kernel(const ConvolutionKernel& kernel) {
+	ConvolutionKernel flipped = kernel;
+	std::reverse(flipped.values.begin(), flipped.values.end());
+	return flipped;
+}
+
+bool separate_kernel(const ConvolutionKernel& kernel, std::vector<float>& column, std::vector<float>& row) {
+	// pivot on the largest element; a rank-1 kernel is then its pivot column
+	// times its pivot row divided by the pivot
+	int pivot_x = 0;
+	int pivot_y = 0;
+	float largest = 0.0f;
+	for (int y = 0; y < kernel.height; ++y) {
+		for (int x = 0; x < kernel.width; ++x) {
+			if (std::fabs(kernel.at(x, y)) > largest) {
+				largest = std::fabs(kernel.at(x, y));
+				pivot_x = x;
+				pivot_y = y;
+			}
+		}
+	}
+	if (largest == 0.0f)
+		return false;
+
+	column.resize(kernel.height);
+	row.resize(kernel.width);
+	double row_total = 0.0;
+	for (int x = 0; x < kernel.width; ++x) {
+		row[x] = kernel.at(x, pivot_y) / kernel.at(pivot_x, pivot_y);
+		row_total += std::fabs(row[x]);
+	}
+	for (int y = 0; y < kernel.height; ++y)
+		column[y] = kernel.at(pivot_x, y);
+
+	float tolerance = largest * 1e-5f;
+	for (int y = 0; y < kernel.height; ++y)
+		for (int x = 0; x < kernel.width; ++x)
+			if (std::fabs(kernel.at(x, y) - column[y] * row[x]) > tolerance)
+				return false;
+
+	// move the scale into the column so the horizontal pass has unit gain
+	for (int x = 0; x < kernel.width; ++x)
+		row[x] = static_cast<float>(row[x] / row_total);
+	for (int y = 0; y < kernel.height; ++y)
+		column[y] = static_cast<float>(column[y] * row_total);
+	return true;
+}
+
+namespace {
+
+// Scales weights by 2^shift into int16, taking the largest shift for which
+// both the weights fit int16 and sum |weight| * max_input fits an int32
+// accumulator. The rounding error of the total is folded into the largest
+// weight so a normalized kernel keeps exactly unit gain.
+bool quantize_weights(const std::vector<float>& weights, double max_input, int minimum_shift,
+	std::vector<int16_t>& quantized, int& shift)
+{
+	double largest = 0.0;
+	double total = 0.0;
+	double sum = 0.0;
+	size_t largest_index = 0;
+	for (size_t i = 0; i < weights.size(); ++i) {
+		if (std::fabs(weights[i]) > largest) {
+			largest = std::fabs(weights[i]);
+			largest_index = i;
+		}
+		total += std::fabs(weights[i]);
+		sum += weights[i];
+	}
+	for (shift = 30; shift >= minimum_shift; --shift) {
+		double scale = std::ldexp(1.0, shift);
+		if (largest * scale + 1.0 <= 32767.0 && (total * scale + weights.size()) * max_input < 2147483647.0)
+			break;
+	}
+	if (shift < minimum_shift)
+		return false;
+
+	double scale = std::ldexp(1.0, shift);
+	quantized.resize(weights.size());
+	long quantized_sum = 0;
+	for (size_t i = 0; i < weights.size(); ++i) {
+		quantized[i] = static_cast<int16_t>(std::lround(weights[i] * scale));
+		quantized_sum += quantized[i];
+	}
+	long corrected = quantized[largest_index] + std::lround(sum * scale) - quantized_sum;
+	if (corrected < -32767 || corrected > 32767)
+		return false;
+	quantized[largest_index] = static_cast<int16_t>(corrected);
+	return true;
+}
+
+inline uint8_t saturate(int value) {
+	return static_cast<uint8_t>(value < 0 ? 0 : (value > 255 ? 255 : value));
+}
+
+inline uint8_t saturate(float value) {
+	return static_cast<uint8_t>(value < 0.0f ? 0.0f : (value > 255.0f ? 255.0f : value + 0.5f));
+}
+
+// Source row `y` (which may lie outside the image) spread out with `left`
+// and `right` border pixels, so the horizontal taps never need a bounds check.
+void pad_row(const Image8& in, int y, int left, int right, const ConvolutionOptions& options, uint8_t* padded) {
+	int width = in.width();
+	int source_y = border_index(y, in.height(), options.border);
+	if (source_y < 0) {
+		std::memset(padded, options.constant, width + left + right);
+		return;
+	}
+	const uint8_t* row = in[source_y];
+	std::memcpy(padded + left, row, width);
+	for (int x = -left; x < 0; ++x) {
+		int source_x = border_index(x, width, options.border);
+		padded[x + left] = source_x < 0 ? options.constant : row[source_x];
+	}
+	for (int x = width; x < width + right; ++x) {
+		int source_x = border_index(x, width, options.border);
+		padded[x + left] = source_x < 0 ? options.constant : row[source_x];
+	}
+}
+
+// accumulator[x] += sum of weights[i] * input[x + i], at the CPU's widest level
+inline void accumulate_row(int32_t* accumulator, const uint8_t* input, const int16_t* weights, int taps, int width) {
+	pixel_kernels().accumulate_u8_i16(accumulator, input, weights, taps, width);
+}
+
+inline void accumulate_row(int32_t* accumulator, const int16_t* input, const int16_t* weights, int taps, int width) {
+	pixel_kernels().accumulate_i16_i16(accumulator, input, weights, taps, width);
+}
+
+inline void accumulate_row(float* accumulator, const uint8_t* input, const float* weights, int taps, int width) {
+	pixel_kernels().accumulate_u8_f32(accumulator, input, weights, taps, width);
+}
+
+inline void accumulate_row(float* accumulator, const float* input, const float* weights, int taps, int width) {
+	pixel_kernels().accumulate_f32_f32(accumulator, input, weights, taps, width);
+}
+
+void convolve_direct_fixed(Image8& out, const Image8& in, const ConvolutionKernel& kernel,
+	const std::vector<int16_t>& weights, int shift, const ConvolutionOptions& options)
+{
+	int width = in.width();
+	int left = kernel.width / 2;
+	int right = kernel.width - 1 - left;
+	int top = kernel.height / 2;
+	int padded_width = width + kernel.width - 1;
+	parallel_rows(in.height(), [&](int begin, int end) {
+		int rows = end - begin + kernel.height - 1;
+		std::vector<uint8_t> padded(static_cast<size_t>(rows) * padded_width);
+		for (int r = 0; r < rows; ++r)
+			pad_row(in, begin - top + r, left, right, options, &padded[static_cast<size_t>(r) * padded_width]);
+		std::vector<int32_t> accumulator(width);
+		for (int y = begin; y < end; ++y) {
+			std::fill(accumulator.begin(), accumulator.end(), 1 << (shift - 1));
+			for (int j = 0; j < kernel.height; ++j) {
+				accumulate_row(accumulator.data(), &padded[static_cast<size_t>(y - begin + j) * padded_width],
+					&weights[j * kernel.width], kernel.width, width);
+			}
+			uint8_t* destination = out[y];
+			for (int x = 0; x < width; ++x)
+				destination[x] = saturate(accumulator[x] >> shift);
+		}
+	});
+}
+
+void convolve_direct_float(Image8& out, const Image8& in, const ConvolutionKernel& kernel,
+	const ConvolutionOptions& options)
+{
+	int width = in.width();
+	int left = kernel.width / 2;
+	int right = kernel.width - 1 - left;
+	int top = kernel.height / 2;
+	int padded_width = width + kernel.width - 1;
+	parallel_rows(in.height(), [&](int begin, int end) {
+		int rows = end - begin + kernel.height - 1;
+		std::vector<uint8_t> padded(static_cast<size_t>(rows) * padded_width);
+		for (int r = 0; r < rows; ++r)
+			pad_row(in, begin - top + r, left, right, options, &padded[static_cast<size_t>(r) * padded_width]);
+		std::vector<float> accumulator(width);
+		for (int y = begin; y < end; ++y) {
+			std::fill(accumulator.begin(), accumulator.end(), 0.0f);
+			for (int j = 0; j < kernel.height; ++j) {
+				accumulate_row(accumulator.data(), &padded[static_cast<size_t>(y - begin + j) * padded_width],
+					&kernel.values[j * kernel.width], kernel.width, width);
+			}
+			uint8_t* destination = out[y];
+			for (int x = 0; x < width; ++x)
+				destination[x] = saturate(accumulator[x]);
+		}
+	});
+}
+
+// The horizontal pass keeps `fraction` fractional bits per pixel in an int16
+// intermediate; the vertical pass then accumulates int16 x int16 into int32.
+void convolve_separable_fixed(Image8& out, const Image8& in, int kernel_width, int kernel_height,
+	const std::vector<int16_t>& row_weights, int row_shift, int fraction,
+	const std::vector<int16_t>& column_weights, int column_shift, const ConvolutionOptions& options)
+{
+	int width = in.width();
+	int left = kernel_width / 2;
+	int right = kernel_width - 1 - left;
+	int top = kernel_height / 2;
+	int down_shift = row_shift - fraction;
+	int shift = column_shift + fraction;
+	parallel_rows(in.height(), [&](int begin, int end) {
+		int rows = end - begin + kernel_height - 1;
+		std::vector<uint8_t> padded(width + kernel_width - 1);
+		std::vector<int32_t> accumulator(width);
+		std::vector<int16_t> horizontal(static_cast<size_t>(rows) * width);
+		for (int r = 0; r < rows; ++r) {
+			pad_row(in, begin - top + r, left, right, options, padded.data());
+			std::fill(accumulator.begin(), accumulator.end(), down_shift > 0 ? 1 << (down_shift - 1) : 0);
+			accumulate_row(accumulator.data(), padded.data(), row_weights.data(), kernel_width, width);
+			int16_t* intermediate = &horizontal[static_cast<size_t>(r) * width];
+			for (int x = 0; x < width; ++x)
+				intermediate[x] = static_cast<int16_t>(accumulator[x] >> down_shift);
+		}
+		for (int y = begin; y < end; ++y) {
+			std::fill(accumulator.begin(), accumulator.end(), 1 << (shift - 1));
+			for (int j = 0; j < kernel_height; ++j) {
+				accumulate_row(accumulator.data(), &horizontal[static_cast<size_t>(y - begin + j) * width],
+					&column_weights[j], 1, width);
+			}
+			uint8_t* destination = out[y];
+			for (int x = 0; x < width; ++x)
+				destination[x] = saturate(accumulator[x] >> shift);
+		}
+	});
+}
+
+void convolve_separable_float(Image8& out, const Image8& in,
+	const std::vector<float>& column, const std::vector<float>& row, const ConvolutionOptions& options)
+{
+	int width = in.width();
+	int kernel_width = static_cast<int>(row.size());
+	int kernel_height = static_cast<int>(column.size());
+	int left = kernel_width / 2;
+	int right = kernel_width - 1 - left;
+	int top = kernel_height / 2;
+	parallel_rows(in.height(), [&](int begin, int end) {
+		int rows = end - begin + kernel_height - 1;
+		std::vector<uint8_t> padded(width + kernel_width - 1);
+		std::vector<float> horizontal(static_cast<size_t>(rows) * width, 0.0f);
+		for (int r = 0; r < rows; ++r) {
+			pad_row(in, begin - top + r, left, right, options, padded.data());
+			accumulate_row(&horizontal[static_cast<size_t>(r) * width], padded.data(), row.data(), kernel_width, width);
+		}
+		std::vector<float> accumulator(width);
+		for (int y = begin; y < end; ++y) {
+			std::fill(accumulator.begin(), accumulator.end(), 0.0f);
+			for (int j = 0; j < kernel_height; ++j) {
+				accumulate_row(accumulator.data(), &horizontal[static_cast<size_t>(y - begin + j) * width],
+					&column[j], 1, width);
+			}
+			uint8_t* destination = out[y];
+			for (int x = 0; x < width; ++x)
+				destination[x] = saturate(accumulator[x]);
+		}
+	});
+}
+
+// an odd-sized kernel of equal weights summing to one, which box_blur
+// computes with running sums in constant time per pixel
+bool uniform_kernel(const ConvolutionKernel& kernel) {
+	if (kernel.width % 2 == 0 || kernel.height % 2 == 0)
+		return false;
+	float weight = kernel.values[0];
+	for (float value : kernel.values)
+		if (value != weight)
+			return false;
+	return std::fabs(weight * kernel.values.size() - 1.0) < 1e-5;
+}
+
+bool convolve_separable(Image8& out, const Image8& in, const ConvolutionKernel& kernel,
+	const ConvolutionOptions& options)
+{
+	std::vector<float> column;
+	std::vector<float> row;
+	if (!separate_kernel(kernel, column, row))
+		return false;
+
+	if (options.fixed_point) {
+		std::vector<int16_t> row_weights;
+		std::vector<int16_t> column_weights;
+		int row_shift = 0;
+		int column_shift = 0;
+		double row_total = 0.0;
+		for (float weight : row)
+			row_total += std::fabs(weight);
+		// as many fractional bits as the int16 intermediate has room for
+		int fraction = static_cast<int>(std::floor(std::log2(32767.0 / (255.0 * row_total + 1.0))));
+		if (fraction >= 4 &&
+			quantize_weights(row, 255.0, 8, row_weights, row_shift) &&
+			quantize_weights(column, 32767.0, 8, column_weights, column_shift))
+		{
+			fraction = std::min(fraction, row_shift);
+			convolve_separable_fixed(out, in, kernel.width, kernel.height, row_weights, row_shift, fraction,
+				column_weights, column_shift, options);
+			return true;
+		}
+	}
+	convolve_separable_float(out, in, column, row, options);
+	return true;
+}
+
+}
+
+void grayscale_convolve(Image8& out, const Image8& in, const ConvolutionKernel& kernel,
+	const ConvolutionOptions& options)
+{
+	if (out.width() != in.width() || out.height() != in.height() || out.channels() != 1)
+		out.resize(in.width(), in.height());
+	if (in.empty() || kernel.width <= 0 || kernel.height <= 0)
+		return;
+
+	if (options.path == ConvolutionPath::fft) {
+		fft_convolve(out, in, kernel, options);
+		return;
+	}
+	if (options.path == ConvolutionPath::automatic && uniform_kernel(kernel)) {
+		box_blur(out, in, kernel.width / 2, kernel.height / 2, options.border, options.constant);
+		return;
+	}
+	if (options.path == ConvolutionPath::automatic) {
+		std::vector<float> column;
+		std::vector<float> row;
+		double direct_cost = separate_kernel(kernel, column, row) ?
+			kernel.width + kernel.height : static_cast<double>(kernel.width) * kernel.height;
+		if (fft_cost_per_pixel(kernel.width, kernel.height, in.width(), in.height()) < direct_cost) {
+			fft_convolve(out, in, kernel, options);
+			return;
+		}
+	}
+
+	if (options.path != ConvolutionPath::direct && convolve_separable(out, in, kernel, options))
+		return;
+
+	std::vector<int16_t> weights;
+	int shift = 0;
+	if (options.fixed_point && quantize_weights(kernel.values, 255.0, 8, weights, shift))
+		convolve_direct_fixed(out, in, kernel, weights, shift, options);
+	else
+		convolve_direct_float(out, in, kernel, options);
+}
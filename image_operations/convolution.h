@@ -0,0 +1,58 @@
+#ifndef CONVOLUTION_H
+#define CONVOLUTION_H
+
+#include <cstdint>
+#include <vector>
+
+#include "border.h"
+#include "image.h"
+
+// An arbitrary width x height kernel, stored row-major. It is applied
+// centred on (width / 2, height / 2) without flipping, as the original 3x3
+// grayscale_convolve did: out(x, y) = sum k(i, j) * in(x + i - width / 2, y + j - height / 2).
+struct ConvolutionKernel {
+	int width = 0;
+	int height = 0;
+	std::vector<float> values;
+
+	float at(int x, int y) const { return values[y * width + x]; }
+};
+
+ConvolutionKernel make_kernel(int width, int height, const float* values);
+ConvolutionKernel box_kernel(int width, int height);
+// radius 0 picks ceil(3 * sigma)
+ConvolutionKernel gaussian_kernel(float sigma, int radius = 0);
+
+// Rotates a kernel by 180 degrees, turning the correlation grayscale_convolve
+// computes into a true convolution.
+ConvolutionKernel flip_kernel(const ConvolutionKernel& kernel);
+
+// Splits a rank-1 kernel into kernel(x, y) = column[y] * row[x]. Returns false
+// when the kernel is not separable.
+bool separate_kernel(const ConvolutionKernel& kernel, std::vector<float>& column, std::vector<float>& row);
+
+enum class ConvolutionPath {
+	automatic,
+	direct,
+	separable,
+	fft
+};
+
+struct ConvolutionOptions {
+	BorderMode border = BorderMode::replicate;
+	uint8_t constant = 0;
+	ConvolutionPath path = ConvolutionPath::automatic;
+	// int16 weights with int32 accumulators whenever the kernel quantizes
+	// without losing precision; float otherwise
+	bool fixed_point = true;
+};
+
+// Rounds and saturates to 0..255. Separable kernels run as a horizontal and a
+// vertical 1D pass, so a k x k kernel costs O(k) per pixel instead of O(k^2).
+// Box kernels run as box_blur, in constant time per pixel whatever their size.
+// Large kernels that are not separable go through fft_convolve when its
+// estimated cost per pixel is lower.
+void grayscale_convolve(Image8& out, const Image8& in, const ConvolutionKernel& kernel,
+	const ConvolutionOptions& options = ConvolutionOptions());
+
+#endif
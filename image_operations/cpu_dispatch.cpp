@@ -0,0 +1,322 @@
+#include "cpu_dispatch.h"
+#include "pixel_kernels.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// one per build of pixel_kernels.cpp
+extern const PixelKernels pixel_kernels_scalar;
+extern const PixelKernels pixel_kernels_sse42;
+extern const PixelKernels pixel_kernels_avx2;
+extern const PixelKernels pixel_kernels_avx512;
+
+namespace {
+
+const PixelKernels* table_for(IsaLevel level) {
+	switch (level) {
+	case IsaLevel::scalar:
+		return &pixel_kernels_scalar;
+	case IsaLevel::sse42:
+		return &pixel_kernels_sse42;
+	case IsaLevel::avx2:
+		return &pixel_kernels_avx2;
+	case IsaLevel::avx512:
+		return &pixel_kernels_avx512;
+	}
+	return &pixel_kernels_scalar;
+}
+
+IsaLevel clamp_to_detected(IsaLevel level) {
+	IsaLevel detected = detected_isa_level();
+	if (level > detected) {
+		std::cerr << "[isa_level] This CPU supports " << isa_level_name(detected) << " but not "
+			<< isa_level_name(level) << std::endl;
+		return detected;
+	}
+	return level;
+}
+
+IsaLevel initial_isa_level() {
+	const char* name = std::getenv("IMAGE_OPERATIONS_ISA");
+	if (!name)
+		return detected_isa_level();
+	IsaLevel level;
+	if (!parse_isa_level(name, level)) {
+		std::cerr << "[isa_level] Unknown IMAGE_OPERATIONS_ISA " << name << std::endl;
+		return detected_isa_level();
+	}
+	return clamp_to_detected(level);
+}
+
+std::atomic<const PixelKernels*> active_kernels(nullptr);
+
+}
+
+IsaLevel detected_isa_level() {
+#if defined(__x86_64__) || defined(__i386__)
+	// __builtin_cpu_supports reads cpuid once, and for the AVX levels also
+	// checks with xgetbv that the OS saves the wider registers
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+		__builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("avx512dq") &&
+		__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("bmi2"))
+		return IsaLevel::avx512;
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("bmi2"))
+		return IsaLevel::avx2;
+	if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt"))
+		return IsaLevel::sse42;
+#endif
+	return IsaLevel::scalar;
+}
+
+IsaLevel isa_level() {
+	return pixel_kernels().level;
+}
+
+void set_isa_level(IsaLevel level) {
+	active_kernels.store(table_for(clamp_to_detected(level)), std::memory_order_release);
+}
+
+const char* isa_level_name(IsaLevel level) {
+	switch (level) {
+	case IsaLevel::scalar:
+		return "scalar";
+	case IsaLevel::sse42:
+		return "sse42";
+	case IsaLevel::avx2:
+		return "avx2";
+	case IsaLevel::avx512:
+		return "avx512";
+	}
+	return "unknown";
+}
+
+bool parse_isa_level(const std::string& name, IsaLevel& level) {
+	for (IsaLevel candidate : {IsaLevel::scalar, IsaLevel::sse42, IsaLevel::avx2, IsaLevel::avx512}) {
+		if (name == isa_level_name(candidate)) {
+			level = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+const PixelKernels& pixel_kernels() {
+	const PixelKernels* kernels = active_kernels.load(std::memory_order_acquire);
+	if (!kernels) {
+		static const IsaLevel initial = initial_isa_level();
+		// a racing set_isa_level wins over the default
+		const PixelKernels* expected = nullptr;
+		active_kernels.compare_exchange_strong(expected, table_for(initial), std::memory_order_acq_rel);
+		kernels = active_kernels.load(std::memory_order_acquire);
+	}
+	return *kernels;
+}
+
+const PixelKernels* pixel_kernels_for(IsaLevel level) {
+	return level <= detected_isa_level() ? table_for(level) : nullptr;
+}
+
+namespace {
+
+// widths around every vector and word size
+const int validation_widths[] = {0, 1, 2, 3, 7, 15, 16, 17, 31, 32, 33, 34, 35, 63, 64, 65, 66, 127, 128, 129, 200, 1000, 1027};
+
+template <typename T>
+void fill_random(std::vector<T>& values, std::mt19937& generator, int low, int high) {
+	std::uniform_int_distribution<int> distribution(low, high);
+	for (T& value : values)
+		value = static_cast<T>(distribution(generator));
+}
+
+int report(const PixelKernels& kernels, const char* kernel, int width) {
+	std::cerr << "[validate_pixel_kernels] " << isa_level_name(kernels.level) << " " << kernel
+		<< " differs from scalar at width " << width << std::endl;
+	return 1;
+}
+
+template <typename T>
+bool same(const std::vector<T>& lhs, const std::vector<T>& rhs) {
+	return lhs.size() == rhs.size() && (lhs.empty() || std::memcmp(lhs.data(), rhs.data(), lhs.size() * sizeof(T)) == 0);
+}
+
+// the number of kernels of one level that differ
+int validate_level(const PixelKernels& kernels, const PixelKernels& reference) {
+	std::mt19937 generator(12345);
+	bool lut = true, threshold = true, binary = true, fixed = true, fixed16 = true, floating = true, floating32 = true,
+		gray = true, prefix = true, background = true, network = true, gradient = true, neighbourhood = true;
+
+	for (int width : validation_widths) {
+		std::vector<uint8_t> table(256), pixels(width + 64);
+		fill_random(table, generator, 0, 255);
+		fill_random(pixels, generator, 0, 255);
+
+		std::vector<uint8_t> expected(pixels), actual(pixels);
+		reference.lut_row(table.data(), expected.data(), width);
+		kernels.lut_row(table.data(), actual.data(), width);
+		if (lut && !same(expected, actual))
+			lut = report(kernels, "lut_row", width) == 0;
+
+		for (int level : {0, 1, 2, 127, 128, 255, 256}) {
+			std::vector<uint64_t> expected_words((width + 63) / 64), actual_words(expected_words.size());
+			reference.threshold_row(expected_words.data(), pixels.data(), width, level);
+			kernels.threshold_row(actual_words.data(), pixels.data(), width, level);
+			if (threshold && !same(expected_words, actual_words))
+				threshold = report(kernels, "threshold_row", width) == 0;
+		}
+
+		// rows of words with the guard word either side, as BinaryImage keeps them
+		int words = (width + 63) / 64 + 1;
+		std::vector<uint64_t> rows[3];
+		for (std::vector<uint64_t>& row : rows) {
+			row.resize(words + 2);
+			for (uint64_t& word : row)
+				word = (static_cast<uint64_t>(generator()) << 32) | generator();
+		}
+		for (int rule = 0; rule <= static_cast<int>(BinaryRule::noize); ++rule) {
+			std::vector<uint64_t> expected_words(words), actual_words(words);
+			reference.binary_row(static_cast<BinaryRule>(rule), expected_words.data(), rows[0].data() + 1, rows[1].data() + 1,
+				rows[2].data() + 1, words);
+			kernels.binary_row(static_cast<BinaryRule>(rule), actual_words.data(), rows[0].data() + 1, rows[1].data() + 1,
+				rows[2].data() + 1, words);
+			if (binary && !same(expected_words, actual_words))
+				binary = report(kernels, "binary_row", width) == 0;
+		}
+
+		for (int taps : {1, 3, 7, 13}) {
+			std::vector<int16_t> weights(taps), samples(width + taps);
+			fill_random(weights, generator, -32767, 32767);
+			fill_random(samples, generator, -32767, 32767);
+			std::vector<uint8_t> bytes(width + taps);
+			fill_random(bytes, generator, 0, 255);
+			std::vector<int32_t> expected_sums(width, 1 << 10), actual_sums(width, 1 << 10);
+			reference.accumulate_u8_i16(expected_sums.data(), bytes.data(), weights.data(), taps, width);
+			kernels.accumulate_u8_i16(actual_sums.data(), bytes.data(), weights.data(), taps, width);
+			if (fixed && !same(expected_sums, actual_sums))
+				fixed = report(kernels, "accumulate_u8_i16", width) == 0;
+			// small enough that the int32 sums cannot overflow
+			for (int16_t& sample : samples)
+				sample = static_cast<int16_t>(sample / 16);
+			reference.accumulate_i16_i16(expected_sums.data(), samples.data(), weights.data(), taps, width);
+			kernels.accumulate_i16_i16(actual_sums.data(), samples.data(), weights.data(), taps, width);
+			if (fixed16 && !same(expected_sums, actual_sums))
+				fixed16 = report(kernels, "accumulate_i16_i16", width) == 0;
+
+			std::vector<float> float_weights(taps), float_samples(width + taps);
+			std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+			for (float& weight : float_weights)
+				weight = unit(generator);
+			for (float& sample : float_samples)
+				sample = 255.0f * unit(generator);
+			std::vector<float> expected_floats(width, 0.5f), actual_floats(width, 0.5f);
+			reference.accumulate_u8_f32(expected_floats.data(), bytes.data(), float_weights.data(), taps, width);
+			kernels.accumulate_u8_f32(actual_floats.data(), bytes.data(), float_weights.data(), taps, width);
+			if (floating && !same(expected_floats, actual_floats))
+				floating = report(kernels, "accumulate_u8_f32", width) == 0;
+			reference.accumulate_f32_f32(expected_floats.data(), float_samples.data(), float_weights.data(), taps, width);
+			kernels.accumulate_f32_f32(actual_floats.data(), float_samples.data(), float_weights.data(), taps, width);
+			if (floating32 && !same(expected_floats, actual_floats))
+				floating32 = report(kernels, "accumulate_f32_f32", width) == 0;
+		}
+
+		for (int channels = 2; channels <= 4; ++channels) {
+			// the mean, BT.601 luma and the first channel, as gray_conversion uses them
+			int16_t mean = static_cast<int16_t>((16384 + channels - 1) / channels);
+			const int16_t weight_sets[3][4] = {{mean, mean, mean, mean}, {4899, 9617, 1868, 0}, {16384, 0, 0, 0}};
+			const int biases[3] = {0, 8192, 8192};
+			std::vector<uint8_t> input(static_cast<size_t>(width) * channels);
+			fill_random(input, generator, 0, 255);
+			for (int set = 0; set < 3; ++set) {
+				const int16_t* weights = weight_sets[set];
+				std::vector<uint8_t> expected_gray(width), actual_gray(width);
+				reference.gray_row(expected_gray.data(), input.data(), width, channels, weights, biases[set]);
+				kernels.gray_row(actual_gray.data(), input.data(), width, channels, weights, biases[set]);
+				if (gray && !same(expected_gray, actual_gray))
+					gray = report(kernels, "gray_row", width) == 0;
+			}
+		}
+
+		std::vector<uint32_t> expected_prefix(width + 1), actual_prefix(width + 1);
+		reference.prefix_sum_row(expected_prefix.data(), pixels.data(), width);
+		kernels.prefix_sum_row(actual_prefix.data(), pixels.data(), width);
+		if (prefix && !same(expected_prefix, actual_prefix))
+			prefix = report(kernels, "prefix_sum_row", width) == 0;
+
+		for (int shift : {0, 1, 4, 8}) {
+			std::vector<uint16_t> model(width);
+			fill_random(model, generator, 0, 255 << 8);
+			std::vector<uint16_t> expected_model(model), actual_model(model);
+			std::vector<uint8_t> expected_mask(width), actual_mask(width);
+			reference.background_row(expected_model.data(), pixels.data(), expected_mask.data(), width, shift, 20);
+			kernels.background_row(actual_model.data(), pixels.data(), actual_mask.data(), width, shift, 20);
+			if (background && (!same(expected_model, actual_model) || !same(expected_mask, actual_mask)))
+				background = report(kernels, "background_row", width) == 0;
+		}
+
+		// a network of width random pairs over 32 wires
+		std::vector<uint8_t> pairs(2 * width), wires(32 * network_lanes);
+		fill_random(wires, generator, 0, 255);
+		for (int i = 0; i < width; ++i) {
+			pairs[2 * i] = static_cast<uint8_t>(generator() % 32);
+			pairs[2 * i + 1] = static_cast<uint8_t>((pairs[2 * i] + 1 + generator() % 31) % 32);
+		}
+		std::vector<uint8_t> expected_wires(wires), actual_wires(wires);
+		reference.compare_exchange(expected_wires.data(), pairs.data(), width);
+		kernels.compare_exchange(actual_wires.data(), pairs.data(), width);
+		if (network && !same(expected_wires, actual_wires))
+			network = report(kernels, "compare_exchange", width) == 0;
+
+		// rows with a pixel either side
+		std::vector<uint8_t> above(width + 2), centre(width + 2), below(width + 2);
+		fill_random(above, generator, 0, 255);
+		fill_random(centre, generator, 0, 255);
+		fill_random(below, generator, 0, 255);
+		for (int flags = 0; flags < 4; ++flags) {
+			bool scharr = flags & 1;
+			bool l2 = flags & 2;
+			std::vector<uint16_t> expected_magnitude(width), actual_magnitude(width);
+			std::vector<uint8_t> expected_direction(width), actual_direction(width);
+			reference.gradient_row(expected_magnitude.data(), expected_direction.data(), above.data() + 1, centre.data() + 1,
+				below.data() + 1, width, scharr, l2);
+			kernels.gradient_row(actual_magnitude.data(), actual_direction.data(), above.data() + 1, centre.data() + 1,
+				below.data() + 1, width, scharr, l2);
+			if (gradient && (!same(expected_magnitude, actual_magnitude) || !same(expected_direction, actual_direction)))
+				gradient = report(kernels, "gradient_row", width) == 0;
+		}
+
+		// the same rows as gray and as 0/1, where every rule changes pixels
+		for (int binary_pixels = 0; binary_pixels < 2; ++binary_pixels) {
+			if (binary_pixels) {
+				for (std::vector<uint8_t>* row : {&above, &centre, &below})
+					for (uint8_t& pixel : *row)
+						pixel &= 1;
+			}
+			for (int rule = 0; rule <= static_cast<int>(BinaryRule::noize); ++rule) {
+				std::vector<uint8_t> expected_row(width), actual_row(width);
+				reference.neighbourhood_row(static_cast<BinaryRule>(rule), expected_row.data(), above.data() + 1,
+					centre.data() + 1, below.data() + 1, width);
+				kernels.neighbourhood_row(static_cast<BinaryRule>(rule), actual_row.data(), above.data() + 1,
+					centre.data() + 1, below.data() + 1, width);
+				if (neighbourhood && !same(expected_row, actual_row))
+					neighbourhood = report(kernels, "neighbourhood_row", width) == 0;
+			}
+		}
+	}
+	return !lut + !threshold + !binary + !fixed + !fixed16 + !floating + !floating32 + !gray + !prefix + !background + !network + !gradient + !neighbourhood;
+}
+
+}
+
+int validate_pixel_kernels() {
+	int failures = 0;
+	for (IsaLevel level : {IsaLevel::sse42, IsaLevel::avx2, IsaLevel::avx512}) {
+		const PixelKernels* kernels = pixel_kernels_for(level);
+		if (kernels)
+			failures += validate_level(*kernels, pixel_kernels_scalar);
+	}
+	return failures;
+}
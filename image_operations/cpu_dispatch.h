@@ -0,0 +1,29 @@
+#ifndef CPU_DISPATCH_H
+#define CPU_DISPATCH_H
+
+#include <string>
+
+// The instruction set levels the pixel kernels are built for, in order:
+// sse42 is Nehalem, avx2 Haswell (with FMA and BMI2) and avx512 Skylake-SP
+// (F, BW, VL and DQ).
+enum class IsaLevel {
+	scalar,
+	sse42,
+	avx2,
+	avx512
+};
+
+// the best level this CPU and OS support, from cpuid
+IsaLevel detected_isa_level();
+
+// The level the kernels run at: the detected one, unless lowered by the
+// IMAGE_OPERATIONS_ISA environment variable or set_isa_level. A request above
+// the detected level is clamped to it.
+IsaLevel isa_level();
+void set_isa_level(IsaLevel level);
+
+// "scalar", "sse42", "avx2" or "avx512"
+const char* isa_level_name(IsaLevel level);
+bool parse_isa_level(const std::string& name, IsaLevel& level);
+
+#endif
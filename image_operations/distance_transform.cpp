@@ -0,0 +1,254 @@
+#include "distance_transform.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "profiler.h"
+#include "thread_pool.h"
+
+namespace {
+
+// columns per task of the column pass, each row of a strip one short
+// vectorized loop
+const int strip_columns = 256;
+
+// The distance down each column to the nearest site, a 0 pixel when
+// zero_sites and a nonzero one otherwise, or unreachable when the column has
+// none. Each strip goes down the rows and back up.
+void column_pass(Image32& columns, const Image8& in, bool zero_sites, uint32_t unreachable) {
+	int width = in.width();
+	int height = in.height();
+	int strips = (width + strip_columns - 1) / strip_columns;
+	default_thread_pool().parallel_for(0, strips, 1, [&](int begin, int end) {
+		for (int strip = begin; strip < end; ++strip) {
+			int x0 = strip * strip_columns;
+			int x1 = std::min(width, x0 + strip_columns);
+			for (int y = 0; y < height; ++y) {
+				const uint8_t* source = in[y];
+				uint32_t* distance = columns[y];
+				const uint32_t* above = y > 0 ? columns[y - 1] : nullptr;
+				for (int x = x0; x < x1; ++x) {
+					bool site = zero_sites ? source[x] == 0 : source[x] != 0;
+					uint32_t previous = above ? std::min(above[x] + 1, unreachable) : unreachable;
+					distance[x] = site ? 0 : previous;
+				}
+			}
+			for (int y = height - 2; y >= 0; --y) {
+				uint32_t* distance = columns[y];
+				const uint32_t* below = columns[y + 1];
+				for (int x = x0; x < x1; ++x)
+					distance[x] = std::min(distance[x], below[x] + 1);
+			}
+		}
+	});
+}
+
+// Meijster's second phase: the squared distance at x is the lowest of the
+// parabolas (x - i)^2 + column[i]^2, and the lower envelope of them all is
+// found with a stack of the parabolas that show in it (s) and where each
+// starts to (t).
+void euclidean_row(uint32_t* out, const uint32_t* column, int width, uint32_t unreachable, int* s, int* t) {
+	auto f = [column](int64_t x, int64_t i) {
+		int64_t g = column[i];
+		return (x - i) * (x - i) + g * g;
+	};
+	// the first x at which the parabola of u is below that of i, for i < u
+	auto separation = [column](int64_t i, int64_t u) {
+		int64_t gi = column[i];
+		int64_t gu = column[u];
+		int64_t numerator = u * u - i * i + gu * gu - gi * gi;
+		int64_t denominator = 2 * (u - i);
+		int64_t quotient = numerator / denominator;
+		if (numerator % denominator != 0 && numerator < 0)
+			--quotient;
+		return quotient + 1;
+	};
+	int q = 0;
+	s[0] = 0;
+	t[0] = 0;
+	for (int u = 1; u < width; ++u) {
+		while (q >= 0 && f(t[q], s[q]) > f(t[q], u))
+			--q;
+		if (q < 0) {
+			q = 0;
+			s[0] = u;
+		} else {
+			int64_t start = separation(s[q], u);
+			if (start < width) {
+				++q;
+				s[q] = u;
+				t[q] = static_cast<int>(start);
+			}
+		}
+	}
+	for (int u = width - 1; u >= 0; --u) {
+		// a row's parabolas are all unreachable only when the image has no sites
+		if (column[s[q]] >= unreachable)
+			out[u] = distance_infinity;
+		else
+			out[u] = static_cast<uint32_t>(std::min<int64_t>(f(u, s[q]), distance_infinity - 1));
+		if (u == t[q])
+			--q;
+	}
+}
+
+// |x - i| + column[i] at its lowest, a scan each way
+void city_block_row(uint32_t* out, const uint32_t* column, int width, uint32_t unreachable) {
+	out[0] = column[0];
+	for (int x = 1; x < width; ++x)
+		out[x] = std::min(column[x], out[x - 1] + 1);
+	for (int x = width - 2; x >= 0; --x)
+		out[x] = std::min(out[x], out[x + 1] + 1);
+	for (int x = 0; x < width; ++x)
+		out[x] = out[x] >= unreachable ? distance_infinity : out[x];
+}
+
+// The two raster scans of the 3-4 mask. Each row first takes the row before
+// it, in a loop that vectorizes, and then its own pixels in order.
+void chamfer_transform(Image32& out, const Image8& in, bool zero_sites) {
+	int width = in.width();
+	int height = in.height();
+	uint32_t unreachable = 4 * static_cast<uint32_t>(width + height);
+	auto from_row = [width, unreachable](uint32_t* row, const uint32_t* other) {
+		row[0] = std::min(row[0], other[0] + 3);
+		if (width > 1) {
+			row[0] = std::min(row[0], other[1] + 4);
+			row[width - 1] = std::min({row[width - 1], other[width - 1] + 3, other[width - 2] + 4});
+		}
+		for (int x = 1; x < width - 1; ++x)
+			row[x] = std::min({row[x], other[x] + 3, other[x - 1] + 4, other[x + 1] + 4, unreachable});
+	};
+	for (int y = 0; y < height; ++y) {
+		const uint8_t* source = in[y];
+		uint32_t* row = out[y];
+		for (int x = 0; x < width; ++x) {
+			bool site = zero_sites ? source[x] == 0 : source[x] != 0;
+			row[x] = site ? 0 : unreachable;
+		}
+		if (y > 0)
+			from_row(row, out[y - 1]);
+		for (int x = 1; x < width; ++x)
+			row[x] = std::min(row[x], row[x - 1] + 3);
+	}
+	for (int y = height - 1; y >= 0; --y) {
+		uint32_t* row = out[y];
+		if (y + 1 < height)
+			from_row(row, out[y + 1]);
+		for (int x = width - 2; x >= 0; --x)
+			row[x] = std::min(row[x], row[x + 1] + 3);
+	}
+	parallel_rows(height, [&](int begin, int end) {
+		for (int y = begin; y < end; ++y) {
+			uint32_t* row = out[y];
+			for (int x = 0; x < width; ++x)
+				row[x] = row[x] >= unreachable ? distance_infinity : row[x];
+		}
+	});
+}
+
+// distances to the nearest site, as distance_transform gives them
+void site_distances(Image32& out, const Image8& in, bool zero_sites, DistanceMetric metric) {
+	int width = in.width();
+	int height = in.height();
+	if (out.width() != width || out.height() != height || out.channels() != 1)
+		out.resize(width, height);
+	if (in.empty())
+		return;
+	if (metric == DistanceMetric::chamfer) {
+		chamfer_transform(out, in, zero_sites);
+		return;
+	}
+	uint32_t unreachable = static_cast<uint32_t>(width + height);
+	column_pass(out, in, zero_sites, unreachable);
+	parallel_rows(height, [&](int begin, int end) {
+		std::vector<uint32_t> column(width);
+		std::vector<int> s(width);
+		std::vector<int> t(width);
+		for (int y = begin; y < end; ++y) {
+			std::copy(out[y], out[y] + width, column.begin());
+			if (metric == DistanceMetric::euclidean)
+				euclidean_row(out[y], column.data(), width, unreachable, s.data(), t.data());
+			else
+				city_block_row(out[y], column.data(), width, unreachable);
+		}
+	});
+}
+
+// out is 1 where the distance is at most limit, or above it when above
+void threshold_distances(Image8& out, const Image32& distances, uint64_t limit, bool above) {
+	int width = distances.width();
+	if (out.width() != width || out.height() != distances.height() || out.channels() != 1)
+		out.resize(width, distances.height());
+	uint32_t bound = static_cast<uint32_t>(std::min<uint64_t>(limit, distance_infinity - 1));
+	parallel_rows(distances.height(), [&](int begin, int end) {
+		for (int y = begin; y < end; ++y) {
+			const uint32_t* distance = distances[y];
+			uint8_t* destination = out[y];
+			for (int x = 0; x < width; ++x)
+				destination[x] = static_cast<uint8_t>((distance[x] > bound) == above);
+		}
+	});
+}
+
+// the threshold for radius in the units of the metric
+uint64_t radius_limit(int radius, DistanceMetric metric) {
+	uint64_t r = static_cast<uint64_t>(std::max(0, radius));
+	switch (metric) {
+	case DistanceMetric::euclidean:
+		return r * r;
+	case DistanceMetric::chamfer:
+		return 3 * r;
+	case DistanceMetric::city_block:
+		break;
+	}
+	return r;
+}
+
+}
+
+void distance_transform(Image32& out, const Image8& in, DistanceMetric metric) {
+	size_t pixels = static_cast<size_t>(in.width()) * in.height();
+	ProfileScope scope("distance_transform", pixels, 9 * pixels);
+	site_distances(out, in, true, metric);
+}
+
+void distance_image(Image8& out, const Image8& in, DistanceMetric metric) {
+	size_t pixels = static_cast<size_t>(in.width()) * in.height();
+	ProfileScope scope("distance_image", pixels, 10 * pixels);
+	Image32 distances;
+	site_distances(distances, in, true, metric);
+	int width = in.width();
+	if (out.width() != width || out.height() != in.height() || out.channels() != 1)
+		out.resize(width, in.height());
+	parallel_rows(in.height(), [&](int begin, int end) {
+		for (int y = begin; y < end; ++y) {
+			const uint32_t* distance = distances[y];
+			uint8_t* destination = out[y];
+			for (int x = 0; x < width; ++x) {
+				uint32_t value = distance[x];
+				if (metric == DistanceMetric::euclidean)
+					value = static_cast<uint32_t>(std::lround(std::sqrt(static_cast<double>(value))));
+				else if (metric == DistanceMetric::chamfer)
+					value = value / 3 + (value % 3 == 2);
+				destination[x] = static_cast<uint8_t>(std::min<uint32_t>(value, 255));
+			}
+		}
+	});
+}
+
+void distance_erode(Image8& out, const Image8& in, int radius, DistanceMetric metric) {
+	size_t pixels = static_cast<size_t>(in.width()) * in.height();
+	ProfileScope scope("distance_erode", pixels, 10 * pixels);
+	Image32 distances;
+	site_distances(distances, in, true, metric);
+	threshold_distances(out, distances, radius_limit(radius, metric), true);
+}
+
+void distance_dilate(Image8& out, const Image8& in, int radius, DistanceMetric metric) {
+	size_t pixels = static_cast<size_t>(in.width()) * in.height();
+	ProfileScope scope("distance_dilate", pixels, 10 * pixels);
+	Image32 distances;
+	site_distances(distances, in, false, metric);
+	threshold_distances(out, distances, radius_limit(radius, metric), false);
+}
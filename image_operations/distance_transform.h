@@ -0,0 +1,45 @@
+#ifndef DISTANCE_TRANSFORM_H
+#define DISTANCE_TRANSFORM_H
+
+#include <cstdint>
+
+#include "image.h"
+
+enum class DistanceMetric {
+	// the exact Euclidean distance, squared so it stays an integer
+	euclidean,
+	// 3 per step along a row or column and 4 per diagonal step, about three
+	// times the Euclidean distance
+	chamfer,
+	// |dx| + |dy|
+	city_block
+};
+
+// what distance_transform gives every pixel of an image with no background
+const uint32_t distance_infinity = UINT32_MAX;
+
+// The distance from every pixel of a 0/1 image (any nonzero value counts as
+// 1) to the nearest 0, which is 0 on the 0s themselves. Pixels past the edge
+// are not background, so a blob that runs off the image is as deep there
+// as if it went on. Euclidean and city block are separable: a pass down the
+// columns, in strips of columns on the default pool, finds each pixel's
+// distance to the nearest 0 in its column, then a pass along each row,
+// rows on the pool, combines the columns: Meijster's lower envelope of
+// parabolas for Euclidean, a scan each way for city block. Chamfer is the
+// two raster scans, which run in order. All are O(pixels) whatever the
+// distances.
+void distance_transform(Image32& out, const Image8& in, DistanceMetric metric = DistanceMetric::euclidean);
+
+// The distance in pixels, rounded (chamfer divided by 3) and capped at 255,
+// for viewing or further 8-bit steps.
+void distance_image(Image8& out, const Image8& in, DistanceMetric metric = DistanceMetric::euclidean);
+
+// Binary erosion and dilation of a 0/1 image by every offset within radius
+// in the metric (a disc for Euclidean, a diamond for city block and an
+// octagon for chamfer, 3 per pixel of radius), as a threshold on the
+// distance to the nearest 0 or 1. The cost does not depend on the radius.
+// As with grayscale_erode, pixels past the edge are left out.
+void distance_erode(Image8& out, const Image8& in, int radius, DistanceMetric metric = DistanceMetric::euclidean);
+void distance_dilate(Image8& out, const Image8& in, int radius, DistanceMetric metric = DistanceMetric::euclidean);
+
+#endif
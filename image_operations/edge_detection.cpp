@@ -0,0 +1,142 @@
+#include "edge_detection.h"
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include "border.h"
+#include "pixel_kernels.h"
+#include "point_operations.h"
+#include "profiler.h"
+#include "thread_pool.h"
+
+namespace {
+
+// what non-maximum suppression leaves in out before hysteresis
+const uint8_t not_edge = 0;
+const uint8_t weak = 1;
+const uint8_t strong = 2;
+
+// The gradient rows of one band: magnitudes with a zero either side, so the
+// neighbours of the first and last pixels need no checks, and directions.
+struct GradientRing {
+	std::vector<uint16_t> magnitude[3];
+	std::vector<uint8_t> direction[3];
+	std::vector<uint8_t> padded[3];
+};
+
+void pad_row(uint8_t* padded, const uint8_t* row, int width) {
+	std::memcpy(padded + 1, row, width);
+	padded[0] = row[0];
+	padded[width + 1] = row[width - 1];
+}
+
+// Row y of the gradient into slot, all zeros for a row past the edge, where
+// there is nothing to suppress against.
+void gradient_row(GradientRing& ring, int slot, const Image8& in, int y, const CannyOptions& options) {
+	int width = in.width();
+	int height = in.height();
+	uint16_t* magnitude = ring.magnitude[slot].data();
+	if (y < 0 || y >= height) {
+		std::fill(magnitude, magnitude + width + 2, 0);
+		return;
+	}
+	for (int dy = 0; dy < 3; ++dy)
+		pad_row(ring.padded[dy].data(), in[border_index(y + dy - 1, height, BorderMode::replicate)], width);
+	pixel_kernels().gradient_row(magnitude + 1, ring.direction[slot].data(), ring.padded[0].data() + 1,
+		ring.padded[1].data() + 1, ring.padded[2].data() + 1, width, options.gradient == GradientOperator::scharr,
+		options.l2);
+}
+
+struct Pixel {
+	int x;
+	int y;
+};
+
+// Marks row y of out not_edge, weak or strong from the gradient rows around
+// it, and notes where the strong pixels are. A pixel survives when its
+// magnitude beats the neighbour behind it along the gradient and is not
+// beaten by the one ahead, so a ridge two pixels wide keeps one. The
+// neighbours are picked with selects rather than a branch on the direction,
+// so the loop vectorizes; the strong pixels are few and found after.
+void suppress_row(uint8_t* out, const uint16_t* above, const uint16_t* centre, const uint16_t* below,
+	const uint8_t* direction, int width, int low, int high, int y, std::vector<Pixel>& strong_pixels)
+{
+	for (int x = 0; x < width; ++x) {
+		int value = centre[x + 1];
+		int left = centre[x];
+		int right = centre[x + 2];
+		int above_left = above[x];
+		int above_middle = above[x + 1];
+		int above_right = above[x + 2];
+		int below_left = below[x];
+		int below_middle = below[x + 1];
+		int below_right = below[x + 2];
+		int code = direction[x];
+		int behind = code == 0 ? left : (code == 1 ? above_left : (code == 2 ? above_middle : above_right));
+		int ahead = code == 0 ? right : (code == 1 ? below_right : (code == 2 ? below_middle : below_left));
+		bool kept = (value >= low) & (value > behind) & (value >= ahead);
+		out[x] = kept ? (value >= high ? strong : weak) : not_edge;
+	}
+	for (int x = 0; x < width; ++x)
+		if (out[x] == strong)
+			strong_pixels.push_back(Pixel{x, y});
+}
+
+}
+
+void canny(Image8& out, const Image8& in, const CannyOptions& options) {
+	int width = in.width();
+	int height = in.height();
+	if (out.width() != width || out.height() != height || out.channels() != 1)
+		out.resize(width, height);
+	if (in.empty())
+		return;
+	size_t pixels = static_cast<size_t>(width) * height;
+	ProfileScope scope("canny", pixels, 2 * pixels);
+	int low = std::max(1, options.low);
+	int high = std::max(low, options.high);
+
+	std::vector<Pixel> strong_pixels;
+	std::mutex strong_mutex;
+	parallel_rows(height, [&](int begin, int end) {
+		GradientRing ring;
+		for (int slot = 0; slot < 3; ++slot) {
+			ring.magnitude[slot].resize(width + 2);
+			ring.direction[slot].resize(width);
+			ring.padded[slot].resize(width + 2);
+		}
+		std::vector<Pixel> found;
+		gradient_row(ring, 0, in, begin - 1, options);
+		gradient_row(ring, 1, in, begin, options);
+		for (int y = begin; y < end; ++y) {
+			int above = (y - begin) % 3;
+			int centre = (y - begin + 1) % 3;
+			int below = (y - begin + 2) % 3;
+			gradient_row(ring, below, in, y + 1, options);
+			suppress_row(out[y], ring.magnitude[above].data(), ring.magnitude[centre].data(),
+				ring.magnitude[below].data(), ring.direction[centre].data(), width, low, high, y, found);
+		}
+		std::lock_guard<std::mutex> lock(strong_mutex);
+		strong_pixels.insert(strong_pixels.end(), found.begin(), found.end());
+	});
+
+	// every weak pixel joined to a strong one through weak ones becomes
+	// strong; each is pushed once, when it is promoted
+	std::vector<Pixel>& worklist = strong_pixels;
+	while (!worklist.empty()) {
+		Pixel pixel = worklist.back();
+		worklist.pop_back();
+		for (int y = std::max(0, pixel.y - 1); y <= std::min(height - 1, pixel.y + 1); ++y) {
+			uint8_t* row = out[y];
+			for (int x = std::max(0, pixel.x - 1); x <= std::min(width - 1, pixel.x + 1); ++x) {
+				if (row[x] == weak) {
+					row[x] = strong;
+					worklist.push_back(Pixel{x, y});
+				}
+			}
+		}
+	}
+	apply_point_lut(make_point_lut([](int value){return value == strong ? 1 : 0;}), out);
+}
@@ -0,0 +1,31 @@
+#ifndef EDGE_DETECTION_H
+#define EDGE_DETECTION_H
+
+#include "image.h"
+
+enum class GradientOperator {
+	sobel,
+	scharr
+};
+
+struct CannyOptions {
+	GradientOperator gradient = GradientOperator::sobel;
+	// on the gradient magnitude, |gx| + |gy| unless l2: pixels of at least
+	// high start edges and pixels of at least low continue them
+	int low = 40;
+	int high = 100;
+	// the Euclidean length of the gradient rather than |gx| + |gy|
+	bool l2 = false;
+};
+
+// Canny edges as a 0/1 image. Bands of rows run on the default pool, each
+// computing the gradient magnitude and quantized direction of a row in one
+// pass (replicating the border), keeping just the three rows that
+// non-maximum suppression reads and writing each row's candidates straight
+// into out, so no intermediate ever takes a whole frame. Hysteresis then
+// grows the edges from a worklist of the strong pixels into the weak ones
+// around them, touching only the candidates rather than rescanning the
+// frame.
+void canny(Image8& out, const Image8& in, const CannyOptions& options = CannyOptions());
+
+#endif
@@ -0,0 +1,212 @@
+#include "fft_convolution.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <fftw3.h>
+
+#include "thread_pool.h"
+
+namespace {
+
+struct FftPlans {
+	fftw_plan forward;
+	fftw_plan inverse;
+};
+
+// the FFTW planner is not thread safe; executing a plan on new arrays is
+std::mutex planner_mutex;
+std::map<std::pair<int, int>, FftPlans> plan_cache;
+std::string wisdom_file;
+bool wisdom_file_chosen = false;
+bool wisdom_loaded = false;
+
+const std::string& current_wisdom_file() {
+	if (!wisdom_file_chosen) {
+		const char* path = std::getenv("IMAGE_OPERATIONS_FFTW_WISDOM");
+		if (path)
+			wisdom_file = path;
+		wisdom_file_chosen = true;
+	}
+	return wisdom_file;
+}
+
+// Plans for a rows x columns transform, made once per size and kept for the
+// life of the process. Call with planner_mutex held.
+FftPlans plans_for(int rows, int columns) {
+	auto found = plan_cache.find(std::make_pair(rows, columns));
+	if (found != plan_cache.end())
+		return found->second;
+
+	const std::string& path = current_wisdom_file();
+	if (!path.empty() && !wisdom_loaded) {
+		fftw_import_wisdom_from_filename(path.c_str());
+		wisdom_loaded = true;
+	}
+	unsigned int flags = path.empty() ? FFTW_ESTIMATE : FFTW_MEASURE;
+
+	// measuring overwrites the arrays, so plan on scratch ones; every array
+	// from fftw_alloc has the same alignment, as the new-array execute needs
+	double* real = fftw_alloc_real(static_cast<size_t>(rows) * columns);
+	fftw_complex* spectrum = fftw_alloc_complex(static_cast<size_t>(rows) * (columns / 2 + 1));
+	FftPlans plans;
+	plans.forward = fftw_plan_dft_r2c_2d(rows, columns, real, spectrum, flags);
+	plans.inverse = fftw_plan_dft_c2r_2d(rows, columns, spectrum, real, flags);
+	fftw_free(spectrum);
+	fftw_free(real);
+
+	if (!path.empty())
+		fftw_export_wisdom_to_filename(path.c_str());
+	plan_cache[std::make_pair(rows, columns)] = plans;
+	return plans;
+}
+
+// sizes FFTW handles with its fast codelets
+bool fast_size(int size) {
+	for (int factor : {2, 3, 5, 7})
+		while (size % factor == 0)
+			size /= factor;
+	return size == 1;
+}
+
+int next_fast_size(int size) {
+	while (!fast_size(size))
+		++size;
+	return size;
+}
+
+// cost per output sample along one axis of a transform of `size` whose
+// valid part is size - kernel_size + 1 samples long
+double axis_cost(int size, int kernel_size) {
+	return size * std::log2(static_cast<double>(size)) / (size - kernel_size + 1);
+}
+
+// the transform length along one axis: the cheapest per output sample,
+// but never longer than one tile covering the whole image
+int transform_size(int kernel_size, int image_size) {
+	int largest = next_fast_size(image_size + kernel_size - 1);
+	int best = largest;
+	for (int size = next_fast_size(std::max(2 * kernel_size, 16)); size < largest && size <= 2048; size = next_fast_size(size + 1)) {
+		if (axis_cost(size, kernel_size) < axis_cost(best, kernel_size))
+			best = size;
+	}
+	return best;
+}
+
+inline uint8_t saturate(double value) {
+	return static_cast<uint8_t>(value < 0.0 ? 0.0 : (value > 255.0 ? 255.0 : std::floor(value + 0.5)));
+}
+
+}
+
+void fft_set_wisdom_file(const std::string& path) {
+	std::lock_guard<std::mutex> lock(planner_mutex);
+	wisdom_file = path;
+	wisdom_file_chosen = true;
+	wisdom_loaded = false;
+}
+
+double fft_cost_per_pixel(int kernel_width, int kernel_height, int image_width, int image_height) {
+	int rows = transform_size(kernel_height, image_height);
+	int columns = transform_size(kernel_width, image_width);
+	double samples = static_cast<double>(rows) * columns;
+	// a real forward and inverse transform at ~2.5 n log2 n flops between
+	// them, plus the complex products, weighted against the vectorized
+	// direct multiply-adds
+	double flops = 2.5 * samples * std::log2(samples) + 3.0 * samples;
+	double outputs = static_cast<double>(rows - kernel_height + 1) * (columns - kernel_width + 1);
+	return 4.0 * flops / outputs;
+}
+
+void fft_convolve(Image8& out, const Image8& in, const ConvolutionKernel& kernel, const ConvolutionOptions& options) {
+	if (out.width() != in.width() || out.height() != in.height() || out.channels() != 1)
+		out.resize(in.width(), in.height());
+	if (in.empty() || kernel.width <= 0 || kernel.height <= 0)
+		return;
+
+	int width = in.width();
+	int height = in.height();
+	int left = kernel.width / 2;
+	int top = kernel.height / 2;
+	int rows = transform_size(kernel.height, height);
+	int columns = transform_size(kernel.width, width);
+	int spectrum_columns = columns / 2 + 1;
+	int tile_width = columns - kernel.width + 1;
+	int tile_height = rows - kernel.height + 1;
+	size_t real_size = static_cast<size_t>(rows) * columns;
+	size_t spectrum_size = static_cast<size_t>(rows) * spectrum_columns;
+
+	FftPlans plans;
+	{
+		std::lock_guard<std::mutex> lock(planner_mutex);
+		plans = plans_for(rows, columns);
+	}
+
+	// The kernel goes in reversed and wrapped around, so the circular
+	// convolution of an input tile with it is the unflipped correlation
+	// grayscale_convolve computes. The inverse transform's scale is folded in.
+	double* kernel_real = fftw_alloc_real(real_size);
+	fftw_complex* kernel_spectrum = fftw_alloc_complex(spectrum_size);
+	std::fill(kernel_real, kernel_real + real_size, 0.0);
+	double scale = 1.0 / real_size;
+	for (int j = 0; j < kernel.height; ++j)
+		for (int i = 0; i < kernel.width; ++i)
+			kernel_real[static_cast<size_t>((rows - j) % rows) * columns + (columns - i) % columns] = kernel.at(i, j) * scale;
+	fftw_execute_dft_r2c(plans.forward, kernel_real, kernel_spectrum);
+	fftw_free(kernel_real);
+
+	int tiles_across = (width + tile_width - 1) / tile_width;
+	int tiles_down = (height + tile_height - 1) / tile_height;
+	default_thread_pool().parallel_for(0, tiles_across * tiles_down, 1, [&](int begin, int end) {
+		double* tile = fftw_alloc_real(real_size);
+		fftw_complex* spectrum = fftw_alloc_complex(spectrum_size);
+		std::vector<int> source_columns(tile_width + kernel.width - 1);
+		for (int index = begin; index < end; ++index) {
+			int x0 = (index % tiles_across) * tile_width;
+			int y0 = (index / tiles_across) * tile_height;
+
+			// overlap-save: the tile plus the kernel's reach around it
+			for (size_t u = 0; u < source_columns.size(); ++u)
+				source_columns[u] = border_index(x0 - left + static_cast<int>(u), width, options.border);
+			std::fill(tile, tile + real_size, 0.0);
+			for (int v = 0; v < tile_height + kernel.height - 1; ++v) {
+				int source_y = border_index(y0 - top + v, height, options.border);
+				double* destination = tile + static_cast<size_t>(v) * columns;
+				if (source_y < 0) {
+					std::fill(destination, destination + source_columns.size(), static_cast<double>(options.constant));
+					continue;
+				}
+				const uint8_t* source = in[source_y];
+				for (size_t u = 0; u < source_columns.size(); ++u)
+					destination[u] = source_columns[u] < 0 ? options.constant : source[source_columns[u]];
+			}
+
+			fftw_execute_dft_r2c(plans.forward, tile, spectrum);
+			for (size_t k = 0; k < spectrum_size; ++k) {
+				double real = spectrum[k][0] * kernel_spectrum[k][0] - spectrum[k][1] * kernel_spectrum[k][1];
+				double imaginary = spectrum[k][0] * kernel_spectrum[k][1] + spectrum[k][1] * kernel_spectrum[k][0];
+				spectrum[k][0] = real;
+				spectrum[k][1] = imaginary;
+			}
+			fftw_execute_dft_c2r(plans.inverse, spectrum, tile);
+
+			int valid_height = std::min(tile_height, height - y0);
+			int valid_width = std::min(tile_width, width - x0);
+			for (int y = 0; y < valid_height; ++y) {
+				const double* source = tile + static_cast<size_t>(y) * columns;
+				uint8_t* destination = out[y0 + y] + x0;
+				for (int x = 0; x < valid_width; ++x)
+					destination[x] = saturate(source[x]);
+			}
+		}
+		fftw_free(spectrum);
+		fftw_free(tile);
+	});
+	fftw_free(kernel_spectrum);
+}
@@ -0,0 +1,26 @@
+#ifndef FFT_CONVOLUTION_H
+#define FFT_CONVOLUTION_H
+
+#include <string>
+
+#include "convolution.h"
+#include "image.h"
+
+// FFTW wisdom is loaded from this file before the first plan is made and
+// written back whenever new plans were measured, so the expensive
+// FFTW_MEASURE planning happens once per machine rather than once per run.
+// Defaults to the IMAGE_OPERATIONS_FFTW_WISDOM environment variable; with no
+// wisdom file, plans use FFTW_ESTIMATE.
+void fft_set_wisdom_file(const std::string& path);
+
+// Same result as grayscale_convolve (unflipped, centred, rounded and
+// saturated, with the same border modes) computed by overlap-save: every
+// tile of output comes from one r2c/c2r transform of the input around it,
+// so the transform size depends on the kernel rather than the image.
+void fft_convolve(Image8& out, const Image8& in, const ConvolutionKernel& kernel,
+	const ConvolutionOptions& options = ConvolutionOptions());
+
+// estimated multiply-adds per output pixel for fft_convolve with this kernel
+double fft_cost_per_pixel(int kernel_width, int kernel_height, int image_width, int image_height);
+
+#endif
@@ -0,0 +1,341 @@
+#include "frame_io.h"
+
+#include <cctype>
+#include <climits>
+#include <cstdio>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "png_stream.h"
+#include "profiler.h"
+#include "thread_pool.h"
+
+namespace {
+
+struct FrameLayout {
+	long long width = 0;
+	long long height = 0;
+	long long channels = 1;
+	long long bit_depth = 8;
+	long long pitch = 0;
+	long long offset = 0;
+	// the sample value that means full scale
+	long long maxval = 255;
+};
+
+std::string lower_extension(const char* filename) {
+	std::string name = filename;
+	size_t dot = name.find_last_of("./");
+	if (dot == std::string::npos || name[dot] != '.')
+		return std::string();
+	std::string extension = name.substr(dot + 1);
+	for (char& c : extension)
+		c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+	return extension;
+}
+
+// The whole file, mapped copy-on-write and unmapped when the last holder of
+// keeper lets go. An empty file maps to nothing. Returns 0 or 1.
+int map_file(const char* filename, uint8_t*& data, size_t& size, std::shared_ptr<void>& keeper) {
+	int descriptor = open(filename, O_RDONLY);
+	if (descriptor < 0) {
+		std::cerr << "[read_mapped_gray] File " << filename << " could not be opened for reading" << std::endl;
+		return 1;
+	}
+	struct stat status;
+	if (fstat(descriptor, &status) != 0) {
+		std::cerr << "[read_mapped_gray] File " << filename << " could not be read" << std::endl;
+		close(descriptor);
+		return 1;
+	}
+	data = nullptr;
+	size = static_cast<size_t>(status.st_size);
+	if (size == 0) {
+		close(descriptor);
+		return 0;
+	}
+	void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, descriptor, 0);
+	close(descriptor);
+	if (mapping == MAP_FAILED) {
+		std::cerr << "[read_mapped_gray] File " << filename << " could not be mapped" << std::endl;
+		return 1;
+	}
+	// start reading ahead now rather than fault by fault
+	madvise(mapping, size, MADV_WILLNEED);
+	data = static_cast<uint8_t*>(mapping);
+	keeper = std::shared_ptr<void>(mapping, [size](void* address) { munmap(address, size); });
+	return 0;
+}
+
+// the next number of a PNM header, after whitespace and # comments
+bool pnm_number(const uint8_t* data, size_t size, size_t& offset, long long& value) {
+	while (offset < size) {
+		if (data[offset] == '#') {
+			while (offset < size && data[offset] != '\n')
+				++offset;
+		} else if (std::isspace(data[offset])) {
+			++offset;
+		} else {
+			break;
+		}
+	}
+	if (offset >= size || !std::isdigit(data[offset]))
+		return false;
+	value = 0;
+	while (offset < size && std::isdigit(data[offset])) {
+		value = value * 10 + (data[offset++] - '0');
+		if (value > INT_MAX)
+			return false;
+	}
+	return true;
+}
+
+// P5 or P6 up to the single whitespace byte before the samples
+int parse_pnm_header(const char* filename, const uint8_t* data, size_t size, FrameLayout& layout) {
+	size_t offset = 2;
+	long long& maxval = layout.maxval;
+	if (size < 2 || data[0] != 'P' || (data[1] != '5' && data[1] != '6')
+		|| !pnm_number(data, size, offset, layout.width) || !pnm_number(data, size, offset, layout.height)
+		|| !pnm_number(data, size, offset, maxval) || offset >= size || !std::isspace(data[offset])
+		|| layout.width < 1 || layout.height < 1 || maxval < 1 || maxval > 65535)
+	{
+		std::cerr << "[read_mapped_gray] File " << filename << " is not recognized as a binary PGM or PPM file" << std::endl;
+		return 2;
+	}
+	layout.channels = data[1] == '5' ? 1 : 3;
+	layout.bit_depth = maxval < 256 ? 8 : 16;
+	layout.pitch = layout.width * layout.channels * (layout.bit_depth / 8);
+	layout.offset = static_cast<long long>(offset) + 1;
+	return 0;
+}
+
+int read_sidecar(const std::string& path, FrameLayout& layout) {
+	std::ifstream file(path);
+	if (!file) {
+		std::cerr << "[read_mapped_gray] Sidecar " << path << " could not be opened for reading" << std::endl;
+		return 1;
+	}
+	std::string key;
+	long long value;
+	while (file >> key >> value) {
+		if (key == "width")
+			layout.width = value;
+		else if (key == "height")
+			layout.height = value;
+		else if (key == "channels")
+			layout.channels = value;
+		else if (key == "bit_depth")
+			layout.bit_depth = value;
+		else if (key == "pitch")
+			layout.pitch = value;
+		else if (key == "offset")
+			layout.offset = value;
+		else
+			break;
+	}
+	long long row_bytes = layout.width * layout.channels * (layout.bit_depth / 8);
+	if (layout.pitch == 0)
+		layout.pitch = row_bytes;
+	if (!file.eof() || layout.width <= 0 || layout.width > INT_MAX || layout.height <= 0 || layout.height > INT_MAX
+		|| layout.channels < 1 || layout.channels > 4 || (layout.bit_depth != 8 && layout.bit_depth != 16)
+		|| layout.pitch < row_bytes || layout.offset < 0)
+	{
+		std::cerr << "[read_mapped_gray] Sidecar " << path << " does not describe a frame" << std::endl;
+		return 2;
+	}
+	layout.maxval = layout.bit_depth == 8 ? 255 : 65535;
+	return 0;
+}
+
+int write_rows(FILE* file, const Image8& image, size_t pitch) {
+	std::vector<uint8_t> padding(pitch - image.row_bytes(), 0);
+	for (int y = 0; y < image.height(); ++y) {
+		if (std::fwrite(image[y], 1, image.row_bytes(), file) != image.row_bytes()
+			|| (!padding.empty() && std::fwrite(padding.data(), 1, padding.size(), file) != padding.size()))
+		{
+			return 3;
+		}
+	}
+	return 0;
+}
+
+}
+
+FrameFormat frame_format(const char* filename) {
+	std::string extension = lower_extension(filename);
+	if (extension == "pgm" || extension == "ppm" || extension == "pnm")
+		return FrameFormat::pnm;
+	if (extension == "raw")
+		return FrameFormat::raw;
+	return FrameFormat::png;
+}
+
+int read_mapped_gray(const char* filename, int& width, int& height, int& channels, int& bit_depth,
+	GrayWeights weights, Image8& gray)
+{
+	ProfileScope scope("read_mapped_gray");
+	FrameLayout layout;
+	if (frame_format(filename) == FrameFormat::raw) {
+		int result = read_sidecar(std::string(filename) + ".hdr", layout);
+		if (result != 0)
+			return result;
+	}
+	uint8_t* data = nullptr;
+	size_t size = 0;
+	std::shared_ptr<void> keeper;
+	if (map_file(filename, data, size, keeper) != 0)
+		return 1;
+	if (frame_format(filename) != FrameFormat::raw) {
+		int result = parse_pnm_header(filename, data, size, layout);
+		if (result != 0)
+			return result;
+	}
+	// offset + pitch * (height - 1) + row_bytes <= size, without overflowing
+	long long row_bytes = layout.width * layout.channels * (layout.bit_depth / 8);
+	long long available = static_cast<long long>(size);
+	if (layout.offset > available || row_bytes > available - layout.offset
+		|| (available - layout.offset - row_bytes) / layout.pitch < layout.height - 1)
+	{
+		std::cerr << "[read_mapped_gray] File " << filename << " is shorter than its frame" << std::endl;
+		return 3;
+	}
+
+	width = static_cast<int>(layout.width);
+	height = static_cast<int>(layout.height);
+	channels = static_cast<int>(layout.channels);
+	bit_depth = static_cast<int>(layout.bit_depth);
+	const uint8_t* base = data + layout.offset;
+	size_t pitch = static_cast<size_t>(layout.pitch);
+	size_t pixels = static_cast<size_t>(width) * height;
+	bool full_scale = layout.maxval == (bit_depth == 8 ? 255 : 65535);
+	if (channels == 1 && bit_depth == 8 && full_scale) {
+		// the samples are already what the pipeline works on
+		scope.set_work(pixels, 0);
+		gray.wrap(data + layout.offset, width, height, 1, pitch, std::move(keeper));
+		return 0;
+	}
+	// a frame wrapped from an earlier file is let go rather than written over
+	if (gray.wrapped())
+		Image8().swap(gray);
+	gray.resize(width, height);
+	scope.set_work(pixels, static_cast<size_t>(row_bytes) * height + pixels);
+	if (full_scale) {
+		parallel_rows(height, [&](int begin, int end) {
+			for (int y = begin; y < end; ++y)
+				gray_row(gray[y], base + static_cast<size_t>(y) * pitch, width, channels, bit_depth, weights);
+		});
+		return 0;
+	}
+	// Samples up to some other maxval, such as 1023 from a 10-bit sensor,
+	// are rescaled to 8 bits before conversion; values past maxval (which
+	// the format does not allow) read as full scale.
+	long long maxval = layout.maxval;
+	std::vector<uint8_t> scale(static_cast<size_t>(maxval) + 1);
+	for (long long value = 0; value <= maxval; ++value)
+		scale[value] = static_cast<uint8_t>((value * 255 + maxval / 2) / maxval);
+	size_t samples = static_cast<size_t>(width) * channels;
+	parallel_rows(height, [&](int begin, int end) {
+		std::vector<uint8_t> scaled(samples);
+		for (int y = begin; y < end; ++y) {
+			const uint8_t* row = base + static_cast<size_t>(y) * pitch;
+			for (size_t index = 0; index < samples; ++index) {
+				long long value = bit_depth == 8 ? row[index] : (row[2 * index] << 8) | row[2 * index + 1];
+				scaled[index] = value > maxval ? 255 : scale[value];
+			}
+			gray_row(gray[y], scaled.data(), width, channels, 8, weights);
+		}
+	});
+	return 0;
+}
+
+int write_pnm_file(const char* filename, const Image8& image) {
+	ProfileScope scope("write_pnm_file", static_cast<size_t>(image.width()) * image.height(), image.row_bytes() * image.height());
+	if (image.channels() != 1 && image.channels() != 3) {
+		std::cerr << "[write_pnm_file] PNM holds 1 or 3 channels, not " << image.channels() << std::endl;
+		return 2;
+	}
+	FILE* file = std::fopen(filename, "wb");
+	if (!file) {
+		std::cerr << "[write_pnm_file] File " << filename << " could not be opened for writing" << std::endl;
+		return 1;
+	}
+	std::fprintf(file, "P%d\n%d %d\n255\n", image.channels() == 1 ? 5 : 6, image.width(), image.height());
+	int result = write_rows(file, image, image.row_bytes());
+	if (std::fclose(file) != 0 || result != 0) {
+		std::cerr << "[write_pnm_file] Writing " << filename << " failed" << std::endl;
+		return 3;
+	}
+	return 0;
+}
+
+int write_raw_file(const char* filename, const Image8& image) {
+	ProfileScope scope("write_raw_file", static_cast<size_t>(image.width()) * image.height(), image.row_bytes() * image.height());
+	size_t pitch = (image.row_bytes() + Image8::alignment - 1) / Image8::alignment * Image8::alignment;
+	FILE* file = std::fopen(filename, "wb");
+	if (!file) {
+		std::cerr << "[write_raw_file] File " << filename << " could not be opened for writing" << std::endl;
+		return 1;
+	}
+	int result = write_rows(file, image, pitch);
+	if (std::fclose(file) != 0 || result != 0) {
+		std::cerr << "[write_raw_file] Writing " << filename << " failed" << std::endl;
+		return 3;
+	}
+
+	std::string sidecar = std::string(filename) + ".hdr";
+	file = std::fopen(sidecar.c_str(), "w");
+	if (!file) {
+		std::cerr << "[write_raw_file] File " << sidecar << " could not be opened for writing" << std::endl;
+		return 1;
+	}
+	std::fprintf(file, "width %d\nheight %d\nchannels %d\nbit_depth 8\npitch %zu\noffset 0\n",
+		image.width(), image.height(), image.channels(), pitch);
+	if (std::fclose(file) != 0) {
+		std::cerr << "[write_raw_file] Writing " << sidecar << " failed" << std::endl;
+		return 3;
+	}
+	return 0;
+}
+
+int read_gray_frame(
+	const char* filename,
+	int& width,
+	int& height,
+	png_byte& color_type,
+	png_byte& bit_depth,
+	int& number_of_passes,
+	int& stride,
+	GrayWeights weights,
+	Image8& gray)
+{
+	if (frame_format(filename) == FrameFormat::png)
+		return read_png_gray(filename, width, height, color_type, bit_depth, number_of_passes, stride, weights, gray);
+	int channels = 0;
+	int depth = 0;
+	int result = read_mapped_gray(filename, width, height, channels, depth, weights, gray);
+	if (result != 0)
+		return result;
+	const png_byte color_types[4] = {PNG_COLOR_TYPE_GRAY, PNG_COLOR_TYPE_GRAY_ALPHA, PNG_COLOR_TYPE_RGB, PNG_COLOR_TYPE_RGB_ALPHA};
+	color_type = color_types[channels - 1];
+	bit_depth = static_cast<png_byte>(depth);
+	number_of_passes = 1;
+	stride = channels;
+	return 0;
+}
+
+int write_gray_frame(const char* filename, const Image8& image) {
+	switch (frame_format(filename)) {
+	case FrameFormat::pnm:
+		return write_pnm_file(filename, image);
+	case FrameFormat::raw:
+		return write_raw_file(filename, image);
+	default:
+		return write_png_file(filename, PNG_COLOR_TYPE_GRAY, 8, image);
+	}
+}
@@ -0,0 +1,64 @@
+#ifndef FRAME_IO_H
+#define FRAME_IO_H
+
+#include "gray_conversion.h"
+#include "image.h"
+#include "png_io.h"
+
+// Uncompressed frames: binary PGM (P5) and PPM (P6), and headerless .raw
+// files described by a sidecar of "key value" lines at path + ".hdr":
+//   width 640
+//   height 480
+//   channels 1      1 to 4 samples per pixel
+//   bit_depth 8     8, or 16 for big-endian samples as PNM stores them
+//   pitch 640       bytes from one row to the next, at least a row's samples
+//   offset 0        bytes before the first row
+// Only width and height are required; the rest default to the values shown.
+enum class FrameFormat {
+	png,
+	pnm,
+	raw
+};
+
+// .pgm, .ppm and .pnm are pnm, .raw is raw and anything else is png
+FrameFormat frame_format(const char* filename);
+
+// Maps a PNM or raw file and gives its grayscale conversion, with samples
+// scaled so the header's maxval becomes 255. A file of 8-bit gray samples
+// with maxval 255 is not copied at all: gray wraps the mapping, whose pages
+// are private to the process, so processing in place writes copies of the
+// pages it touches and never the file. Anything else is converted row by row from
+// the mapping into gray's own allocation. Returns 0 on success, 1 if the
+// file cannot be opened or mapped, 2 if it is not of its format and 3 if it
+// is shorter than its header or sidecar says.
+int read_mapped_gray(const char* filename, int& width, int& height, int& channels, int& bit_depth,
+	GrayWeights weights, Image8& gray);
+
+// P5 for one channel and P6 for three, maxval 255. Returns 0 on success, 1 if
+// the file cannot be opened, 2 for another channel count and 3 if writing
+// fails.
+int write_pnm_file(const char* filename, const Image8& image);
+
+// The samples with each row padded to a multiple of Image8::alignment bytes,
+// so a frame read back is as aligned as one of our own, and the sidecar
+// that says so. Returns as write_pnm_file does.
+int write_raw_file(const char* filename, const Image8& image);
+
+// read_png_gray or read_mapped_gray by frame_format, with color_type and
+// stride those of the matching PNG and one pass
+int read_gray_frame(
+	const char* filename,
+	int& width,
+	int& height,
+	png_byte& color_type,
+	png_byte& bit_depth,
+	int& number_of_passes,
+	int& stride,
+	GrayWeights weights,
+	Image8& gray);
+
+// write_png_file as 8-bit gray, write_pnm_file or write_raw_file by
+// frame_format
+int write_gray_frame(const char* filename, const Image8& image);
+
+#endif
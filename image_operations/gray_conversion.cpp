@@ -0,0 +1,95 @@
+#include "gray_conversion.h"
+
+#include <cstring>
+
+#include "pixel_kernels.h"
+
+namespace {
+
+// Q14 weights, so every weight fits the signed 16 bits the SIMD kernels'
+// pmaddwd multiplies by. 5462 / 16384 is just over a third, which keeps the
+// truncated mean of three samples exact for every sum up to 765.
+const int gray_shift = 14;
+
+struct GrayKernel {
+	int16_t weights[4];
+	int bias;
+};
+
+GrayKernel gray_kernel(int channels, GrayWeights weights) {
+	GrayKernel kernel = {{0, 0, 0, 0}, 0};
+	if (weights == GrayWeights::equal) {
+		static const int16_t mean[5] = {0, 16384, 8192, 5462, 4096};
+		for (int channel = 0; channel < channels; ++channel)
+			kernel.weights[channel] = mean[channels];
+		return kernel;
+	}
+	kernel.bias = 1 << (gray_shift - 1);
+	if (channels < 3) {
+		kernel.weights[0] = 16384;
+	} else if (weights == GrayWeights::bt601) {
+		kernel.weights[0] = 4899;
+		kernel.weights[1] = 9617;
+		kernel.weights[2] = 1868;
+	} else {
+		kernel.weights[0] = 3483;
+		kernel.weights[1] = 11718;
+		kernel.weights[2] = 1183;
+	}
+	return kernel;
+}
+
+// 16-bit samples are weighted into a 16-bit gray value, which is then
+// rounded to 8 bits the way libpng's png_set_scale_16 does
+void gray_row_16(uint8_t* out, const uint8_t* in, int width, int channels, const GrayKernel& kernel) {
+	for (int x = 0; x < width; ++x) {
+		const uint8_t* pixel = in + 2 * x * channels;
+		uint32_t sum = kernel.bias;
+		for (int channel = 0; channel < channels; ++channel)
+			sum += ((pixel[2 * channel] << 8) | pixel[2 * channel + 1]) * static_cast<uint32_t>(kernel.weights[channel]);
+		uint32_t value = sum >> gray_shift;
+		if (value > 65535)
+			value = 65535;
+		out[x] = static_cast<uint8_t>((value * 255 + 32895) >> 16);
+	}
+}
+
+}
+
+bool parse_gray_weights(const std::string& name, GrayWeights& weights) {
+	if (name == "equal")
+		weights = GrayWeights::equal;
+	else if (name == "bt601")
+		weights = GrayWeights::bt601;
+	else if (name == "bt709")
+		weights = GrayWeights::bt709;
+	else
+		return false;
+	return true;
+}
+
+const char* gray_weights_name(GrayWeights weights) {
+	switch (weights) {
+	case GrayWeights::equal:
+		return "equal";
+	case GrayWeights::bt601:
+		return "bt601";
+	case GrayWeights::bt709:
+		return "bt709";
+	}
+	return "unknown";
+}
+
+void gray_row(uint8_t* out, const uint8_t* in, int width, int channels, int bit_depth, GrayWeights weights) {
+	GrayKernel kernel = gray_kernel(channels, weights);
+	if (bit_depth == 16) {
+		gray_row_16(out, in, width, channels, kernel);
+		return;
+	}
+	if (channels == 1) {
+		if (out != in)
+			std::memcpy(out, in, width);
+		return;
+	}
+	pixel_kernels().gray_row(out, in, width, channels, kernel.weights, kernel.bias);
+}
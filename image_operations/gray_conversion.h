@@ -0,0 +1,28 @@
+#ifndef GRAY_CONVERSION_H
+#define GRAY_CONVERSION_H
+
+#include <cstdint>
+#include <string>
+
+// How the samples of a pixel are weighted into one gray value:
+// equal is the mean of every sample, alpha included, truncated, which is
+// what the conversion has always done; bt601 and bt709 are rounded luma
+// from the red, green and blue (or gray) samples, ignoring alpha.
+enum class GrayWeights {
+	equal,
+	bt601,
+	bt709
+};
+
+// "equal", "bt601" or "bt709"; false for anything else
+bool parse_gray_weights(const std::string& name, GrayWeights& weights);
+const char* gray_weights_name(GrayWeights weights);
+
+// Converts a row of width pixels of 1 to 4 samples each to 8-bit gray.
+// bit_depth is 8 or 16; 16-bit samples are big-endian, as PNG stores them,
+// and are weighted at full precision before scaling to 8 bits. out may
+// alias in for 8-bit input.
+void gray_row(uint8_t* out, const uint8_t* in, int width, int channels, int bit_depth,
+	GrayWeights weights = GrayWeights::equal);
+
+#endif
@@ -0,0 +1,171 @@
+#include "histogram.h"
+
+#include <cstring>
+#include <mutex>
+
+#include "profiler.h"
+#include "thread_pool.h"
+
+namespace {
+
+void count_row(uint32_t (*tables)[256], const uint8_t* row, size_t count) {
+	size_t x = 0;
+	for (; x + 8 <= count; x += 8) {
+		uint64_t word;
+		std::memcpy(&word, row + x, sizeof(word));
+		++tables[0][word & 0xff];
+		++tables[1][(word >> 8) & 0xff];
+		++tables[2][(word >> 16) & 0xff];
+		++tables[3][(word >> 24) & 0xff];
+		++tables[0][(word >> 32) & 0xff];
+		++tables[1][(word >> 40) & 0xff];
+		++tables[2][(word >> 48) & 0xff];
+		++tables[3][word >> 56];
+	}
+	for (; x < count; ++x)
+		++tables[0][row[x]];
+}
+
+// low to 0 and high to 255, rounded; the identity when the range is empty
+PointLut linear_lut(int low, int high) {
+	if (high <= low)
+		return identity_point_lut();
+	PointLut lut;
+	for (int value = 0; value < 256; ++value)
+		lut.table[value] = clamp_byte(((value - low) * 255 * 2 + (high - low)) / (2 * (high - low)));
+	return lut;
+}
+
+}
+
+uint64_t Histogram::total() const {
+	uint64_t sum = 0;
+	for (int value = 0; value < 256; ++value)
+		sum += count[value];
+	return sum;
+}
+
+void grayscale_histogram(Histogram& histogram, const Image8& in) {
+	size_t pixels = in.row_elements() * in.height();
+	ProfileScope scope("grayscale_histogram", pixels, pixels);
+	std::memset(histogram.count, 0, sizeof(histogram.count));
+	std::mutex mutex;
+	parallel_rows(in.height(), [&](int begin, int end) {
+		uint32_t tables[4][256] = {};
+		for (int y = begin; y < end; ++y)
+			count_row(tables, in[y], in.row_elements());
+		std::lock_guard<std::mutex> lock(mutex);
+		for (int value = 0; value < 256; ++value)
+			histogram.count[value] += static_cast<uint64_t>(tables[0][value]) + tables[1][value] + tables[2][value] + tables[3][value];
+	});
+}
+
+int otsu_threshold(const Histogram& histogram) {
+	double total = 0.0;
+	double sum = 0.0;
+	int first = -1;
+	for (int value = 0; value < 256; ++value) {
+		total += histogram.count[value];
+		sum += static_cast<double>(value) * histogram.count[value];
+		if (first < 0 && histogram.count[value])
+			first = value;
+	}
+	if (first < 0)
+		return 0;
+	// class 0 is [0, threshold)
+	int best = first;
+	double best_variance = -1.0;
+	double weight = 0.0;
+	double weighted = 0.0;
+	for (int threshold = 1; threshold < 256; ++threshold) {
+		weight += histogram.count[threshold - 1];
+		weighted += static_cast<double>(threshold - 1) * histogram.count[threshold - 1];
+		if (weight == 0.0)
+			continue;
+		if (weight == total)
+			break;
+		double difference = sum * weight - weighted * total;
+		double variance = difference * difference / (weight * (total - weight));
+		if (variance > best_variance) {
+			best_variance = variance;
+			best = threshold;
+		}
+	}
+	return best;
+}
+
+int triangle_threshold(const Histogram& histogram) {
+	int left = 0;
+	while (left < 256 && histogram.count[left] == 0)
+		++left;
+	if (left == 256)
+		return 0;
+	int right = 255;
+	while (histogram.count[right] == 0)
+		--right;
+	int peak = left;
+	for (int value = left; value <= right; ++value)
+		if (histogram.count[value] > histogram.count[peak])
+			peak = value;
+	if (left == right)
+		return left;
+
+	// the line runs from the peak to the far end of the longer tail; the
+	// threshold is the value whose count lies furthest below it, and the
+	// foreground the tail side of it
+	bool tail_right = right - peak > peak - left;
+	int end = tail_right ? right : left;
+	double peak_count = static_cast<double>(histogram.count[peak]);
+	double end_count = static_cast<double>(histogram.count[end]);
+	int best = peak;
+	double best_distance = -1.0;
+	int step = tail_right ? 1 : -1;
+	for (int value = peak; value != end + step; value += step) {
+		// distance below the line, up to the line's constant length factor
+		double along = static_cast<double>(value - peak) / (end - peak);
+		double line = peak_count + along * (end_count - peak_count);
+		double distance = line - static_cast<double>(histogram.count[value]);
+		if (distance > best_distance) {
+			best_distance = distance;
+			best = value;
+		}
+	}
+	// the split is just above best whichever side the tail is on
+	return best + 1;
+}
+
+PointLut auto_stretch_lut(const Histogram& histogram, double clip) {
+	uint64_t total = histogram.total();
+	if (total == 0)
+		return identity_point_lut();
+	uint64_t skip = static_cast<uint64_t>(clip * static_cast<double>(total));
+	int low = 0;
+	uint64_t below = 0;
+	while (low < 255 && below + histogram.count[low] <= skip)
+		below += histogram.count[low++];
+	int high = 255;
+	uint64_t above = 0;
+	while (high > 0 && above + histogram.count[high] <= skip)
+		above += histogram.count[high--];
+	return linear_lut(low, high);
+}
+
+PointLut equalize_lut(const Histogram& histogram) {
+	uint64_t total = histogram.total();
+	int first = 0;
+	while (first < 256 && histogram.count[first] == 0)
+		++first;
+	if (first == 256 || histogram.count[first] == total)
+		return identity_point_lut();
+	// the lowest value present maps to 0 and the highest to 255
+	uint64_t base = histogram.count[first];
+	uint64_t span = total - base;
+	PointLut lut;
+	uint64_t cumulative = 0;
+	for (int value = 0; value < 256; ++value) {
+		cumulative += histogram.count[value];
+		uint64_t rank = cumulative > base ? cumulative - base : 0;
+		lut.table[value] = static_cast<uint8_t>((rank * 255 + span / 2) / span);
+	}
+	return lut;
+}
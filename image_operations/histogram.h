@@ -0,0 +1,36 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <cstdint>
+
+#include "image.h"
+#include "point_operations.h"
+
+struct Histogram {
+	uint64_t count[256];
+
+	uint64_t total() const;
+};
+
+// Counts every sample of in. Each band of rows counts into four interleaved
+// tables, one per byte lane of a word, so runs of equal pixels do not wait on
+// the increment of the same counter, and the bands' tables are summed at the
+// end.
+void grayscale_histogram(Histogram& histogram, const Image8& in);
+
+// Thresholds for grayscale_threshold: pixels at or above them become 1.
+// otsu maximizes the variance between the two classes; triangle takes the
+// value furthest below the line from the histogram's peak to the end of its
+// longer tail, which suits a small foreground on a large background. An
+// image of one value gives that value.
+int otsu_threshold(const Histogram& histogram);
+int triangle_threshold(const Histogram& histogram);
+
+// Linear stretch of the range left after dropping clip (a fraction) of the
+// pixels at either end onto 0..255.
+PointLut auto_stretch_lut(const Histogram& histogram, double clip = 0.01);
+// Maps each value to its rank, so the output histogram is as flat as the
+// input allows.
+PointLut equalize_lut(const Histogram& histogram);
+
+#endif
@@ -0,0 +1,156 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+
+#include "profiler.h"
+
+// A single contiguous, 64-byte aligned plane of width * channels samples per row.
+// Rows are padded so that every row starts on a 64-byte boundary; pitch() is the
+// distance between rows in elements. image[y] and row(y) are views of one row.
+// An image can instead wrap memory it does not own, such as a mapped file,
+// keeping that memory's pitch and alignment.
+template <typename T>
+class Image {
+public:
+	static const size_t alignment = 64;
+
+	Image() {}
+
+	Image(int width, int height, int channels = 1) {
+		resize(width, height, channels);
+	}
+
+	Image(const Image& other) {
+		resize(other.width_, other.height_, other.channels_);
+		for (int y = 0; y < height_; ++y)
+			std::memcpy(row(y), other.row(y), row_bytes());
+	}
+
+	Image(Image&& other) noexcept {
+		swap(other);
+	}
+
+	~Image() {
+		if (!wrapped_)
+			std::free(data_);
+	}
+
+	Image& operator=(Image other) noexcept {
+		swap(other);
+		return *this;
+	}
+
+	// reshape the image, reusing the existing allocation when it is large enough;
+	// a wrapped image keeps its rows only while the shape stays the same
+	void resize(int width, int height, int channels = 1) {
+		if (wrapped_) {
+			if (width == width_ && height == height_ && channels == channels_)
+				return;
+			release();
+		}
+		size_t row_size = static_cast<size_t>(width) * channels * sizeof(T);
+		size_t pitch_bytes = (row_size + alignment - 1) / alignment * alignment;
+		size_t bytes = pitch_bytes * height;
+		if (bytes > capacity_) {
+			std::free(data_);
+			data_ = static_cast<T*>(std::aligned_alloc(alignment, bytes));
+			if (!data_ && bytes > 0) {
+				capacity_ = 0;
+				throw std::bad_alloc();
+			}
+			capacity_ = bytes;
+			if (profiling_enabled())
+				profile_allocation(bytes);
+		}
+		width_ = width;
+		height_ = height;
+		channels_ = channels;
+		pitch_ = pitch_bytes / sizeof(T);
+	}
+
+	void fill(T value) {
+		for (int y = 0; y < height_; ++y) {
+			T* r = row(y);
+			for (size_t x = 0; x < row_elements(); ++x)
+				r[x] = value;
+		}
+	}
+
+	// Views height rows of width * channels samples, pitch elements apart, that
+	// the image does not own; keeper holds them alive until the image lets go.
+	// Writes go to the wrapped memory.
+	void wrap(T* data, int width, int height, int channels, size_t pitch, std::shared_ptr<void> keeper = nullptr) {
+		release();
+		data_ = data;
+		width_ = width;
+		height_ = height;
+		channels_ = channels;
+		pitch_ = pitch;
+		wrapped_ = true;
+		keeper_ = std::move(keeper);
+	}
+
+	void swap(Image& other) noexcept {
+		T* data = data_; data_ = other.data_; other.data_ = data;
+		size_t capacity = capacity_; capacity_ = other.capacity_; other.capacity_ = capacity;
+		size_t pitch = pitch_; pitch_ = other.pitch_; other.pitch_ = pitch;
+		int width = width_; width_ = other.width_; other.width_ = width;
+		int height = height_; height_ = other.height_; other.height_ = height;
+		int channels = channels_; channels_ = other.channels_; other.channels_ = channels;
+		bool wrapped = wrapped_; wrapped_ = other.wrapped_; other.wrapped_ = wrapped;
+		keeper_.swap(other.keeper_);
+	}
+
+	T* row(int y) { return data_ + static_cast<size_t>(y) * pitch_; }
+	const T* row(int y) const { return data_ + static_cast<size_t>(y) * pitch_; }
+	T* operator[](int y) { return row(y); }
+	const T* operator[](int y) const { return row(y); }
+
+	T* data() { return data_; }
+	const T* data() const { return data_; }
+	int width() const { return width_; }
+	int height() const { return height_; }
+	int channels() const { return channels_; }
+	size_t pitch() const { return pitch_; }
+	size_t row_elements() const { return static_cast<size_t>(width_) * channels_; }
+	size_t row_bytes() const { return row_elements() * sizeof(T); }
+	bool empty() const { return width_ == 0 || height_ == 0; }
+	bool wrapped() const { return wrapped_; }
+
+private:
+	void release() {
+		if (!wrapped_)
+			std::free(data_);
+		data_ = nullptr;
+		capacity_ = 0;
+		wrapped_ = false;
+		keeper_.reset();
+	}
+
+	T* data_ = nullptr;
+	size_t capacity_ = 0;
+	size_t pitch_ = 0;
+	int width_ = 0;
+	int height_ = 0;
+	int channels_ = 0;
+	bool wrapped_ = false;
+	std::shared_ptr<void> keeper_;
+};
+
+template <typename T>
+void swap(Image<T>& lhs, Image<T>& rhs) noexcept {
+	lhs.swap(rhs);
+}
+
+typedef Image<uint8_t> Image8;
+typedef Image<uint16_t> Image16;
+typedef Image<uint32_t> Image32;
+typedef Image<float> ImageF;
+
+#endif
@@ -1,203 +1,109 @@
 #include <cstdio>
+#include <cstdlib>
 #include <fftw3.h>
-#include <functional>
 #include <iostream>
-
-extern "C"
-{
-	#include <png.h>
-}
-
-int read_png_file(
-	const char* filename,
-	int& width,
-	int& height,
-	png_byte& color_type,
-	png_byte& bit_depth,
-	int& number_of_passes,
-	int& stride,
-	png_bytep*& row_pointers)
-{
-	// open file and test for it being a png
-	FILE *fp = fopen(filename, "rb");
-	if (!fp) {
-		std::cerr << "[read_png_file] File " << filename << " could not be opened for reading" << std::endl;
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "background_model.h"
+#include "batch.h"
+#include "binary_image.h"
+#include "connected_components.h"
+#include "convolution.h"
+#include "cpu_dispatch.h"
+#include "fft_convolution.h"
+#include "frame_io.h"
+#include "gray_conversion.h"
+#include "image.h"
+#include "integral_image.h"
+#include "neighbourhood_operations.h"
+#include "pipeline.h"
+#include "png_encoder.h"
+#include "png_io.h"
+#include "png_stream.h"
+#include "point_operations.h"
+#include "profiler.h"
+#include "row_pipeline.h"
+#include "thread_pool.h"
+
+// Decodes, converts to grayscale, runs the stages and encodes one row at a
+// time. Decoding runs a few rows ahead on its own thread, so it overlaps the
+// processing and encoding, and only the queue and the stages' rings are ever
+// in memory. Returns 1 if reading fails and 2 if writing fails.
+int stream_png_file(const char* input, const char* output, const std::vector<RowStage>& stages, GrayWeights weights) {
+	PngRowReader reader;
+	int open_result = reader.open(input);
+	if (open_result == 8) {
+		std::cerr << "[stream_png_file] File " << input << " is interlaced and cannot be streamed" << std::endl;
+	}
+	if (open_result != 0) {
 		return 1;
 	}
-	char header[8];
-	fread(header, 1, 8, fp);
-	if (png_sig_cmp(reinterpret_cast<unsigned char*>(header), 0, 8)) {
-		std::cerr << "[read_png_file] File " << filename << " is not recognized as a PNG file" << std::endl;
-		return 2;
-	}
-
-	// initialize stuff
-	png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-
-	if (!png_ptr) {
-		std::cerr << "[read_png_file] png_create_read_struct failed" << std::endl;
-		return 4;
-	}
-
-	png_infop info_ptr = png_create_info_struct(png_ptr);
-	if (!info_ptr)
-	{
-		std::cerr << "[read_png_file] png_create_info_struct failed" << std::endl;
-		return 5;
-	}
-
-	if (setjmp(png_jmpbuf(png_ptr)))
-	{
-		std::cerr << "[read_png_file] Error during init_io" << std::endl;
-		return 6;
-	}
-
-
-	png_init_io(png_ptr, fp);
-	png_set_sig_bytes(png_ptr, 8);
-
-	png_read_info(png_ptr, info_ptr);
-
-	width = png_get_image_width(png_ptr, info_ptr);
-	height = png_get_image_height(png_ptr, info_ptr);
-	color_type = png_get_color_type(png_ptr, info_ptr);
-	bit_depth = png_get_bit_depth(png_ptr, info_ptr);
-
-	number_of_passes = png_set_interlace_handling(png_ptr);
-	png_read_update_info(png_ptr, info_ptr);
+	int width = reader.width();
+	int height = reader.height();
+	std::cout << "Width: " << width << std::endl;
+	std::cout << "Height: " << height << std::endl;
+	std::cout << "Color type: " << static_cast<int>(reader.color_type()) << std::endl;
+	std::cout << "Bit depth: " << static_cast<int>(reader.bit_depth()) << std::endl;
 
-	// read file
-	if (setjmp(png_jmpbuf(png_ptr)))
-	{
-		std::cerr << "[read_png_file] Error during read_png_file" << std::endl;
+	PngRowWriter writer;
+	if (output && writer.open(output, width, height, PNG_COLOR_TYPE_GRAY, 8) != 0) {
+		return 2;
 	}
 
-	row_pointers = reinterpret_cast<png_bytep*>(malloc(sizeof(png_bytep) * height));
-	for (int y = 0; y < height; ++y)
-		row_pointers[y] = reinterpret_cast<png_byte*>(malloc(png_get_rowbytes(png_ptr,info_ptr)));
-
-	png_read_image(png_ptr, row_pointers);
+	RowQueue decoded(reader.row_bytes(), 16);
+	int read_result = 0;
+	std::thread decoder([&]() {
+		for (int y = 0; y < height; ++y) {
+			png_bytep row = decoded.begin_write();
+			if (!row) {
+				break;
+			}
+			read_result = reader.read_row(row);
+			if (read_result != 0) {
+				break;
+			}
+			decoded.end_write();
+		}
+		decoded.close();
+	});
 
-	// print info
-	if (png_get_color_type(png_ptr, info_ptr) == PNG_COLOR_TYPE_PALETTE)
-	{
-		std::cout << "Palette image detected" << std::endl;
-		stride = 1;
-	}
-	else if (png_get_color_type(png_ptr, info_ptr) == PNG_COLOR_TYPE_RGB)
-	{
-		std::cout << "RGB image detected" << std::endl;
-		stride = 3;
-	}
-	else if (png_get_color_type(png_ptr, info_ptr) == PNG_COLOR_TYPE_RGBA)
-	{
-		std::cout << "RGBA image detected" << std::endl;
-		stride = 4;
-	}
-	else if (png_get_color_type(png_ptr, info_ptr) == PNG_COLOR_TYPE_GRAY_ALPHA)
-	{
-		std::cout << "Gray alpha image detected" << std::endl;
-		stride = 2;
-	}
-	else if (png_get_color_type(png_ptr, info_ptr) == PNG_COLOR_TYPE_GRAY)
-	{
-		std::cout << "Gray image detected" << std::endl;
-		stride = 1;
+	int write_result = 0;
+	RowPipeline pipeline(width, height, stages, [&](const uint8_t* row, int) {
+		if (output && write_result == 0) {
+			write_result = writer.write_row(row);
+		}
+	});
+	std::vector<png_byte> gray(width);
+	int rows = 0;
+	while (const png_byte* row = decoded.begin_read()) {
+		gray_row(gray.data(), row, width, reader.channels(), reader.bit_depth(), weights);
+		decoded.end_read();
+		pipeline.push(gray.data());
+		++rows;
+		if (write_result != 0) {
+			decoded.close();
+			break;
+		}
 	}
+	decoder.join();
 
-	fclose(fp);
-
-
-	return 0;
-}
-
-int write_png_file(
-	const char* file_name,
-	int& width,
-	int& height,
-	png_byte& color_type,
-	png_byte& bit_depth,
-	png_bytep*& row_pointers)
-{
-	// create file
-	FILE *fp = fopen(file_name, "wb");
-	if (!fp) {
-		std::cerr << "[write_png_file] File " << file_name << " could not be opened for writing" << std::endl;
+	if (read_result != 0 || (rows != height && write_result == 0)) {
 		return 1;
 	}
-
-	// initialize stuff
-	png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-
-	if (!png_ptr)
-	{
-		std::cerr << "[write_png_file] png_create_write_struct failed" << std::endl;
+	if (write_result != 0 || (output && writer.close() != 0)) {
 		return 2;
 	}
-
-	png_infop info_ptr = png_create_info_struct(png_ptr);
-	if (!info_ptr)
-	{
-		std::cerr << "[write_png_file] png_create_info_struct failed" << std::endl;
-		return 3;
-	}
-
-	if (setjmp(png_jmpbuf(png_ptr)))
-	{
-		std::cerr << "[write_png_file] Error during init_io" << std::endl;
-		return 4;
-	}
-
-	png_init_io(png_ptr, fp);
-
-
-	// write header
-	if (setjmp(png_jmpbuf(png_ptr)))
-	{
-		std::cerr << "[write_png_file] Error during writing header" << std::endl;
-		return 5;
-	}
-
-	png_set_IHDR(png_ptr, info_ptr, width, height,
-			bit_depth, color_type, PNG_INTERLACE_NONE,
-			PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
-
-	png_write_info(png_ptr, info_ptr);
-
-
-	// write bytes
-	if (setjmp(png_jmpbuf(png_ptr)))
-	{
-		std::cerr << "[write_png_file] Error during writing bytes" << std::endl;
-		return 6;
-	}
-
-	png_write_image(png_ptr, row_pointers);
-
-
-	// end write
-	if (setjmp(png_jmpbuf(png_ptr)))
-	{
-		std::cerr << "[write_png_file] Error during end of write" << std::endl;
-		return 7;
-	}
-
-	png_write_end(png_ptr, NULL);
-
-	// cleanup heap allocation
-	for (int y = 0; y < height; ++y)
-		free(row_pointers[y]);
-	free(row_pointers);
-
-	fclose(fp);
+	std::cout << "Streamed " << rows << " rows holding " << pipeline.depth() << " rows in the pipeline" << std::endl;
 	return 0;
 }
 
-void print_image(png_bytep* row_pointers, int width, int height, int stride) {
-	for (int y = 0; y < height; ++y) {
-		png_byte* row = row_pointers[y];
-		for (int x = 0; x < width; ++x) {
-			png_byte* ptr = &row[x*stride];
+void print_image(const Image8& image, int stride) {
+	for (int y = 0; y < image.height(); ++y) {
+		const png_byte* row = image[y];
+		for (int x = 0; x < image.width(); ++x) {
+			const png_byte* ptr = &row[x*stride];
 
 			std::cout << "[";
 			for (int offset = 0; offset < stride; ++offset) {
@@ -208,360 +114,174 @@ void print_image(png_bytep* row_pointers, int width, int height, int stride) {
 	}
 }
 
-int grayscale_copy(int lhs, int rhs) {
-	return rhs;
-}
-
-int grayscale_add(int lhs, int rhs) {
-	return lhs + rhs;
-}
-
-int grayscale_average(int lhs, int rhs) {
-	return (lhs + rhs) / 2;
-}
-
-int grayscale_learn_average(int lhs, int rhs) {
-	return (lhs * 16 + rhs + 8) / 16;
-}
-
-int grayscale_set(int value, int alpha) {
-	return alpha;
-}
-
-int grayscale_brighten(int value, int beta) {
-	return value + beta;
-}
-
-int grayscale_stretch(int value, float gamma, int beta) {
-	return static_cast<int>(static_cast<float>(value) * gamma) + beta;
-}
-
-int grayscale_invert(int value) {
-	return 255 - value;
-}
-
-int grayscale_threshold(int value, int threshold) {
-	return value < threshold ? 0 : 1;
-}
-
-int grayscale_invert_threshold(int value, int threshold) {
-	return value < threshold ? 1 : 0;
-}
-
-int bit_display(int value) {
-	return value > 0 ? 255 : 0;
-}
-
-int bit_invert_display(int value) {
-	return value <= 0 ? 255 : 0;
-}
-
-int bit_not(int value) {
-	return !value;
-}
-
-int bit_invert(int value) {
-	return 1 - value;
-}
-
-int bit_and(int lhs, int rhs) {
-	return lhs && rhs;
-}
-
-void single_channel_apply(std::function<int(int)> fn, png_bytep* row_pointers, int width, int height) {
-	for (int y = 0; y < height; ++y) {
-		for (int x = 0; x < width; ++x) {
-			row_pointers[y][x] = std::max(0, std::min(255, fn(row_pointers[y][x])));
-		}
-	}
-}
-
-void single_channel_apply(std::function<int(int, int)> fn, png_bytep* lhs_row_pointers, png_bytep* rhs_row_pointers, int width, int height) {
-	for (int y = 0; y < height; ++y) {
-		for (int x = 0; x < width; ++x) {
-			lhs_row_pointers[y][x] = std::max(0, std::min(255, fn(lhs_row_pointers[y][x], rhs_row_pointers[y][x])));
+int main(int argc, char** argv) {
+	// options may appear anywhere; everything else is the input and optional output path
+	std::vector<const char*> paths;
+	bool stream = false;
+	bool batch = false;
+	GrayWeights weights = GrayWeights::equal;
+	Pipeline pipeline;
+	const char* profile_path = nullptr;
+	const char* trace_path = nullptr;
+	const char* blobs_path = nullptr;
+	Connectivity connectivity = Connectivity::eight;
+	bool background = false;
+	int background_rate = 4;
+	int background_threshold = 24;
+	const char* checkpoint_path = nullptr;
+	int checkpoint_every = 100;
+	PngOptions png;
+	for (int index = 1; index < argc; ++index) {
+		std::string argument = argv[index];
+		if (argument == "--threads" && index + 1 < argc) {
+			set_thread_count(std::atoi(argv[++index]));
+		} else if (argument == "--isa" && index + 1 < argc) {
+			// scalar, sse42, avx2 or avx512 kernels, rather than the best the CPU has
+			IsaLevel level;
+			if (!parse_isa_level(argv[++index], level)) {
+				std::cerr << "[main] Unknown instruction set level " << argv[index] << std::endl;
+				return 1;
+			}
+			set_isa_level(level);
+		} else if (argument == "--fftw-wisdom" && index + 1 < argc) {
+			fft_set_wisdom_file(argv[++index]);
+		} else if (argument == "--gray" && index + 1 < argc) {
+			// equal, bt601 or bt709 weights for the grayscale conversion
+			if (!parse_gray_weights(argv[++index], weights)) {
+				std::cerr << "[main] Unknown grayscale weights " << argv[index] << std::endl;
+				return 1;
+			}
+		} else if (argument == "--stream") {
+			stream = true;
+		} else if (argument == "--batch") {
+			batch = true;
+		} else if (argument == "--background") {
+			// a batch in input order, writing each frame's foreground against
+			// the running background of the frames before it
+			batch = true;
+			background = true;
+		} else if (argument == "--background-rate" && index + 1 < argc) {
+			// the model moves 1/2^n of the way to each frame
+			background_rate = std::atoi(argv[++index]);
+		} else if (argument == "--background-threshold" && index + 1 < argc) {
+			background_threshold = std::atoi(argv[++index]);
+		} else if (argument == "--checkpoint" && index + 1 < argc) {
+			// resume the background model from this file if it exists, and
+			// save it there every --checkpoint-every frames and at the end
+			checkpoint_path = argv[++index];
+		} else if (argument == "--checkpoint-every" && index + 1 < argc) {
+			checkpoint_every = std::atoi(argv[++index]);
+		} else if (argument == "--profile" && index + 1 < argc) {
+			// per-stage report, as CSV for a .csv path and JSON otherwise
+			profile_path = argv[++index];
+			profiler_enable();
+		} else if (argument == "--trace" && index + 1 < argc) {
+			// Chrome trace-event file
+			trace_path = argv[++index];
+			profiler_enable();
+		} else if (argument == "--blobs" && index + 1 < argc) {
+			// label the nonzero pixels of the result and write their stats as CSV
+			blobs_path = argv[++index];
+		} else if (argument == "--connectivity" && index + 1 < argc) {
+			std::string value = argv[++index];
+			if (value != "4" && value != "8") {
+				std::cerr << "[main] Connectivity must be 4 or 8, not " << value << std::endl;
+				return 1;
+			}
+			connectivity = value == "4" ? Connectivity::four : Connectivity::eight;
+		} else if (argument == "--png-preset" && index + 1 < argc) {
+			// default, small or fast; --png-level and --png-filter after it adjust it
+			if (!parse_png_preset(argv[++index], png)) {
+				std::cerr << "[main] Unknown PNG preset " << argv[index] << std::endl;
+				return 1;
+			}
+		} else if (argument == "--png-level" && index + 1 < argc) {
+			png.level = std::atoi(argv[++index]);
+		} else if (argument == "--png-filter" && index + 1 < argc) {
+			if (!parse_png_filter(argv[++index], png.filter)) {
+				std::cerr << "[main] Unknown PNG filter " << argv[index] << std::endl;
+				return 1;
+			}
+		} else if (argument == "--pipeline" && index + 1 < argc) {
+			// a spec, or @file to read the spec from a file
+			std::string spec = argv[++index];
+			int result = spec.size() > 1 && spec[0] == '@' ? load_pipeline(spec.c_str() + 1, pipeline) : parse_pipeline(spec, pipeline);
+			if (result != 0) {
+				return 1;
+			}
+		} else {
+			paths.push_back(argv[index]);
 		}
 	}
-}
-
-void shrink(png_bytep* out_row_pointers, png_bytep* row_pointers, int x_in, int y_in, int width, int height) {
-	if (x_in - 1 < 0) {
-		out_row_pointers[y_in][x_in] = row_pointers[y_in][x_in];
-		return;
-	}
-	if (y_in - 1 < 0) {
-		out_row_pointers[y_in][x_in] = row_pointers[y_in][x_in];
-		return;
-	}
-	if (x_in + 1 > width - 1) {
-		out_row_pointers[y_in][x_in] = row_pointers[y_in][x_in];
-		return;
-	}
-	if (y_in + 1 > height - 1) {
-		out_row_pointers[y_in][x_in] = row_pointers[y_in][x_in];
-		return;
-	}
-	int sigma = row_pointers[y_in - 1][x_in - 1] +
-	            row_pointers[y_in - 1][x_in]  +
-	            row_pointers[y_in - 1][x_in + 1] +
-	            row_pointers[y_in][x_in - 1] +
-	            row_pointers[y_in][x_in + 1] +
-	            row_pointers[y_in + 1][x_in - 1] +
-	            row_pointers[y_in + 1][x_in] +
-	            row_pointers[y_in + 1][x_in + 1];
-	if (sigma < 8) {
-		out_row_pointers[y_in][x_in] = 0;
-	} else {
-		out_row_pointers[y_in][x_in] = row_pointers[y_in][x_in];
-	}
-}
-
-void expand(png_bytep* out_row_pointers, png_bytep* row_pointers, int x_in, int y_in, int width, int height) {
-	if (x_in - 1 < 0) {
-		out_row_pointers[y_in][x_in] = row_pointers[y_in][x_in];
-		return;
-	}
-	if (y_in - 1 < 0) {
-		out_row_pointers[y_in][x_in] = row_pointers[y_in][x_in];
-		return;
-	}
-	if (x_in + 1 > width - 1) {
-		out_row_pointers[y_in][x_in] = row_pointers[y_in][x_in];
-		return;
-	}
-	if (y_in + 1 > height - 1) {
-		out_row_pointers[y_in][x_in] = row_pointers[y_in][x_in];
-		return;
-	}
-	int sigma = row_pointers[y_in - 1][x_in - 1] +
-	            row_pointers[y_in - 1][x_in]  +
-	            row_pointers[y_in - 1][x_in + 1] +
-	            row_pointers[y_in][x_in - 1] +
-	            row_pointers[y_in][x_in + 1] +
-	            row_pointers[y_in + 1][x_in - 1] +
-	            row_pointers[y_in + 1][x_in] +
-	            row_pointers[y_in + 1][x_in + 1];
-	if (sigma > 0) {
-		out_row_pointers[y_in][x_in] = 1;
-	} else {
-		out_row_pointers[y_in][x_in] = row_pointers[y_in][x_in];
-	}
-}
-
-void edge(png_bytep* out_row_pointers, png_bytep* row_pointers, int x_in, int y_in, int width, int height) {
-	if (x_in - 1 < 0) {
-		out_row_pointers[y_in][x_in] = 0;
-		return;
-	}
-	if (y_in - 1 < 0) {
-		out_row_pointers[y_in][x_in] = 0;
-		return;
-	}
-	if (x_in + 1 > width - 1) {
-		out_row_pointers[y_in][x_in] = 0;
-		return;
-	}
-	if (y_in + 1 > height - 1) {
-		out_row_pointers[y_in][x_in] = 0;
-		return;
-	}
-	int sigma = row_pointers[y_in - 1][x_in - 1] +
-	            row_pointers[y_in - 1][x_in]  +
-	            row_pointers[y_in - 1][x_in + 1] +
-	            row_pointers[y_in][x_in - 1] +
-	            row_pointers[y_in][x_in + 1] +
-	            row_pointers[y_in + 1][x_in - 1] +
-	            row_pointers[y_in + 1][x_in] +
-	            row_pointers[y_in + 1][x_in + 1];
-	if (sigma == 8) {
-		out_row_pointers[y_in][x_in] = 0;
-	} else {
-		out_row_pointers[y_in][x_in] = row_pointers[y_in][x_in];
-	}
-}
-
-void salt(png_bytep* out_row_pointers, png_bytep* row_pointers, int x_in, int y_in, int width, int height) {
-	if (x_in - 1 < 0) {
-		out_row_pointers[y_in][x_in] = row_pointers[y_in][x_in];
-		return;
-	}
-	if (y_in - 1 < 0) {
-		out_row_pointers[y_in][x_in] = row_pointers[y_in][x_in];
-		return;
-	}
-	if (x_in + 1 > width - 1) {
-		out_row_pointers[y_in][x_in] = row_pointers[y_in][x_in];
-		return;
-	}
-	if (y_in + 1 > height - 1) {
-		out_row_pointers[y_in][x_in] = row_pointers[y_in][x_in];
-		return;
-	}
-	int sigma = row_pointers[y_in - 1][x_in - 1] +
-	            row_pointers[y_in - 1][x_in]  +
-	            row_pointers[y_in - 1][x_in + 1] +
-	            row_pointers[y_in][x_in - 1] +
-	            row_pointers[y_in][x_in + 1] +
-	            row_pointers[y_in + 1][x_in - 1] +
-	            row_pointers[y_in + 1][x_in] +
-	            row_pointers[y_in + 1][x_in + 1];
-	if (sigma == 8) {
-		out_row_pointers[y_in][x_in] = 1;
-	} else {
-		out_row_pointers[y_in][x_in] = row_pointers[y_in][x_in];
-	}
-}
-
-void pepper(png_bytep* out_row_pointers, png_bytep* row_pointers, int x_in, int y_in, int width, int height) {
-	if (x_in - 1 < 0) {
-		out_row_pointers[y_in][x_in] = row_pointers[y_in][x_in];
-		return;
-	}
-	if (y_in - 1 < 0) {
-		out_row_pointers[y_in][x_in] = row_pointers[y_in][x_in];
-		return;
-	}
-	if (x_in + 1 > width - 1) {
-		out_row_pointers[y_in][x_in] = row_pointers[y_in][x_in];
-		return;
-	}
-	if (y_in + 1 > height - 1) {
-		out_row_pointers[y_in][x_in] = row_pointers[y_in][x_in];
-		return;
-	}
-	int sigma = row_pointers[y_in - 1][x_in - 1] +
-	            row_pointers[y_in - 1][x_in]  +
-	            row_pointers[y_in - 1][x_in + 1] +
-	            row_pointers[y_in][x_in - 1] +
-	            row_pointers[y_in][x_in + 1] +
-	            row_pointers[y_in + 1][x_in - 1] +
-	            row_pointers[y_in + 1][x_in] +
-	            row_pointers[y_in + 1][x_in + 1];
-	if (sigma == 8) {
-		out_row_pointers[y_in][x_in] = 0;
-	} else {
-		out_row_pointers[y_in][x_in] = row_pointers[y_in][x_in];
-	}
-}
-
-void noise(png_bytep* out_row_pointers, png_bytep* row_pointers, int x_in, int y_in, int width, int height) {
-	if (x_in - 1 < 0) {
-		out_row_pointers[y_in][x_in] = row_pointers[y_in][x_in];
-		return;
-	}
-	if (y_in - 1 < 0) {
-		out_row_pointers[y_in][x_in] = row_pointers[y_in][x_in];
-		return;
-	}
-	if (x_in + 1 > width - 1) {
-		out_row_pointers[y_in][x_in] = row_pointers[y_in][x_in];
-		return;
-	}
-	if (y_in + 1 > height - 1) {
-		out_row_pointers[y_in][x_in] = row_pointers[y_in][x_in];
-		return;
-	}
-	int sigma = row_pointers[y_in - 1][x_in - 1] +
-	            row_pointers[y_in - 1][x_in]  +
-	            row_pointers[y_in - 1][x_in + 1] +
-	            row_pointers[y_in][x_in - 1] +
-	            row_pointers[y_in][x_in + 1] +
-	            row_pointers[y_in + 1][x_in - 1] +
-	            row_pointers[y_in + 1][x_in] +
-	            row_pointers[y_in + 1][x_in + 1];
-	if (sigma == 0) {
-		out_row_pointers[y_in][x_in] = 0;
-	} else if (sigma == 8) {
-		out_row_pointers[y_in][x_in] = 1;
-	} else {
-		out_row_pointers[y_in][x_in] = row_pointers[y_in][x_in];
-	}
-}
-
-void noize(png_bytep* out_row_pointers, png_bytep* row_pointers, int x_in, int y_in, int width, int height) {
-	if (x_in - 1 < 0) {
-		out_row_pointers[y_in][x_in] = row_pointers[y_in][x_in];
-		return;
-	}
-	if (y_in - 1 < 0) {
-		out_row_pointers[y_in][x_in] = row_pointers[y_in][x_in];
-		return;
-	}
-	if (x_in + 1 > width - 1) {
-		out_row_pointers[y_in][x_in] = row_pointers[y_in][x_in];
-		return;
-	}
-	if (y_in + 1 > height - 1) {
-		out_row_pointers[y_in][x_in] = row_pointers[y_in][x_in];
-		return;
-	}
-	int sigma = row_pointers[y_in - 1][x_in - 1] +
-	            row_pointers[y_in - 1][x_in]  +
-	            row_pointers[y_in - 1][x_in + 1] +
-	            row_pointers[y_in][x_in - 1] +
-	            row_pointers[y_in][x_in + 1] +
-	            row_pointers[y_in + 1][x_in - 1] +
-	            row_pointers[y_in + 1][x_in] +
-	            row_pointers[y_in + 1][x_in + 1];
-	if (sigma < 2) {
-		out_row_pointers[y_in][x_in] = 0;
-	} else if (sigma > 6) {
-		out_row_pointers[y_in][x_in] = 1;
-	} else {
-		out_row_pointers[y_in][x_in] = row_pointers[y_in][x_in];
-	}
-}
-
-void grayscale_convolve(png_bytep* out_row_pointers, png_bytep* row_pointers, int x_in, int y_in, int width, int height, const float* kernel) {
-	if (x_in - 1 < 0) {
-		out_row_pointers[y_in][x_in] = row_pointers[y_in][x_in];
-		return;
-	}
-	if (y_in - 1 < 0) {
-		out_row_pointers[y_in][x_in] = row_pointers[y_in][x_in];
-		return;
-	}
-	if (x_in + 1 > width - 1) {
-		out_row_pointers[y_in][x_in] = row_pointers[y_in][x_in];
-		return;
-	}
-	if (y_in + 1 > height - 1) {
-		out_row_pointers[y_in][x_in] = row_pointers[y_in][x_in];
-		return;
+	if (paths.size() < 1) {
+		std::cout << "Invalid number of arguments" << std::endl;
+		return 1;
 	}
-	int kernel_index = 0;
-	float value = 0.0f;
-	for (int y = y_in - 1; y < y_in + 2; ++y) {
-		for (int x = x_in - 1; x < x_in + 2; ++x) {
-			 value += static_cast<float>(row_pointers[y][x]) * kernel[kernel_index++];
+	set_png_options(png);
+	auto finish = [&](int result) {
+		if (profile_path && profiler_write_report(profile_path) != 0 && result == 0) {
+			result = 3;
 		}
-	}
-	out_row_pointers[y_in][x_in] = static_cast<int>(value);
-}
+		if (trace_path && profiler_write_trace(trace_path) != 0 && result == 0) {
+			result = 3;
+		}
+		return result;
+	};
 
-void single_channel_kernel(std::function<void(png_bytep*, png_bytep*, int, int, int, int)> fn, png_bytep* out_row_pointers, png_bytep* row_pointers, int width, int height) {
-	for (int y = 0; y < height; ++y) {
-		for (int x = 0; x < width; ++x) {
-			fn(out_row_pointers, row_pointers, x, y, width, height);
+	std::cout << "Compiled with libpng " << PNG_LIBPNG_VER_STRING << "; using libpng " << png_libpng_ver << std::endl;
+	IsaLevel level = isa_level();
+	std::cout << "Kernels: " << isa_level_name(level) << std::endl;
+
+	if (batch) {
+		// paths[0] is a directory, a glob or - for a list on stdin; paths[1]
+		// the output directory
+		std::vector<std::string> inputs = batch_inputs(paths[0]);
+		std::cout << "Batch of " << inputs.size() << " images" << std::endl;
+		// frames are processed one at a time, so they can share the buffers
+		PipelineBuffers buffers;
+		BackgroundModel model(background_rate, background_threshold);
+		if (checkpoint_path && model.load(checkpoint_path) == 0) {
+			std::cout << "Resuming the background of " << model.frames() << " frames from " << checkpoint_path << std::endl;
+		}
+		PointLut display = make_point_lut(bit_display);
+		int checkpoint_result = 0;
+		BatchProcess process = [&](Image8& image, Image8& scratch) {
+			swap(buffers.scratch, scratch);
+			run_pipeline(pipeline, image, buffers);
+			swap(buffers.scratch, scratch);
+			if (!background) {
+				return;
+			}
+			// the mask replaces the frame, which is kept as the next scratch
+			model.update(image, scratch);
+			swap(image, scratch);
+			apply_point_lut(display, image);
+			if (checkpoint_path && checkpoint_every > 0 && model.frames() % checkpoint_every == 0) {
+				checkpoint_result |= model.save(checkpoint_path);
+			}
+		};
+		BatchReport report = run_batch(inputs, paths.size() > 1 ? paths[1] : "", process, weights, 0, background);
+		if (background && checkpoint_path && model.frames() > 0) {
+			checkpoint_result |= model.save(checkpoint_path);
 		}
+		std::cout << report.images << " images, " << report.failed << " failed, in " << report.seconds << " s: "
+			<< report.images / report.seconds << " images/s, "
+			<< report.file_bytes / report.seconds / 1e6 << " MB/s read, "
+			<< report.pixel_bytes / report.seconds / 1e6 << " MB/s decoded" << std::endl;
+		return finish(report.failed > 0 ? 1 : (checkpoint_result != 0 ? 2 : 0));
 	}
-}
-
 
-void swap(png_bytep*& lhs_row_pointers, png_bytep*& rhs_row_pointers) {
-	png_bytep* temp_row_pointers = lhs_row_pointers;
-	lhs_row_pointers = rhs_row_pointers;
-	rhs_row_pointers = temp_row_pointers;
-}
+	std::cout << "Loading: " << paths[0] << std::endl;
 
-int main(int argc, char** argv) {
-	if (argc < 2) {
-		std::cout << "Invalid number of arguments" << std::endl;
-		return 1;
+	if (stream) {
+		// each 3x3 kernel adds three rows to the pipeline
+		std::vector<RowStage> stages;
+		if (!pipeline_row_stages(pipeline, stages)) {
+			std::cerr << "[main] Only point and 3x3 neighbourhood steps can be streamed" << std::endl;
+			return 1;
+		}
+		return finish(stream_png_file(paths[0], paths.size() > 1 ? paths[1] : nullptr, stages, weights));
 	}
-	std::cout << "Compiled with libpng " << PNG_LIBPNG_VER_STRING << "; using libpng " << png_libpng_ver << std::endl;
-
-	std::cout << "Loading: " << argv[1] << std::endl;
 	
 	int width = 0;
 	int height = 0;
@@ -569,130 +289,64 @@ int main(int argc, char** argv) {
 	png_byte bit_depth;
 	int number_of_passes = 0;
 	int stride = 0;
-	png_bytep* row_pointers = nullptr;
+	// converted to grayscale row by row as it is decoded, or wrapping the
+	// mapped file of an 8-bit PGM or raw frame
+	Image8 out;
 
-	if (read_png_file(argv[1], width, height, color_type, bit_depth, number_of_passes, stride, row_pointers) != 0) {
-		return 1;
+	if (read_gray_frame(paths[0], width, height, color_type, bit_depth, number_of_passes, stride, weights, out) != 0) {
+		return finish(1);
 	}
 
+	std::cout << color_type_name(color_type) << " image detected" << std::endl;
 	std::cout << "Width: " << width << std::endl;
 	std::cout << "Height: " << height << std::endl;
 	std::cout << "Color type: " << static_cast<int>(color_type) << std::endl;
 	std::cout << "Bit depth: " << static_cast<int>(bit_depth) << std::endl;
 	std::cout << "Number of passes: " << number_of_passes << std::endl;
 	std::cout << "Stride: " << stride << std::endl;
-
-	// Convert to grayscale
-	png_byte out_color_type = PNG_COLOR_TYPE_GRAY;
-	png_bytep* out_row_pointers = reinterpret_cast<png_bytep*>(malloc(sizeof(png_bytep) * height));
-	for (int y = 0; y < height; ++y) {
-		out_row_pointers[y] = reinterpret_cast<png_byte*>(malloc(sizeof(png_byte) * width));
-		for (int x = 0; x < width; ++x) {
-			float value = 0.0f;
-			for (int offset = 0; offset < stride; ++offset) {
-				value += static_cast<float>(row_pointers[y][x * stride + offset]);
-			}
-			value /= stride;
-			out_row_pointers[y][x] = static_cast<int>(value);
+	std::cout << "Grayscale weights: " << gray_weights_name(weights) << std::endl;
+
+	// Do stuff with the image, as described by --pipeline, e.g.
+	//   "stretch:5:-100"                      contrast stretch
+	//   "threshold:100,display"               binarize for viewing
+	//   "otsu,display"                        binarize at the image's own threshold
+	//   "equalize"                            histogram equalization
+	//   "threshold:100,shrink*3,display"      erode three times
+	//   "threshold:100,expand*3,display"      dilate three times
+	//   "threshold:100,edge,display"          outline
+	//   "threshold:100,noize,display"         despeckle
+	//   "threshold:100,shrink*stable,display" erode until nothing changes
+	//   "threshold:100,thin,display"          skeleton
+	//   "erode_disc:8"                        grayscale erosion by a disc
+	//   "threshold:100,erode_euclidean:20"    binary erosion by a large disc
+	//   "median:2"                            remove impulse noise from gray
+	//   "gaussian:1.4,canny:40:100,display"   Canny edges
+	//   "box:3,box:3,box:3"                   triple box blur
+	//   "gaussian:2"                          gaussian blur
+	//   "adaptive:15:5,display"               threshold against the local mean
+	if (!pipeline.steps.empty()) {
+		std::cout << "Pipeline:" << std::endl << describe_pipeline(pipeline);
+		PipelineBuffers buffers;
+		run_pipeline(pipeline, out, buffers);
+	}
+
+	if (blobs_path) {
+		Image32 labels;
+		BlobStats stats;
+		int blobs = label_components(labels, out, connectivity, &stats);
+		std::cout << "Blobs: " << blobs << std::endl;
+		if (write_blob_stats(blobs_path, stats) != 0) {
+			return finish(2);
 		}
 	}
 
-	for (int y = 0; y < height; ++y)
-		free(row_pointers[y]);
-	free(row_pointers);
-
-	png_bytep* other_row_pointers = reinterpret_cast<png_bytep*>(malloc(sizeof(png_bytep) * height));
-	for (int y = 0; y < height; ++y) {
-		other_row_pointers[y] = reinterpret_cast<png_byte*>(malloc(sizeof(png_byte) * width));
-	}
-	single_channel_apply(grayscale_copy, other_row_pointers, out_row_pointers, width, height);
-
-
-	// Do stuff with the image
-
-	//print_image(row_pointers, width, height, stride);
-	//single_channel_apply([](int value){return grayscale_set(value, 100);}, out_row_pointers, width, height);
-	//single_channel_apply([](int value){return grayscale_brighten(value, 100);}, out_row_pointers, width, height);
-	//single_channel_apply([](int value){return grayscale_stretch(value, 5, -100);}, out_row_pointers, width, height);
-	//single_channel_apply(grayscale_invert, out_row_pointers, width, height);
-	/*
-	{
-		single_channel_apply([](int value){return grayscale_threshold(value, 100);}, out_row_pointers, width, height);
-		single_channel_apply(bit_display, out_row_pointers, width, height);
-	}
-	*/
-	/*
-	{
-		single_channel_apply([](int value){return grayscale_threshold(value, 100);}, out_row_pointers, width, height);
-		single_channel_kernel(shrink, other_row_pointers, out_row_pointers, width, height);
-		swap(other_row_pointers, out_row_pointers);
-		single_channel_kernel(shrink, other_row_pointers, out_row_pointers, width, height);
-		swap(other_row_pointers, out_row_pointers);
-		single_channel_kernel(shrink, other_row_pointers, out_row_pointers, width, height);
-		single_channel_apply(bit_display, other_row_pointers, width, height);
-		swap(other_row_pointers, out_row_pointers);
-	}
-	*/
-	/*
-	{
-		single_channel_apply([](int value){return grayscale_threshold(value, 100);}, out_row_pointers, width, height);
-		single_channel_kernel(expand, other_row_pointers, out_row_pointers, width, height);
-		swap(other_row_pointers, out_row_pointers);
-		single_channel_kernel(expand, other_row_pointers, out_row_pointers, width, height);
-		swap(other_row_pointers, out_row_pointers);
-		single_channel_kernel(expand, other_row_pointers, out_row_pointers, width, height);
-		single_channel_apply(bit_display, other_row_pointers, width, height);
-		swap(other_row_pointers, out_row_pointers);
-	}
-	*/
-	/*
-	{
-		single_channel_apply([](int value){return grayscale_threshold(value, 100);}, out_row_pointers, width, height);
-		single_channel_kernel(edge, other_row_pointers, out_row_pointers, width, height);
-		swap(other_row_pointers, out_row_pointers);
-		single_channel_apply(bit_display, out_row_pointers, width, height);
-	}
-	*/
-	/*
-	{
-		single_channel_apply([](int value){return grayscale_threshold(value, 100);}, out_row_pointers, width, height);
-		single_channel_kernel(noize, other_row_pointers, out_row_pointers, width, height);
-		swap(other_row_pointers, out_row_pointers);
-		single_channel_apply(bit_display, out_row_pointers, width, height);
-	}
-	*/
-	/*
-	{
-		single_channel_apply([](int value){return grayscale_threshold(value, 100);}, out_row_pointers, width, height);
-		single_channel_apply(bit_and, other_row_pointers, out_row_pointers, width, height);
-		swap(other_row_pointers, out_row_pointers);
-		single_channel_apply(bit_display, out_row_pointers, width, height);
-	}
-	*/
-	/*
-	{
-		float kernel[9] = {1/9.0, 1/9.0, 1/9.0, 1/9.0, 1/9.0, 1/9.0, 1/9.0, 1/9.0, 1/9.0};
-		single_channel_kernel([&](png_bytep* lhs, png_bytep* rhs, int x_in, int y_in, int width, int height){return grayscale_convolve(lhs, rhs, x_in, y_in, width, height, kernel);}, other_row_pointers, out_row_pointers, width, height);
-		swap(other_row_pointers, out_row_pointers);
-		single_channel_kernel([&](png_bytep* lhs, png_bytep* rhs, int x_in, int y_in, int width, int height){return grayscale_convolve(lhs, rhs, x_in, y_in, width, height, kernel);}, other_row_pointers, out_row_pointers, width, height);
-		swap(other_row_pointers, out_row_pointers);
-		single_channel_kernel([&](png_bytep* lhs, png_bytep* rhs, int x_in, int y_in, int width, int height){return grayscale_convolve(lhs, rhs, x_in, y_in, width, height, kernel);}, other_row_pointers, out_row_pointers, width, height);
-		swap(other_row_pointers, out_row_pointers);
-	}
-	*/
-
-	for (int y = 0; y < height; ++y)
-		free(other_row_pointers[y]);
-	free(other_row_pointers);
-	
-	
-	if (argc > 2) {
-		std::cout << "Writing output to " << argv[2] << std::endl;
-		if (write_png_file(argv[2], width, height, out_color_type, bit_depth, out_row_pointers) != 0) {
-			return 2;
+	if (paths.size() > 1) {
+		std::cout << "Writing output to " << paths[1] << std::endl;
+		if (write_gray_frame(paths[1], out) != 0) {
+			return finish(2);
 		}
 		
 	}
 
-	return 0;
+	return finish(0);
 }
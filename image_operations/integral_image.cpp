@@ -0,0 +1,275 @@
+#include "integral_image.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "pixel_kernels.h"
+#include "thread_pool.h"
+
+namespace {
+
+void prefix_sum_squares_row(uint64_t* out, const uint8_t* in, int width) {
+	out[0] = 0;
+	for (int x = 0; x < width; ++x)
+		out[x + 1] = out[x] + static_cast<uint64_t>(in[x]) * in[x];
+}
+
+// turns per-row prefix sums into the table by adding each row to the one
+// below, in strips of columns so the strips can run in parallel
+template <typename Sum>
+void accumulate_columns(Image<Sum>& sums) {
+	const int strip = 1024;
+	int width = sums.width();
+	int height = sums.height();
+	default_thread_pool().parallel_for(0, (width + strip - 1) / strip, 1, [&sums, width, height](int begin, int end) {
+		int x0 = begin * strip;
+		int x1 = std::min(width, end * strip);
+		for (int y = 1; y < height; ++y) {
+			const Sum* above = sums[y - 1];
+			Sum* row = sums[y];
+			for (int x = x0; x < x1; ++x)
+				row[x] += above[x];
+		}
+	});
+}
+
+}
+
+void integral_image(Image32& sums, const Image8& in) {
+	int width = in.width();
+	int height = in.height();
+	sums.resize(width + 1, height + 1);
+	std::memset(sums[0], 0, sums.row_bytes());
+	const PixelKernels& kernels = pixel_kernels();
+	parallel_rows(height, [&sums, &in, &kernels, width](int begin, int end) {
+		for (int y = begin; y < end; ++y)
+			kernels.prefix_sum_row(sums[y + 1], in[y], width);
+	});
+	accumulate_columns(sums);
+}
+
+void integral_image_squares(Image<uint64_t>& sums, const Image8& in) {
+	int width = in.width();
+	int height = in.height();
+	sums.resize(width + 1, height + 1);
+	std::memset(sums[0], 0, sums.row_bytes());
+	parallel_rows(height, [&sums, &in, width](int begin, int end) {
+		for (int y = begin; y < end; ++y)
+			prefix_sum_squares_row(sums[y + 1], in[y], width);
+	});
+	accumulate_columns(sums);
+}
+
+void box_blur(Image8& out, const Image8& in, int radius_x, int radius_y, BorderMode border, uint8_t constant) {
+	if (out.width() != in.width() || out.height() != in.height() || out.channels() != 1)
+		out.resize(in.width(), in.height());
+	if (in.empty())
+		return;
+
+	int width = in.width();
+	int height = in.height();
+	radius_x = std::max(radius_x, 0);
+	radius_y = std::max(radius_y, 0);
+	int window_width = 2 * radius_x + 1;
+	int window_height = 2 * radius_y + 1;
+	uint32_t area = static_cast<uint32_t>(window_width) * window_height;
+	// (sum + area / 2) / area as a multiply and shift, exact for every sum
+	// below 256 * area
+	uint64_t reciprocal = ((static_cast<uint64_t>(1) << 55) + area - 1) / area;
+	uint32_t constant_column = static_cast<uint32_t>(constant) * window_height;
+	std::vector<uint8_t> constant_row(width, constant);
+
+	auto source_row = [&](int y) -> const uint8_t* {
+		int source = border_index(y, height, border);
+		return source < 0 ? constant_row.data() : in[source];
+	};
+
+	// blocks[i][x] is the total of column x over rows [0, i * block_rows),
+	// so a band starts its window from a few rows either side of two of
+	// them rather than by adding up the window's rows
+	const int block_rows = 16;
+	int block_count = height / block_rows;
+	Image32 blocks(width, block_count + 1);
+	std::memset(blocks[0], 0, blocks.row_bytes());
+	default_thread_pool().parallel_for(1, block_count + 1, 1, [&](int begin, int end) {
+		for (int i = begin; i < end; ++i) {
+			uint32_t* row = blocks[i];
+			std::fill(row, row + width, 0);
+			for (int y = (i - 1) * block_rows; y < i * block_rows; ++y) {
+				const uint8_t* source = in[y];
+				for (int x = 0; x < width; ++x)
+					row[x] += source[x];
+			}
+		}
+	});
+	accumulate_columns(blocks);
+
+	// the total of each column over rows [0, k) for 0 <= k <= height, from
+	// the nearest block boundary
+	auto prefix_row = [&](uint32_t* sum, int k) {
+		int block = std::min((k + block_rows / 2) / block_rows, block_count);
+		int boundary = block * block_rows;
+		std::memcpy(sum, blocks[block], width * sizeof(uint32_t));
+		for (int y = boundary; y < k; ++y) {
+			const uint8_t* source = in[y];
+			for (int x = 0; x < width; ++x)
+				sum[x] += source[x];
+		}
+		for (int y = k; y < boundary; ++y) {
+			const uint8_t* source = in[y];
+			for (int x = 0; x < width; ++x)
+				sum[x] -= source[x];
+		}
+	};
+
+	// The column totals of the border-extended rows before row k, counted
+	// from row 0 and negative above it. Past the edge, replicate and constant
+	// add a fixed row per row and reflect repeats with a period of
+	// 2 * (height - 1) rows. The uint32 arithmetic wraps, which cancels in
+	// the difference of two of them. scratch holds three rows.
+	auto cumulative = [&](uint32_t* sum, int k, uint32_t* scratch) {
+		if (k >= 0 && k <= height) {
+			prefix_row(sum, k);
+			return;
+		}
+		if (border != BorderMode::reflect || height == 1) {
+			bool below = k > height;
+			uint32_t count = static_cast<uint32_t>(below ? k - height : k);
+			const uint8_t* edge = border == BorderMode::constant ? constant_row.data() : (below ? in[height - 1] : in[0]);
+			if (below)
+				prefix_row(sum, height);
+			else
+				std::fill(sum, sum + width, 0);
+			for (int x = 0; x < width; ++x)
+				sum[x] += count * edge[x];
+			return;
+		}
+		int period = 2 * (height - 1);
+		int repeats = k / period;
+		if (k % period < 0)
+			--repeats;
+		int rest = k - repeats * period;
+		uint32_t* last = scratch;
+		uint32_t* before_last = scratch + width;
+		uint32_t* first = scratch + 2 * width;
+		prefix_row(last, height);
+		prefix_row(before_last, height - 1);
+		prefix_row(first, 1);
+		prefix_row(sum, rest <= height ? rest : period - rest + 1);
+		for (int x = 0; x < width; ++x) {
+			uint32_t whole = last[x] + before_last[x] - first[x];
+			uint32_t partial = rest <= height ? sum[x] : last[x] + before_last[x] - sum[x];
+			sum[x] = static_cast<uint32_t>(repeats) * whole + partial;
+		}
+	};
+
+	parallel_rows(height, [&](int begin, int end) {
+		// the sum of each input column over the rows in the window; a short
+		// window is quicker added up than started from the blocks
+		std::vector<uint32_t> columns(width, 0);
+		std::vector<uint32_t> extended(width + 2 * radius_x);
+		if (window_height <= block_rows) {
+			for (int j = begin - radius_y; j <= begin + radius_y; ++j) {
+				const uint8_t* row = source_row(j);
+				for (int x = 0; x < width; ++x)
+					columns[x] += row[x];
+			}
+		} else {
+			std::vector<uint32_t> window_top(width), scratch(3 * width);
+			cumulative(columns.data(), begin + radius_y + 1, scratch.data());
+			cumulative(window_top.data(), begin - radius_y, scratch.data());
+			for (int x = 0; x < width; ++x)
+				columns[x] -= window_top[x];
+		}
+
+		for (int y = begin; y < end; ++y) {
+			if (y > begin) {
+				const uint8_t* entering = source_row(y + radius_y);
+				const uint8_t* leaving = source_row(y - radius_y - 1);
+				for (int x = 0; x < width; ++x)
+					columns[x] += static_cast<uint32_t>(entering[x]) - leaving[x];
+			}
+
+			std::memcpy(extended.data() + radius_x, columns.data(), width * sizeof(uint32_t));
+			for (int u = 0; u < radius_x; ++u) {
+				int left = border_index(u - radius_x, width, border);
+				int right = border_index(width + u, width, border);
+				extended[u] = left < 0 ? constant_column : columns[left];
+				extended[radius_x + width + u] = right < 0 ? constant_column : columns[right];
+			}
+
+			uint32_t sum = 0;
+			for (int u = 0; u < window_width; ++u)
+				sum += extended[u];
+			uint8_t* destination = out[y];
+			for (int x = 0; x < width; ++x) {
+				destination[x] = static_cast<uint8_t>(((sum + area / 2) * reciprocal) >> 55);
+				if (x + 1 < width)
+					sum += extended[x + window_width] - extended[x];
+			}
+		}
+	});
+}
+
+void local_mean_variance(ImageF& mean, ImageF& variance, const Image8& in, int radius) {
+	int width = in.width();
+	int height = in.height();
+	mean.resize(width, height);
+	variance.resize(width, height);
+	if (in.empty())
+		return;
+
+	Image32 sums;
+	Image<uint64_t> squares;
+	integral_image(sums, in);
+	integral_image_squares(squares, in);
+	radius = std::max(radius, 0);
+
+	parallel_rows(height, [&](int begin, int end) {
+		for (int y = begin; y < end; ++y) {
+			int y0 = std::max(0, y - radius);
+			int y1 = std::min(height, y + radius + 1);
+			float* mean_row = mean[y];
+			float* variance_row = variance[y];
+			for (int x = 0; x < width; ++x) {
+				int x0 = std::max(0, x - radius);
+				int x1 = std::min(width, x + radius + 1);
+				double count = static_cast<double>(x1 - x0) * (y1 - y0);
+				double average = box_sum(sums, x0, y0, x1, y1) / count;
+				double spread = box_sum(squares, x0, y0, x1, y1) / count - average * average;
+				mean_row[x] = static_cast<float>(average);
+				variance_row[x] = static_cast<float>(spread > 0.0 ? spread : 0.0);
+			}
+		}
+	});
+}
+
+void adaptive_threshold(Image8& out, const Image8& in, int radius, int offset) {
+	if (out.width() != in.width() || out.height() != in.height() || out.channels() != 1)
+		out.resize(in.width(), in.height());
+	if (in.empty())
+		return;
+
+	int width = in.width();
+	int height = in.height();
+	Image32 sums;
+	integral_image(sums, in);
+	radius = std::max(radius, 0);
+
+	parallel_rows(height, [&](int begin, int end) {
+		for (int y = begin; y < end; ++y) {
+			int y0 = std::max(0, y - radius);
+			int y1 = std::min(height, y + radius + 1);
+			const uint8_t* source = in[y];
+			uint8_t* destination = out[y];
+			for (int x = 0; x < width; ++x) {
+				int x0 = std::max(0, x - radius);
+				int x1 = std::min(width, x + radius + 1);
+				int64_t count = static_cast<int64_t>(x1 - x0) * (y1 - y0);
+				// value >= sum / count - offset
+				destination[x] = (source[x] + offset) * count >= box_sum(sums, x0, y0, x1, y1) ? 1 : 0;
+			}
+		}
+	});
+}
@@ -0,0 +1,39 @@
+#ifndef INTEGRAL_IMAGE_H
+#define INTEGRAL_IMAGE_H
+
+#include <cstdint>
+
+#include "border.h"
+#include "image.h"
+
+// Summed-area tables: sums is (width + 1) x (height + 1) with a zero first row
+// and column, and sums[y][x] is the total of in over [0, x) x [0, y). The
+// uint32 table wraps past 2^32, which cancels out in box_sum as long as the
+// box itself totals less than 2^32 (any box under 16.8M pixels). Squares are
+// kept in 64 bits since 255^2 per pixel would wrap from a 257x257 box.
+void integral_image(Image32& sums, const Image8& in);
+void integral_image_squares(Image<uint64_t>& sums, const Image8& in);
+
+// total over [x0, x1) x [y0, y1)
+template <typename Sum>
+inline Sum box_sum(const Image<Sum>& sums, int x0, int y0, int x1, int y1) {
+	return sums[y1][x1] - sums[y1][x0] - sums[y0][x1] + sums[y0][x0];
+}
+
+// Mean of the (2 * radius_x + 1) x (2 * radius_y + 1) box around each pixel,
+// rounded, from running column and row sums so the cost per pixel does not
+// depend on the radius. Each band of rows starts its column sums from
+// column totals kept every 16 rows, so neither does the cost per band.
+void box_blur(Image8& out, const Image8& in, int radius_x, int radius_y,
+	BorderMode border = BorderMode::replicate, uint8_t constant = 0);
+
+// Mean and variance of the box around each pixel, clipped to the image so
+// windows near the edge hold fewer pixels.
+void local_mean_variance(ImageF& mean, ImageF& variance, const Image8& in, int radius);
+
+// grayscale_threshold against the local mean: 1 where the pixel is at least
+// the mean of the box around it minus offset, else 0. The comparison is done
+// on sums, so no division or rounding is involved.
+void adaptive_threshold(Image8& out, const Image8& in, int radius, int offset);
+
+#endif
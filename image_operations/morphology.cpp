@@ -0,0 +1,363 @@
+#include "morphology.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "neighbourhood_operations.h"
+#include "profiler.h"
+#include "thread_pool.h"
+
+namespace {
+
+typedef void (*KernelFn)(Image8&, const Image8&, int, int);
+
+// appends the index of every pixel that differs between the images
+void collect_changes(const Image8& before, const Image8& after, std::vector<size_t>& changed) {
+	int width = before.width();
+	for (int y = 0; y < before.height(); ++y) {
+		const uint8_t* a = before[y];
+		const uint8_t* b = after[y];
+		if (std::memcmp(a, b, width) == 0)
+			continue;
+		for (int x = 0; x < width; ++x)
+			if (a[x] != b[x])
+				changed.push_back(static_cast<size_t>(y) * width + x);
+	}
+}
+
+// Zhang-Suen: a foreground pixel with 2 to 6 foreground neighbours and one
+// background to foreground transition around it is cleared when the last two
+// of its north, east, south and west neighbours checked are not both set
+void thin_step(Image8& out, const Image8& in, int x_in, int y_in, bool second) {
+	uint8_t centre = in[y_in][x_in];
+	out[y_in][x_in] = centre;
+	if (!centre || x_in < 1 || y_in < 1 || x_in > in.width() - 2 || y_in > in.height() - 2)
+		return;
+	const uint8_t* above = in[y_in - 1];
+	const uint8_t* row = in[y_in];
+	const uint8_t* below = in[y_in + 1];
+	// clockwise from north
+	int p[8] = {
+		above[x_in] != 0, above[x_in + 1] != 0, row[x_in + 1] != 0, below[x_in + 1] != 0,
+		below[x_in] != 0, below[x_in - 1] != 0, row[x_in - 1] != 0, above[x_in - 1] != 0
+	};
+	int neighbours = 0;
+	int transitions = 0;
+	for (int index = 0; index < 8; ++index) {
+		neighbours += p[index];
+		transitions += !p[index] && p[(index + 1) % 8];
+	}
+	if (neighbours < 2 || neighbours > 6 || transitions != 1)
+		return;
+	int north = p[0], east = p[2], south = p[4], west = p[6];
+	bool clear = second ? (!(north && east && west) && !(north && south && west))
+		: (!(north && east && south) && !(east && south && west));
+	if (clear)
+		out[y_in][x_in] = 0;
+}
+
+struct MaxOp {
+	static constexpr uint8_t identity = 0;
+	static uint8_t combine(uint8_t a, uint8_t b) { return a > b ? a : b; }
+};
+
+struct MinOp {
+	static constexpr uint8_t identity = 255;
+	static uint8_t combine(uint8_t a, uint8_t b) { return a < b ? a : b; }
+};
+
+// The extreme over the 2 * radius + 1 pixels of each row centred on each
+// pixel. van Herk/Gil-Werman: the padded row is cut into blocks as long as
+// the window, and every window is the suffix of one block and the prefix of
+// the next, so three combines per pixel whatever the radius.
+template <typename Op>
+void horizontal_extreme(Image8& out, const Image8& in, int radius) {
+	int width = in.width();
+	int window = 2 * radius + 1;
+	int padded = (width + 2 * radius + window - 1) / window * window;
+	parallel_rows(in.height(), [&](int begin, int end) {
+		std::vector<uint8_t> line(padded, Op::identity);
+		std::vector<uint8_t> prefix(padded);
+		std::vector<uint8_t> suffix(padded);
+		for (int y = begin; y < end; ++y) {
+			std::memcpy(line.data() + radius, in[y], width);
+			for (int block = 0; block < padded; block += window) {
+				prefix[block] = line[block];
+				for (int index = block + 1; index < block + window; ++index)
+					prefix[index] = Op::combine(prefix[index - 1], line[index]);
+				suffix[block + window - 1] = line[block + window - 1];
+				for (int index = block + window - 2; index >= block; --index)
+					suffix[index] = Op::combine(suffix[index + 1], line[index]);
+			}
+			uint8_t* destination = out[y];
+			for (int x = 0; x < width; ++x)
+				destination[x] = Op::combine(suffix[x], prefix[x + window - 1]);
+		}
+	});
+}
+
+// The same along the lines through (x + step * t, y + t): vertical for step
+// 0 and the diagonals for step 1 and -1. The blocks run down the rows, so
+// the running extremes are whole-row operations, and columns are padded by
+// the radius either side for the diagonals that leave the image sideways.
+template <typename Op>
+void line_extreme(Image8& out, const Image8& in, int radius, int step) {
+	int width = in.width();
+	int height = in.height();
+	int window = 2 * radius + 1;
+	int rows = (height + 2 * radius + window - 1) / window * window;
+	int columns = width + 2 * radius;
+	Image8 prefix(columns, rows);
+	Image8 suffix(columns, rows);
+
+	// row index of the padded image, as a padded row
+	auto load = [&](uint8_t* destination, int index) {
+		int y = index - radius;
+		std::fill(destination, destination + columns, Op::identity);
+		if (y >= 0 && y < height)
+			std::memcpy(destination + radius, in[y], width);
+	};
+	// combines the neighbouring row of the same block, shifted along the line
+	auto extend = [&](uint8_t* destination, const uint8_t* previous, int shift) {
+		int begin = std::max(0, shift);
+		int end = std::min(columns, columns + shift);
+		for (int x = begin; x < end; ++x)
+			destination[x] = Op::combine(destination[x], previous[x - shift]);
+	};
+	default_thread_pool().parallel_for(0, rows / window, 1, [&](int begin, int end) {
+		for (int block = begin * window; block < end * window; block += window) {
+			load(prefix[block], block);
+			for (int index = block + 1; index < block + window; ++index) {
+				load(prefix[index], index);
+				extend(prefix[index], prefix[index - 1], step);
+			}
+			load(suffix[block + window - 1], block + window - 1);
+			for (int index = block + window - 2; index >= block; --index) {
+				load(suffix[index], index);
+				extend(suffix[index], suffix[index + 1], -step);
+			}
+		}
+	});
+	parallel_rows(height, [&](int begin, int end) {
+		for (int y = begin; y < end; ++y) {
+			// the window starts radius rows up, radius * step columns back
+			const uint8_t* first = suffix[y] + radius - radius * step;
+			const uint8_t* last = prefix[y + window - 1] + radius + radius * step;
+			uint8_t* destination = out[y];
+			for (int x = 0; x < width; ++x)
+				destination[x] = Op::combine(first[x], last[x]);
+		}
+	});
+}
+
+// the centre and its four edge neighbours: the diamond of radius 1
+template <typename Op>
+void cross_extreme(Image8& out, const Image8& in) {
+	int width = in.width();
+	int height = in.height();
+	parallel_rows(height, [&](int begin, int end) {
+		for (int y = begin; y < end; ++y) {
+			const uint8_t* row = in[y];
+			const uint8_t* above = y > 0 ? in[y - 1] : row;
+			const uint8_t* below = y + 1 < height ? in[y + 1] : row;
+			uint8_t* destination = out[y];
+			for (int x = 0; x < width; ++x)
+				destination[x] = Op::combine(row[x], Op::combine(above[x], below[x]));
+			for (int x = 1; x < width; ++x)
+				destination[x] = Op::combine(destination[x], row[x - 1]);
+			for (int x = 0; x + 1 < width; ++x)
+				destination[x] = Op::combine(destination[x], row[x + 1]);
+		}
+	});
+}
+
+template <typename Op>
+void square_extreme(Image8& out, const Image8& in, int radius) {
+	Image8 rows(in.width(), in.height());
+	horizontal_extreme<Op>(rows, in, radius);
+	line_extreme<Op>(out, rows, radius, 0);
+}
+
+// The two diagonal lines of half the radius make a diamond with only the
+// pixels whose coordinates sum to an even number; a 3x3 cross fills in the
+// rest for an odd radius, and for an even one the smaller diamond crossed
+// covers the pixels the lines missed.
+template <typename Op>
+void diamond_extreme(Image8& out, const Image8& in, int radius) {
+	int half = radius / 2;
+	Image8 first(in.width(), in.height());
+	Image8 lines(in.width(), in.height());
+	auto diagonals = [&](Image8& result, int length) {
+		line_extreme<Op>(first, in, length, 1);
+		line_extreme<Op>(result, first, length, -1);
+	};
+	if (radius % 2 == 1) {
+		diagonals(lines, half);
+		cross_extreme<Op>(out, lines);
+		return;
+	}
+	Image8 crossed(in.width(), in.height());
+	diagonals(lines, half - 1);
+	cross_extreme<Op>(crossed, lines);
+	diagonals(lines, half);
+	for (int y = 0; y < in.height(); ++y)
+		for (int x = 0; x < in.width(); ++x)
+			out[y][x] = Op::combine(lines[y][x], crossed[y][x]);
+}
+
+template <typename Op>
+void structuring_extreme(Image8& out, const Image8& in, int radius, StructuringElement shape) {
+	if (out.width() != in.width() || out.height() != in.height() || out.channels() != 1)
+		out.resize(in.width(), in.height());
+	if (in.empty())
+		return;
+	if (radius <= 0) {
+		for (int y = 0; y < in.height(); ++y)
+			std::memcpy(out[y], in[y], in.width());
+		return;
+	}
+	switch (shape) {
+	case StructuringElement::square:
+		square_extreme<Op>(out, in, radius);
+		break;
+	case StructuringElement::diamond:
+	case StructuringElement::disc: {
+		// a square of (sqrt(2) - 1) r then a diamond of the rest puts the
+		// octagon's straight and diagonal sides both at r from the centre
+		int side = shape == StructuringElement::disc ? static_cast<int>(std::lround(radius * (std::sqrt(2.0) - 1.0))) : 0;
+		int rest = radius - side;
+		// the diagonals, and the square before them, reach pixels inside
+		// through ones past the edge, so they run on a copy padded with the
+		// identity as far as those can be
+		int pad = side + rest / 2 + 1;
+		Image8 padded(in.width() + 2 * pad, in.height() + 2 * pad);
+		padded.fill(Op::identity);
+		for (int y = 0; y < in.height(); ++y)
+			std::memcpy(padded[y + pad] + pad, in[y], in.width());
+		Image8 result(padded.width(), padded.height());
+		if (side > 0) {
+			square_extreme<Op>(result, padded, side);
+			swap(result, padded);
+		}
+		diamond_extreme<Op>(result, padded, rest);
+		for (int y = 0; y < in.height(); ++y)
+			std::memcpy(out[y], result[y + pad] + pad, in.width());
+		break;
+	}
+	}
+}
+
+}
+
+IterationReport iterate_kernels(const std::vector<KernelFn>& operators, Image8& image, int max_passes) {
+	IterationReport report;
+	int width = image.width();
+	size_t pixels = static_cast<size_t>(width) * image.height();
+	if (operators.empty() || pixels == 0) {
+		report.converged = true;
+		return report;
+	}
+	ProfileScope scope("iterate_kernels");
+	int cycle = static_cast<int>(operators.size());
+	Image8 scratch(width, image.height());
+	// changes[pass % cycle] holds the pixels changed by the last run of each operator
+	std::vector<std::vector<size_t>> changes(cycle);
+	std::vector<uint32_t> visited(pixels, 0);
+	std::vector<size_t> candidates;
+	std::vector<uint8_t> values;
+	int quiet = 0;
+	for (int pass = 0; max_passes <= 0 || pass < max_passes; ++pass) {
+		KernelFn fn = operators[pass % cycle];
+		size_t recent = 0;
+		for (const std::vector<size_t>& changed : changes)
+			recent += changed.size();
+		// each change brings in up to nine pixels; past a quarter of the
+		// frame the whole-frame pass is cheaper
+		bool dense = pass < cycle || recent * 9 > pixels / 4;
+
+		if (dense) {
+			single_channel_kernel(fn, scratch, image);
+			std::vector<size_t>& changed = changes[pass % cycle];
+			changed.clear();
+			collect_changes(image, scratch, changed);
+			swap(image, scratch);
+			report.visited += pixels;
+		} else {
+			uint32_t stamp = static_cast<uint32_t>(pass + 1);
+			candidates.clear();
+			for (const std::vector<size_t>& changed : changes) {
+				for (size_t index : changed) {
+					int x = static_cast<int>(index % width);
+					int y = static_cast<int>(index / width);
+					for (int j = std::max(0, y - 1); j <= std::min(image.height() - 1, y + 1); ++j) {
+						for (int i = std::max(0, x - 1); i <= std::min(width - 1, x + 1); ++i) {
+							size_t neighbour = static_cast<size_t>(j) * width + i;
+							if (visited[neighbour] != stamp) {
+								visited[neighbour] = stamp;
+								candidates.push_back(neighbour);
+							}
+						}
+					}
+				}
+			}
+			// every candidate reads the image as the last pass left it
+			values.resize(candidates.size());
+			for (size_t index = 0; index < candidates.size(); ++index) {
+				int x = static_cast<int>(candidates[index] % width);
+				int y = static_cast<int>(candidates[index] / width);
+				fn(scratch, image, x, y);
+				values[index] = scratch[y][x];
+			}
+			std::vector<size_t>& changed = changes[pass % cycle];
+			changed.clear();
+			for (size_t index = 0; index < candidates.size(); ++index) {
+				int x = static_cast<int>(candidates[index] % width);
+				int y = static_cast<int>(candidates[index] / width);
+				if (image[y][x] != values[index]) {
+					image[y][x] = values[index];
+					changed.push_back(candidates[index]);
+				}
+			}
+			report.visited += candidates.size();
+		}
+
+		report.passes = pass + 1;
+		quiet = changes[pass % cycle].empty() ? quiet + 1 : 0;
+		if (quiet >= cycle) {
+			report.converged = true;
+			break;
+		}
+	}
+	scope.set_work(report.visited, 2 * report.visited);
+	return report;
+}
+
+IterationReport iterate_until_stable(KernelFn fn, Image8& image, int max_passes) {
+	return iterate_kernels(std::vector<KernelFn>{fn}, image, max_passes);
+}
+
+void thin_first(Image8& out, const Image8& in, int x_in, int y_in) {
+	thin_step(out, in, x_in, y_in, false);
+}
+
+void thin_second(Image8& out, const Image8& in, int x_in, int y_in) {
+	thin_step(out, in, x_in, y_in, true);
+}
+
+IterationReport thin(Image8& image, int max_passes) {
+	return iterate_kernels(std::vector<KernelFn>{thin_first, thin_second}, image, max_passes);
+}
+
+void grayscale_erode(Image8& out, const Image8& in, int radius, StructuringElement shape) {
+	size_t pixels = static_cast<size_t>(in.width()) * in.height();
+	ProfileScope scope("grayscale_erode", pixels, 2 * pixels);
+	structuring_extreme<MinOp>(out, in, radius, shape);
+}
+
+void grayscale_dilate(Image8& out, const Image8& in, int radius, StructuringElement shape) {
+	size_t pixels = static_cast<size_t>(in.width()) * in.height();
+	ProfileScope scope("grayscale_dilate", pixels, 2 * pixels);
+	structuring_extreme<MaxOp>(out, in, radius, shape);
+}
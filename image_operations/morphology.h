@@ -0,0 +1,54 @@
+#ifndef MORPHOLOGY_H
+#define MORPHOLOGY_H
+
+#include <cstddef>
+#include <vector>
+
+#include "image.h"
+
+struct IterationReport {
+	// passes run, including the unchanged ones that show convergence
+	int passes = 0;
+	// pixels evaluated over all the passes
+	size_t visited = 0;
+	// false when max_passes ran out first
+	bool converged = false;
+};
+
+// Runs the 3x3 operators in turn, over and over, until a whole cycle of them
+// changes nothing or max_passes passes have run (no limit when max_passes is
+// 0). Each pass reads the whole previous image, as repeated calls to
+// single_channel_kernel would, with identical results. A pixel can only
+// change when something in its 3x3 window changed since its operator last
+// ran, so after the first cycle only the pixels around the changes are
+// revisited and the cost follows the changed pixels rather than the frame.
+// Passes fall back to the whole frame while the changes are dense.
+IterationReport iterate_kernels(const std::vector<void (*)(Image8&, const Image8&, int, int)>& operators,
+	Image8& image, int max_passes = 0);
+IterationReport iterate_until_stable(void (*fn)(Image8&, const Image8&, int, int), Image8& image, int max_passes = 0);
+
+// The two subiterations of Zhang-Suen thinning on a 0/1 image: each clears
+// the foreground pixels on one side of the shape that are not needed to keep
+// it connected. thin alternates them to convergence, leaving a skeleton one
+// pixel wide.
+void thin_first(Image8& out, const Image8& in, int x_in, int y_in);
+void thin_second(Image8& out, const Image8& in, int x_in, int y_in);
+IterationReport thin(Image8& image, int max_passes = 0);
+
+// disc is the octagon from a square and a diamond that best fits the circle
+enum class StructuringElement {
+	square,
+	diamond,
+	disc
+};
+
+// Minimum (erode) or maximum (dilate) over the structuring element of the
+// given radius around each pixel, leaving out the pixels past the edge; on a
+// 0/1 image these are the binary operators. Runs van Herk/Gil-Werman running
+// extremes along lines, so the cost per pixel does not depend on the radius:
+// the square is a horizontal and a vertical line, and the diamond two
+// diagonal lines and a 3x3 cross.
+void grayscale_erode(Image8& out, const Image8& in, int radius, StructuringElement shape = StructuringElement::square);
+void grayscale_dilate(Image8& out, const Image8& in, int radius, StructuringElement shape = StructuringElement::square);
+
+#endif
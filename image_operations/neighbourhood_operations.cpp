@@ -0,0 +1,91 @@
+#include "neighbourhood_operations.h"
+
+#include "rank_filter.h"
+
+void shrink(Image8& out, const Image8& in, int x_in, int y_in) {
+	neighbourhood_pixel<ShrinkNeighbourhood>(out, in, x_in, y_in);
+}
+
+void expand(Image8& out, const Image8& in, int x_in, int y_in) {
+	neighbourhood_pixel<ExpandNeighbourhood>(out, in, x_in, y_in);
+}
+
+void edge(Image8& out, const Image8& in, int x_in, int y_in) {
+	neighbourhood_pixel<EdgeNeighbourhood>(out, in, x_in, y_in);
+}
+
+void salt(Image8& out, const Image8& in, int x_in, int y_in) {
+	neighbourhood_pixel<SaltNeighbourhood>(out, in, x_in, y_in);
+}
+
+void pepper(Image8& out, const Image8& in, int x_in, int y_in) {
+	neighbourhood_pixel<PepperNeighbourhood>(out, in, x_in, y_in);
+}
+
+void noise(Image8& out, const Image8& in, int x_in, int y_in) {
+	neighbourhood_pixel<NoiseNeighbourhood>(out, in, x_in, y_in);
+}
+
+void noize(Image8& out, const Image8& in, int x_in, int y_in) {
+	neighbourhood_pixel<NoizeNeighbourhood>(out, in, x_in, y_in);
+}
+
+void median(Image8& out, const Image8& in, int x_in, int y_in) {
+	if (x_in < 1 || y_in < 1 || x_in > in.width() - 2 || y_in > in.height() - 2) {
+		out[y_in][x_in] = in[y_in][x_in];
+		return;
+	}
+	uint8_t window[9];
+	for (int dy = 0; dy < 3; ++dy)
+		for (int dx = 0; dx < 3; ++dx)
+			window[3 * dy + dx] = in[y_in + dy - 1][x_in + dx - 1];
+	std::nth_element(window, window + 4, window + 9);
+	out[y_in][x_in] = window[4];
+}
+
+namespace {
+
+struct NeighbourhoodOperator {
+	void (*pixel)(Image8&, const Image8&, int, int);
+	NeighbourhoodRowFn row;
+};
+
+const NeighbourhoodOperator neighbourhood_operators[] = {
+	{shrink, neighbourhood_row<ShrinkNeighbourhood>},
+	{expand, neighbourhood_row<ExpandNeighbourhood>},
+	{edge, neighbourhood_row<EdgeNeighbourhood>},
+	{salt, neighbourhood_row<SaltNeighbourhood>},
+	{pepper, neighbourhood_row<PepperNeighbourhood>},
+	{noise, neighbourhood_row<NoiseNeighbourhood>},
+	{noize, neighbourhood_row<NoizeNeighbourhood>},
+	{median, median_row},
+};
+
+}
+
+NeighbourhoodRowFn neighbourhood_row_function(void (*fn)(Image8&, const Image8&, int, int)) {
+	for (const NeighbourhoodOperator& entry : neighbourhood_operators)
+		if (entry.pixel == fn)
+			return entry.row;
+	return nullptr;
+}
+
+void single_channel_kernel(std::function<void(Image8&, const Image8&, int, int)> fn, Image8& out, const Image8& in) {
+	size_t pixels = static_cast<size_t>(in.width()) * in.height();
+	ProfileScope scope("single_channel_kernel", pixels, 2 * pixels);
+	auto pixel = fn.target<void (*)(Image8&, const Image8&, int, int)>();
+	NeighbourhoodRowFn row = pixel ? neighbourhood_row_function(*pixel) : nullptr;
+	int height = in.height();
+	parallel_rows(height, [&](int begin, int end) {
+		for (int y = begin; y < end; ++y) {
+			if (row) {
+				row(out[y], y > 0 ? in[y - 1] : nullptr, in[y], y + 1 < height ? in[y + 1] : nullptr,
+					in.width(), NeighbourhoodOptions());
+				continue;
+			}
+			for (int x = 0; x < in.width(); ++x) {
+				fn(out, in, x, y);
+			}
+		}
+	});
+}
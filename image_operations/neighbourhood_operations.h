@@ -0,0 +1,142 @@
+#ifndef NEIGHBOURHOOD_OPERATIONS_H
+#define NEIGHBOURHOOD_OPERATIONS_H
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+
+#include "border.h"
+#include "image.h"
+#include "neighbourhood_rules.h"
+#include "pixel_kernels.h"
+#include "profiler.h"
+#include "thread_pool.h"
+
+void shrink(Image8& out, const Image8& in, int x_in, int y_in);
+void expand(Image8& out, const Image8& in, int x_in, int y_in);
+void edge(Image8& out, const Image8& in, int x_in, int y_in);
+void salt(Image8& out, const Image8& in, int x_in, int y_in);
+void pepper(Image8& out, const Image8& in, int x_in, int y_in);
+void noise(Image8& out, const Image8& in, int x_in, int y_in);
+void noize(Image8& out, const Image8& in, int x_in, int y_in);
+// the median of the 3x3 window, for grayscale impulse noise; rank_filter.h
+// has the other ranks and radii
+void median(Image8& out, const Image8& in, int x_in, int y_in);
+
+// fn is called concurrently for different rows; it may only write out[y_in][x_in].
+// The operators above run through neighbourhood_apply instead of per pixel.
+void single_channel_kernel(std::function<void(Image8&, const Image8&, int, int)> fn, Image8& out, const Image8& in);
+
+// What a 3x3 operator does on the one pixel frame where its window leaves the
+// image. By default it writes the rule's border value (the input pixel, or 0
+// for edge) as the per-pixel functions do; with extend it applies the rule to
+// the window read past the edge in the border mode.
+struct NeighbourhoodOptions {
+	bool extend = false;
+	BorderMode border = BorderMode::replicate;
+	uint8_t constant = 0;
+};
+
+// The rule at one pixel, with the per-pixel functions' bounds checks.
+template <typename Rule>
+void neighbourhood_pixel(Image8& out, const Image8& in, int x_in, int y_in) {
+	if (x_in < 1 || y_in < 1 || x_in > in.width() - 2 || y_in > in.height() - 2) {
+		out[y_in][x_in] = Rule::border(in[y_in][x_in]);
+		return;
+	}
+	int sigma = in[y_in - 1][x_in - 1] + in[y_in - 1][x_in] + in[y_in - 1][x_in + 1] +
+	            in[y_in][x_in - 1] + in[y_in][x_in + 1] +
+	            in[y_in + 1][x_in - 1] + in[y_in + 1][x_in] + in[y_in + 1][x_in + 1];
+	out[y_in][x_in] = Rule::apply(in[y_in][x_in], sigma);
+}
+
+// One output row from the rows around it, null for rows past the top or
+// bottom of the image. The interior has no bounds checks and runs through
+// pixel_kernels().neighbourhood_row at the CPU's widest level. Only the
+// first and last pixels, and rows with a missing neighbour, take the border
+// path.
+template <typename Rule>
+void neighbourhood_row(uint8_t* out, const uint8_t* above, const uint8_t* centre, const uint8_t* below,
+	int width, const NeighbourhoodOptions& options = NeighbourhoodOptions())
+{
+	if (width <= 0)
+		return;
+	if (!options.extend && (!above || !below)) {
+		for (int x = 0; x < width; ++x)
+			out[x] = Rule::border(centre[x]);
+		return;
+	}
+
+	// past the top or bottom: replicate reads the centre row and reflect the
+	// row on the other side, which is the centre row again in a one row image
+	const int chunk = 256;
+	uint8_t fill[chunk + 2];
+	bool above_constant = false;
+	bool below_constant = false;
+	if (!above || !below) {
+		if (options.border == BorderMode::constant) {
+			std::fill(fill, fill + chunk + 2, options.constant);
+			above_constant = !above;
+			below_constant = !below;
+		} else if (options.border == BorderMode::reflect) {
+			const uint8_t* reflected_above = above ? above : (below ? below : centre);
+			const uint8_t* reflected_below = below ? below : (above ? above : centre);
+			above = reflected_above;
+			below = reflected_below;
+		} else {
+			above = above ? above : centre;
+			below = below ? below : centre;
+		}
+	}
+
+	// a constant row past the edge is read from fill, a chunk at a time
+	const PixelKernels& kernels = pixel_kernels();
+	int step = above_constant || below_constant ? chunk : width;
+	for (int x0 = 1; x0 < width - 1; x0 += step) {
+		int count = std::min(step, width - 1 - x0);
+		const uint8_t* a = above_constant ? fill + 1 : above + x0;
+		const uint8_t* b = below_constant ? fill + 1 : below + x0;
+		kernels.neighbourhood_row(Rule::rule, out + x0, a, centre + x0, b, count);
+	}
+
+	// the first and last columns
+	auto column = [&](int x) {
+		int index = border_index(x, width, options.border);
+		if (index < 0)
+			return 3 * options.constant;
+		return (above_constant ? options.constant : above[index]) + centre[index] +
+			(below_constant ? options.constant : below[index]);
+	};
+	for (int x : {0, width - 1}) {
+		if (!options.extend)
+			out[x] = Rule::border(centre[x]);
+		else
+			out[x] = Rule::apply(centre[x], column(x - 1) + column(x) + column(x + 1) - centre[x]);
+		if (width == 1)
+			break;
+	}
+}
+
+// The rule over the whole image, in bands of rows on the default pool.
+template <typename Rule>
+void neighbourhood_apply(Image8& out, const Image8& in, const NeighbourhoodOptions& options = NeighbourhoodOptions()) {
+	if (out.width() != in.width() || out.height() != in.height() || out.channels() != 1)
+		out.resize(in.width(), in.height());
+	size_t pixels = static_cast<size_t>(in.width()) * in.height();
+	ProfileScope scope("neighbourhood_apply", pixels, 2 * pixels);
+	int height = in.height();
+	parallel_rows(height, [&](int begin, int end) {
+		for (int y = begin; y < end; ++y)
+			neighbourhood_row<Rule>(out[y], y > 0 ? in[y - 1] : nullptr, in[y], y + 1 < height ? in[y + 1] : nullptr,
+				in.width(), options);
+	});
+}
+
+typedef void (*NeighbourhoodRowFn)(uint8_t* out, const uint8_t* above, const uint8_t* centre, const uint8_t* below,
+	int width, const NeighbourhoodOptions& options);
+
+// neighbourhood_row for one of the per-pixel operators above, or null for any
+// other function
+NeighbourhoodRowFn neighbourhood_row_function(void (*fn)(Image8&, const Image8&, int, int));
+
+#endif
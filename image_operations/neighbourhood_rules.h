@@ -0,0 +1,56 @@
+#ifndef NEIGHBOURHOOD_RULES_H
+#define NEIGHBOURHOOD_RULES_H
+
+// The one definition of the 3x3 rules, read both by the templates of
+// neighbourhood_operations.h and by pixel_kernels.cpp, which includes this
+// file inside its anonymous namespace so every ISA level gets copies of its
+// own. Nothing here may include a header the kernels do not already have.
+#include "pixel_kernels.h"
+
+// A rule maps the centre pixel and sigma, the sum of its eight neighbours, to
+// the output pixel, and gives the output on the frame when not extending.
+// These are the operators of neighbourhood_operations.h, and rule is their
+// entry in the PixelKernels table.
+struct ShrinkNeighbourhood {
+	static const BinaryRule rule = BinaryRule::shrink;
+	static uint8_t apply(int centre, int sigma) { return sigma < 8 ? 0 : centre; }
+	static uint8_t border(int centre) { return centre; }
+};
+
+struct ExpandNeighbourhood {
+	static const BinaryRule rule = BinaryRule::expand;
+	static uint8_t apply(int centre, int sigma) { return sigma > 0 ? 1 : centre; }
+	static uint8_t border(int centre) { return centre; }
+};
+
+struct EdgeNeighbourhood {
+	static const BinaryRule rule = BinaryRule::edge;
+	static uint8_t apply(int centre, int sigma) { return sigma == 8 ? 0 : centre; }
+	static uint8_t border(int) { return 0; }
+};
+
+struct SaltNeighbourhood {
+	static const BinaryRule rule = BinaryRule::salt;
+	static uint8_t apply(int centre, int sigma) { return sigma == 8 ? 1 : centre; }
+	static uint8_t border(int centre) { return centre; }
+};
+
+struct PepperNeighbourhood {
+	static const BinaryRule rule = BinaryRule::pepper;
+	static uint8_t apply(int centre, int sigma) { return sigma == 8 ? 0 : centre; }
+	static uint8_t border(int centre) { return centre; }
+};
+
+struct NoiseNeighbourhood {
+	static const BinaryRule rule = BinaryRule::noise;
+	static uint8_t apply(int centre, int sigma) { return sigma == 0 ? 0 : (sigma == 8 ? 1 : centre); }
+	static uint8_t border(int centre) { return centre; }
+};
+
+struct NoizeNeighbourhood {
+	static const BinaryRule rule = BinaryRule::noize;
+	static uint8_t apply(int centre, int sigma) { return sigma < 2 ? 0 : (sigma > 6 ? 1 : centre); }
+	static uint8_t border(int centre) { return centre; }
+};
+
+#endif
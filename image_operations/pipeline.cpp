@@ -0,0 +1,583 @@
+#include "pipeline.h"
+
+#include <bitset>
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "integral_image.h"
+#include "neighbourhood_operations.h"
+#include "profiler.h"
+#include "rank_filter.h"
+
+namespace {
+
+struct KernelOperation {
+	const char* name;
+	NeighbourhoodFn kernel;
+	BinaryFn binary;
+};
+
+const KernelOperation kernel_operations[] = {
+	{"shrink", shrink, binary_shrink},
+	{"expand", expand, binary_expand},
+	{"edge", edge, binary_edge},
+	{"salt", salt, binary_salt},
+	{"pepper", pepper, binary_pepper},
+	{"noise", noise, binary_noise},
+	{"noize", noize, binary_noize},
+	{"median", median, nullptr},
+};
+
+bool parse_number(const std::string& text, double& value) {
+	if (text.empty())
+		return false;
+	char* end = nullptr;
+	errno = 0;
+	value = std::strtod(text.c_str(), &end);
+	return errno == 0 && *end == '\0';
+}
+
+// one step of the spec, before planning
+int parse_step(const std::string& token, std::vector<PipelineStep>& steps) {
+	std::string text = token;
+	int count = 1;
+	bool until_stable = false;
+	size_t star = text.find('*');
+	if (star != std::string::npos && text.substr(star + 1) == "stable") {
+		until_stable = true;
+		text = text.substr(0, star);
+	} else if (star != std::string::npos) {
+		double repeats = 0.0;
+		if (!parse_number(text.substr(star + 1), repeats) || repeats < 1 || repeats != static_cast<int>(repeats)) {
+			std::cerr << "[parse_pipeline] Bad repeat count in '" << token << "'" << std::endl;
+			return 1;
+		}
+		count = static_cast<int>(repeats);
+		text = text.substr(0, star);
+	}
+
+	std::vector<std::string> parts;
+	std::stringstream stream(text);
+	std::string part;
+	while (std::getline(stream, part, ':'))
+		parts.push_back(part);
+	if (parts.empty()) {
+		std::cerr << "[parse_pipeline] Empty step in '" << token << "'" << std::endl;
+		return 1;
+	}
+	const std::string& name = parts[0];
+	std::vector<double> arguments;
+	for (size_t index = 1; index < parts.size(); ++index) {
+		double value = 0.0;
+		if (!parse_number(parts[index], value)) {
+			std::cerr << "[parse_pipeline] Bad argument '" << parts[index] << "' in '" << token << "'" << std::endl;
+			return 1;
+		}
+		arguments.push_back(value);
+	}
+	auto expect = [&](size_t least, size_t most) {
+		if (arguments.size() >= least && arguments.size() <= most)
+			return true;
+		std::cerr << "[parse_pipeline] " << name << " takes " << least;
+		if (most != least)
+			std::cerr << " to " << most;
+		std::cerr << " arguments, got " << arguments.size() << std::endl;
+		return false;
+	};
+
+	PipelineStep step;
+	step.name = text;
+	if (name == "set" || name == "brighten" || name == "threshold" || name == "invert_threshold") {
+		if (!expect(1, 1))
+			return 1;
+		int argument = static_cast<int>(arguments[0]);
+		if (name == "set")
+			step.lut = make_point_lut([argument](int value){return grayscale_set(value, argument);});
+		else if (name == "brighten")
+			step.lut = make_point_lut([argument](int value){return grayscale_brighten(value, argument);});
+		else if (name == "threshold")
+			step.lut = make_point_lut([argument](int value){return grayscale_threshold(value, argument);});
+		else
+			step.lut = make_point_lut([argument](int value){return grayscale_invert_threshold(value, argument);});
+	} else if (name == "stretch") {
+		if (!expect(2, 2))
+			return 1;
+		float gamma = static_cast<float>(arguments[0]);
+		int beta = static_cast<int>(arguments[1]);
+		step.lut = make_point_lut([gamma, beta](int value){return grayscale_stretch(value, gamma, beta);});
+	} else if (name == "invert" || name == "display" || name == "invert_display" || name == "not" || name == "bit_invert") {
+		if (!expect(0, 0))
+			return 1;
+		if (name == "invert")
+			step.lut = make_point_lut(grayscale_invert);
+		else if (name == "display")
+			step.lut = make_point_lut(bit_display);
+		else if (name == "invert_display")
+			step.lut = make_point_lut(bit_invert_display);
+		else if (name == "not")
+			step.lut = make_point_lut(bit_not);
+		else
+			step.lut = make_point_lut(bit_invert);
+	} else if (name == "box") {
+		if (!expect(1, 2))
+			return 1;
+		int width = static_cast<int>(arguments[0]);
+		int height = arguments.size() > 1 ? static_cast<int>(arguments[1]) : width;
+		if (width < 1 || height < 1) {
+			std::cerr << "[parse_pipeline] Bad box size in '" << token << "'" << std::endl;
+			return 1;
+		}
+		step.kind = PipelineStepKind::convolve;
+		step.convolution = box_kernel(width, height);
+	} else if (name == "gaussian") {
+		if (!expect(1, 1))
+			return 1;
+		if (arguments[0] <= 0.0) {
+			std::cerr << "[parse_pipeline] Bad sigma in '" << token << "'" << std::endl;
+			return 1;
+		}
+		step.kind = PipelineStepKind::convolve;
+		step.convolution = gaussian_kernel(static_cast<float>(arguments[0]));
+	} else if (name == "adaptive") {
+		if (!expect(2, 2))
+			return 1;
+		step.kind = PipelineStepKind::adaptive_threshold;
+		step.radius = static_cast<int>(arguments[0]);
+		step.offset = static_cast<int>(arguments[1]);
+	} else if (name == "otsu" || name == "triangle" || name == "equalize") {
+		if (!expect(0, 0))
+			return 1;
+		step.kind = PipelineStepKind::histogram;
+		step.lut = identity_point_lut();
+		if (name == "otsu")
+			step.histogram = HistogramLut::otsu;
+		else if (name == "triangle")
+			step.histogram = HistogramLut::triangle;
+		else
+			step.histogram = HistogramLut::equalize;
+	} else if (name == "auto_stretch") {
+		if (!expect(0, 1))
+			return 1;
+		if (!arguments.empty() && (arguments[0] < 0.0 || arguments[0] >= 50.0)) {
+			std::cerr << "[parse_pipeline] Bad clip percentage in '" << token << "'" << std::endl;
+			return 1;
+		}
+		step.kind = PipelineStepKind::histogram;
+		step.lut = identity_point_lut();
+		step.histogram = HistogramLut::stretch;
+		if (!arguments.empty())
+			step.clip = arguments[0] / 100.0;
+	} else if (name == "thin") {
+		if (!expect(0, 0))
+			return 1;
+		step.kind = PipelineStepKind::iterate;
+		step.cycle = {thin_first, thin_second};
+	} else if (name.compare(0, 5, "erode") == 0 || name.compare(0, 6, "dilate") == 0) {
+		std::string shape = name.substr(name[0] == 'e' ? 5 : 6);
+		if (shape == "_diamond")
+			step.shape = StructuringElement::diamond;
+		else if (shape == "_disc")
+			step.shape = StructuringElement::disc;
+		else if (shape == "_euclidean")
+			step.kind = PipelineStepKind::distance_morphology;
+		else if (!shape.empty()) {
+			std::cerr << "[parse_pipeline] Unknown operation '" << name << "'" << std::endl;
+			return 1;
+		}
+		if (!expect(1, 1))
+			return 1;
+		if (arguments[0] < 0) {
+			std::cerr << "[parse_pipeline] Bad radius in '" << token << "'" << std::endl;
+			return 1;
+		}
+		if (step.kind != PipelineStepKind::distance_morphology)
+			step.kind = PipelineStepKind::morphology;
+		step.radius = static_cast<int>(arguments[0]);
+		step.erode = name[0] == 'e';
+	} else if (name == "distance") {
+		if (!expect(0, 0))
+			return 1;
+		step.kind = PipelineStepKind::distance;
+	} else if (name == "canny" || name == "canny_scharr") {
+		if (!expect(2, 2))
+			return 1;
+		if (arguments[0] < 1 || arguments[1] < arguments[0]) {
+			std::cerr << "[parse_pipeline] Bad thresholds in '" << token << "'" << std::endl;
+			return 1;
+		}
+		step.kind = PipelineStepKind::canny;
+		step.canny.gradient = name == "canny" ? GradientOperator::sobel : GradientOperator::scharr;
+		step.canny.low = static_cast<int>(arguments[0]);
+		step.canny.high = static_cast<int>(arguments[1]);
+	} else if ((name == "median" && !arguments.empty()) || name == "percentile") {
+		size_t wanted = name == "median" ? 1 : 2;
+		if (!expect(wanted, wanted))
+			return 1;
+		if (arguments[0] < 0 || arguments[0] > 32767) {
+			std::cerr << "[parse_pipeline] Bad radius in '" << token << "'" << std::endl;
+			return 1;
+		}
+		if (wanted == 2 && (arguments[1] < 0.0 || arguments[1] > 100.0)) {
+			std::cerr << "[parse_pipeline] Bad percentage in '" << token << "'" << std::endl;
+			return 1;
+		}
+		step.kind = PipelineStepKind::rank;
+		step.radius = static_cast<int>(arguments[0]);
+		step.percentile = wanted == 2 ? arguments[1] : 50.0;
+	} else {
+		bool found = false;
+		for (const KernelOperation& operation : kernel_operations) {
+			if (name == operation.name) {
+				if (!expect(0, 0))
+					return 1;
+				step.kind = PipelineStepKind::kernel;
+				step.kernel = operation.kernel;
+				found = true;
+			}
+		}
+		if (!found) {
+			std::cerr << "[parse_pipeline] Unknown operation '" << name << "'" << std::endl;
+			return 1;
+		}
+	}
+
+	if (until_stable) {
+		if (step.kind == PipelineStepKind::kernel) {
+			step.kind = PipelineStepKind::iterate;
+			step.cycle = {step.kernel};
+		} else if (step.kind != PipelineStepKind::iterate) {
+			std::cerr << "[parse_pipeline] Only neighbourhood operators repeat until stable, in '" << token << "'" << std::endl;
+			return 1;
+		}
+	}
+	for (int repeat = 0; repeat < count; ++repeat)
+		steps.push_back(step);
+	return 0;
+}
+
+void append_name(std::string& name, const std::string& part) {
+	if (!name.empty())
+		name += ",";
+	name += part;
+}
+
+BinaryFn binary_counterpart(NeighbourhoodFn kernel) {
+	for (const KernelOperation& operation : kernel_operations)
+		if (operation.kernel == kernel)
+			return operation.binary;
+	return nullptr;
+}
+
+// the t for which lut is grayscale_threshold(value, t), or -1
+int threshold_of(const PointLut& lut) {
+	int threshold = 0;
+	while (threshold < 256 && lut.table[threshold] == 0)
+		++threshold;
+	if (threshold == 256)
+		return -1;
+	for (int value = threshold; value < 256; ++value)
+		if (lut.table[value] != 1)
+			return -1;
+	return threshold;
+}
+
+// Point steps fuse into one table, or into the table a histogram step
+// applies after its own. The set of values the image can hold is
+// tracked along the chain, and while it is within {0, 1} the neighbourhood
+// operators run as one binary step: a preceding threshold becomes the
+// packing itself and a following point step whose table keeps 0 at 0 only
+// changes the value set bits unpack to.
+void plan_pipeline(const std::vector<PipelineStep>& parsed, Pipeline& pipeline) {
+	std::vector<PipelineStep> fused;
+	for (const PipelineStep& step : parsed) {
+		bool after_table = !fused.empty() && (fused.back().kind == PipelineStepKind::point || fused.back().kind == PipelineStepKind::histogram);
+		if (step.kind == PipelineStepKind::point && after_table) {
+			append_point_operation(fused.back().lut, step.lut);
+			append_name(fused.back().name, step.name);
+		} else {
+			fused.push_back(step);
+		}
+	}
+
+	std::vector<PipelineStep>& steps = pipeline.steps;
+	std::bitset<256> values;
+	values.set();
+	std::bitset<256> binary_values;
+	binary_values.set(0);
+	binary_values.set(1);
+	for (const PipelineStep& step : fused) {
+		bool binary = (values & ~binary_values).none();
+		switch (step.kind) {
+		case PipelineStepKind::point: {
+			if (!steps.empty() && steps.back().kind == PipelineStepKind::binary && step.lut.table[0] == 0) {
+				PipelineStep& packed = steps.back();
+				packed.one = step.lut.table[packed.one];
+				append_name(packed.name, step.name);
+				values.reset();
+				values.set(0);
+				values.set(packed.one);
+				break;
+			}
+			std::bitset<256> mapped;
+			for (int value = 0; value < 256; ++value)
+				if (values.test(value))
+					mapped.set(step.lut.table[value]);
+			values = mapped;
+			steps.push_back(step);
+			break;
+		}
+		case PipelineStepKind::kernel:
+			if (binary && binary_counterpart(step.kernel)) {
+				if (steps.empty() || steps.back().kind != PipelineStepKind::binary || steps.back().one != 1) {
+					PipelineStep packed;
+					packed.kind = PipelineStepKind::binary;
+					if (!steps.empty() && steps.back().kind == PipelineStepKind::point && threshold_of(steps.back().lut) >= 0) {
+						packed.threshold = threshold_of(steps.back().lut);
+						packed.name = steps.back().name;
+						steps.pop_back();
+					}
+					steps.push_back(packed);
+				}
+				PipelineStep& packed = steps.back();
+				packed.binary.push_back(binary_counterpart(step.kernel));
+				append_name(packed.name, step.name);
+			} else {
+				steps.push_back(step);
+				// the operators only ever write 0, 1 or the input value
+				values.set(0);
+				values.set(1);
+			}
+			break;
+		case PipelineStepKind::adaptive_threshold:
+		case PipelineStepKind::canny:
+		case PipelineStepKind::distance_morphology:
+			values = binary_values;
+			steps.push_back(step);
+			break;
+		case PipelineStepKind::iterate:
+			steps.push_back(step);
+			values.set(0);
+			values.set(1);
+			break;
+		case PipelineStepKind::morphology:
+		case PipelineStepKind::rank:
+			// ranks of the values already there
+			steps.push_back(step);
+			break;
+		case PipelineStepKind::histogram: {
+			// a threshold gives 0 or 1 before the fused table
+			bool threshold = step.histogram == HistogramLut::otsu || step.histogram == HistogramLut::triangle;
+			values.reset();
+			for (int value = 0; value < (threshold ? 2 : 256); ++value)
+				values.set(step.lut.table[value]);
+			steps.push_back(step);
+			break;
+		}
+		default:
+			values.set();
+			steps.push_back(step);
+			break;
+		}
+	}
+}
+
+}
+
+int parse_pipeline(const std::string& spec, Pipeline& pipeline) {
+	pipeline.steps.clear();
+	std::string text;
+	bool comment = false;
+	for (char character : spec) {
+		if (character == '#')
+			comment = true;
+		else if (character == '\n')
+			comment = false;
+		if (!comment)
+			text += character == ',' ? ' ' : character;
+	}
+
+	std::vector<PipelineStep> parsed;
+	std::stringstream stream(text);
+	std::string token;
+	while (stream >> token) {
+		if (parse_step(token, parsed) != 0)
+			return 1;
+	}
+	plan_pipeline(parsed, pipeline);
+	return 0;
+}
+
+int load_pipeline(const char* filename, Pipeline& pipeline) {
+	std::ifstream file(filename);
+	if (!file) {
+		std::cerr << "[load_pipeline] File " << filename << " could not be opened for reading" << std::endl;
+		return 1;
+	}
+	std::stringstream spec;
+	spec << file.rdbuf();
+	return parse_pipeline(spec.str(), pipeline);
+}
+
+std::string describe_pipeline(const Pipeline& pipeline) {
+	std::string description;
+	for (const PipelineStep& step : pipeline.steps) {
+		switch (step.kind) {
+		case PipelineStepKind::point:
+			description += "lut";
+			break;
+		case PipelineStepKind::kernel:
+			description += "kernel";
+			break;
+		case PipelineStepKind::binary:
+			description += "binary";
+			break;
+		case PipelineStepKind::convolve:
+			description += "convolve";
+			break;
+		case PipelineStepKind::adaptive_threshold:
+			description += "adaptive";
+			break;
+		case PipelineStepKind::iterate:
+			description += "iterate";
+			break;
+		case PipelineStepKind::morphology:
+			description += "morphology";
+			break;
+		case PipelineStepKind::histogram:
+			description += "histogram";
+			break;
+		case PipelineStepKind::rank:
+			description += "rank";
+			break;
+		case PipelineStepKind::canny:
+			description += "canny";
+			break;
+		case PipelineStepKind::distance:
+			description += "distance";
+			break;
+		case PipelineStepKind::distance_morphology:
+			description += "distance morphology";
+			break;
+		}
+		description += " (" + step.name + ")\n";
+	}
+	return description;
+}
+
+void run_pipeline(const Pipeline& pipeline, Image8& image, PipelineBuffers& buffers) {
+	for (const PipelineStep& step : pipeline.steps) {
+		size_t pixels = static_cast<size_t>(image.width()) * image.height();
+		ProfileScope scope(step.name.c_str(), pixels, 2 * pixels);
+		switch (step.kind) {
+		case PipelineStepKind::point:
+			apply_point_lut(step.lut, image);
+			break;
+		case PipelineStepKind::kernel:
+			if (buffers.scratch.width() != image.width() || buffers.scratch.height() != image.height())
+				buffers.scratch.resize(image.width(), image.height());
+			single_channel_kernel(step.kernel, buffers.scratch, image);
+			swap(buffers.scratch, image);
+			break;
+		case PipelineStepKind::binary:
+			if (step.threshold >= 0)
+				binary_threshold(buffers.bits, image, step.threshold);
+			else
+				binary_from_image(buffers.bits, image);
+			for (BinaryFn fn : step.binary) {
+				fn(buffers.other_bits, buffers.bits);
+				swap(buffers.bits, buffers.other_bits);
+			}
+			binary_to_image(image, buffers.bits, step.one);
+			break;
+		case PipelineStepKind::convolve:
+			grayscale_convolve(buffers.scratch, image, step.convolution);
+			swap(buffers.scratch, image);
+			break;
+		case PipelineStepKind::adaptive_threshold:
+			adaptive_threshold(buffers.scratch, image, step.radius, step.offset);
+			swap(buffers.scratch, image);
+			break;
+		case PipelineStepKind::iterate:
+			iterate_kernels(step.cycle, image);
+			break;
+		case PipelineStepKind::morphology:
+			if (step.erode)
+				grayscale_erode(buffers.scratch, image, step.radius, step.shape);
+			else
+				grayscale_dilate(buffers.scratch, image, step.radius, step.shape);
+			swap(buffers.scratch, image);
+			break;
+		case PipelineStepKind::rank:
+			grayscale_percentile(buffers.scratch, image, step.radius, step.percentile);
+			swap(buffers.scratch, image);
+			break;
+		case PipelineStepKind::canny:
+			canny(buffers.scratch, image, step.canny);
+			swap(buffers.scratch, image);
+			break;
+		case PipelineStepKind::distance:
+			distance_image(buffers.scratch, image);
+			swap(buffers.scratch, image);
+			break;
+		case PipelineStepKind::distance_morphology:
+			if (step.erode)
+				distance_erode(buffers.scratch, image, step.radius);
+			else
+				distance_dilate(buffers.scratch, image, step.radius);
+			swap(buffers.scratch, image);
+			break;
+		case PipelineStepKind::histogram: {
+			Histogram histogram;
+			grayscale_histogram(histogram, image);
+			PointLut lut;
+			if (step.histogram == HistogramLut::otsu || step.histogram == HistogramLut::triangle) {
+				int threshold = step.histogram == HistogramLut::otsu ? otsu_threshold(histogram) : triangle_threshold(histogram);
+				lut = make_point_lut([threshold](int value){return grayscale_threshold(value, threshold);});
+			} else if (step.histogram == HistogramLut::stretch) {
+				lut = auto_stretch_lut(histogram, step.clip);
+			} else {
+				lut = equalize_lut(histogram);
+			}
+			append_point_operation(lut, step.lut);
+			apply_point_lut(lut, image);
+			break;
+		}
+		}
+	}
+}
+
+bool pipeline_row_stages(const Pipeline& pipeline, std::vector<RowStage>& stages) {
+	stages.clear();
+	for (const PipelineStep& step : pipeline.steps) {
+		switch (step.kind) {
+		case PipelineStepKind::point:
+			stages.push_back(point_stage(step.lut));
+			break;
+		case PipelineStepKind::kernel:
+			stages.push_back(kernel_stage(step.kernel));
+			break;
+		case PipelineStepKind::binary: {
+			int threshold = step.threshold;
+			if (threshold >= 0)
+				stages.push_back(point_stage(make_point_lut([threshold](int value){return grayscale_threshold(value, threshold);})));
+			for (BinaryFn fn : step.binary) {
+				for (const KernelOperation& operation : kernel_operations)
+					if (operation.binary == fn)
+						stages.push_back(kernel_stage(operation.kernel));
+			}
+			if (step.one != 1) {
+				uint8_t one = step.one;
+				stages.push_back(point_stage(make_point_lut([one](int value){return value ? one : 0;})));
+			}
+			break;
+		}
+		default:
+			stages.clear();
+			return false;
+		}
+	}
+	return true;
+}
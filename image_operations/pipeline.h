@@ -0,0 +1,117 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <string>
+#include <vector>
+
+#include "binary_image.h"
+#include "convolution.h"
+#include "distance_transform.h"
+#include "edge_detection.h"
+#include "histogram.h"
+#include "image.h"
+#include "morphology.h"
+#include "point_operations.h"
+#include "row_pipeline.h"
+
+// A chain of operators described as text, e.g. "threshold:100,shrink*3,display".
+// Steps are separated by commas or whitespace, arguments follow the name after
+// colons and *n repeats a step n times, or *stable until a neighbourhood
+// operator stops changing the image; # starts a comment. The operators are
+//   point:          set:a brighten:b stretch:gamma:beta invert threshold:t
+//                   invert_threshold:t display invert_display not bit_invert
+//   histogram:      otsu triangle auto_stretch[:clip_percent] equalize
+//   neighbourhood:  shrink expand edge salt pepper noise noize median thin
+//   morphology:     erode:r dilate:r erode_diamond:r dilate_diamond:r
+//                   erode_disc:r dilate_disc:r erode_euclidean:r dilate_euclidean:r
+//   distance:       distance
+//   rank:           median:r percentile:r:percent
+//   edges:          canny:low:high canny_scharr:low:high
+//   filters:        box:w[:h] gaussian:sigma adaptive:radius:offset
+
+enum class PipelineStepKind {
+	point,
+	kernel,
+	binary,
+	convolve,
+	adaptive_threshold,
+	iterate,
+	morphology,
+	histogram,
+	rank,
+	canny,
+	distance,
+	distance_morphology
+};
+
+// where a histogram step's table comes from
+enum class HistogramLut {
+	otsu,
+	triangle,
+	stretch,
+	equalize
+};
+
+typedef void (*NeighbourhoodFn)(Image8&, const Image8&, int, int);
+typedef void (*BinaryFn)(BinaryImage&, const BinaryImage&);
+
+// One planned step. Adjacent point operations are fused into one lut, and
+// neighbourhood operators on an image known to hold only 0 and 1 become a
+// binary step that runs them all on packed bits.
+struct PipelineStep {
+	PipelineStepKind kind = PipelineStepKind::point;
+	std::string name;
+	PointLut lut;
+	NeighbourhoodFn kernel = nullptr;
+	// binary: the operators, the threshold the bits come from (-1 when the
+	// image is already 0/1) and the value set bits become on the way out
+	std::vector<BinaryFn> binary;
+	int threshold = -1;
+	uint8_t one = 1;
+	ConvolutionKernel convolution;
+	int radius = 0;
+	int offset = 0;
+	// iterate: the operators run in turn until they stop changing the image
+	std::vector<NeighbourhoodFn> cycle;
+	// morphology and distance_morphology: erode or dilate by radius
+	StructuringElement shape = StructuringElement::square;
+	bool erode = false;
+	// rank: the percentile of the window of radius
+	double percentile = 50.0;
+	CannyOptions canny;
+	// histogram: the table made from the image's histogram, followed by lut
+	// for the point steps fused after it
+	HistogramLut histogram = HistogramLut::otsu;
+	double clip = 0.01;
+};
+
+struct Pipeline {
+	std::vector<PipelineStep> steps;
+};
+
+// Buffers the steps ping-pong between, allocated on first use and reused
+// for every image run with them.
+struct PipelineBuffers {
+	Image8 scratch;
+	BinaryImage bits;
+	BinaryImage other_bits;
+};
+
+// Parses and plans a spec. Returns 0 on success; otherwise reports the
+// offending step and leaves pipeline empty.
+int parse_pipeline(const std::string& spec, Pipeline& pipeline);
+// the spec is the contents of the file
+int load_pipeline(const char* filename, Pipeline& pipeline);
+
+// the plan, one step per line
+std::string describe_pipeline(const Pipeline& pipeline);
+
+// Runs the steps in place on image, swapping buffers rather than copying
+// between steps.
+void run_pipeline(const Pipeline& pipeline, Image8& image, PipelineBuffers& buffers);
+
+// The same chain as RowStages for --stream. Returns false when a step reads
+// more than one row either side.
+bool pipeline_row_stages(const Pipeline& pipeline, std::vector<RowStage>& stages);
+
+#endif
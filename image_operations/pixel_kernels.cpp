@@ -0,0 +1,567 @@
+// Built once per IsaLevel, with PIXEL_KERNELS_LEVEL naming the level and that
+// level's -m flags (see the Makefile), so the #if blocks below pick the
+// widest code the level allows. Everything here has internal linkage and no
+// standard library templates are used: an inline function shared with
+// another translation unit could be merged by the linker with a copy built
+// for a higher level and run on a CPU that lacks it.
+#include "pixel_kernels.h"
+
+#include <cstring>
+
+#if __SSE4_1__
+#include <immintrin.h>
+#endif
+
+// the word vectors never cross an external interface, so the AVX argument-passing ABI note does not apply
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+namespace {
+
+#if __AVX512F__
+typedef uint64_t WordVector __attribute__((vector_size(64)));
+#elif __AVX2__
+typedef uint64_t WordVector __attribute__((vector_size(32)));
+#elif __SSE4_2__
+typedef uint64_t WordVector __attribute__((vector_size(16)));
+#else
+typedef uint64_t WordVector;
+#endif
+const int vector_words = sizeof(WordVector) / sizeof(uint64_t);
+
+void lut_row(const uint8_t* table, uint8_t* row, size_t count) {
+	// There is no byte gather, so the table is split into sixteen 16-entry
+	// segments and looked up with pshufb. Biasing the index by 0x70 with
+	// unsigned saturation sets the high bit (which zeroes the shuffle lane)
+	// for every lane outside the current segment. At 128 bits the sixteen
+	// shuffles cost more than the plain loads, so sse42 uses the table.
+	size_t x = 0;
+#if __AVX512BW__
+	__m512i segments[16];
+	for (int k = 0; k < 16; ++k)
+		segments[k] = _mm512_broadcast_i32x4(_mm_loadu_si128(reinterpret_cast<const __m128i*>(table + 16 * k)));
+	const __m512i bias = _mm512_set1_epi8(0x70);
+	const __m512i step = _mm512_set1_epi8(16);
+	for (; x + 64 <= count; x += 64) {
+		__m512i index = _mm512_loadu_si512(row + x);
+		__m512i result = _mm512_setzero_si512();
+		for (int k = 0; k < 16; ++k) {
+			result = _mm512_or_si512(result, _mm512_shuffle_epi8(segments[k], _mm512_adds_epu8(index, bias)));
+			index = _mm512_sub_epi8(index, step);
+		}
+		_mm512_storeu_si512(row + x, result);
+	}
+#elif __AVX2__
+	__m256i segments[16];
+	for (int k = 0; k < 16; ++k)
+		segments[k] = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(table + 16 * k)));
+	const __m256i bias = _mm256_set1_epi8(0x70);
+	const __m256i step = _mm256_set1_epi8(16);
+	for (; x + 32 <= count; x += 32) {
+		__m256i index = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + x));
+		__m256i result = _mm256_setzero_si256();
+		for (int k = 0; k < 16; ++k) {
+			result = _mm256_or_si256(result, _mm256_shuffle_epi8(segments[k], _mm256_adds_epu8(index, bias)));
+			index = _mm256_sub_epi8(index, step);
+		}
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(row + x), result);
+	}
+#endif
+	for (; x < count; ++x)
+		row[x] = table[row[x]];
+}
+
+void threshold_row(uint64_t* words, const uint8_t* pixels, int width, int threshold) {
+	int count = (width + 63) / 64;
+	for (int j = 0; j < count; ++j) {
+		const uint8_t* source = pixels + 64 * j;
+		int bits = width - 64 * j < 64 ? width - 64 * j : 64;
+#if __SSE4_1__
+		if (bits == 64 && threshold > 0 && threshold < 256) {
+#if __AVX512BW__
+			words[j] = _mm512_cmpge_epu8_mask(_mm512_loadu_si512(source), _mm512_set1_epi8(static_cast<char>(threshold)));
+#elif __AVX2__
+			// value >= threshold exactly when max(value, threshold) == value
+			__m256i limit = _mm256_set1_epi8(static_cast<char>(threshold));
+			__m256i low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source));
+			__m256i high = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + 32));
+			uint32_t low_bits = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(low, limit), low));
+			uint32_t high_bits = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(high, limit), high));
+			words[j] = low_bits | (static_cast<uint64_t>(high_bits) << 32);
+#else
+			__m128i limit = _mm_set1_epi8(static_cast<char>(threshold));
+			uint64_t word = 0;
+			for (int part = 0; part < 4; ++part) {
+				__m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + 16 * part));
+				uint64_t mask = static_cast<uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(values, limit), values)));
+				word |= mask << (16 * part);
+			}
+			words[j] = word;
+#endif
+			continue;
+		}
+#endif
+		uint64_t word = 0;
+		for (int i = 0; i < bits; ++i)
+			word |= static_cast<uint64_t>(source[i] >= threshold) << i;
+		words[j] = word;
+	}
+}
+
+template <typename W>
+inline W load_words(const uint64_t* words) {
+	W value;
+	std::memcpy(&value, words, sizeof(W));
+	return value;
+}
+
+template <typename W>
+inline void store_words(uint64_t* words, const W& value) {
+	std::memcpy(words, &value, sizeof(W));
+}
+
+// the number of set 8-neighbours of every bit, bit-sliced into four planes
+template <typename W>
+struct NeighbourCount {
+	W c0, c1, c2, c3;
+};
+
+template <typename W>
+inline void full_add(const W& a, const W& b, const W& c, W& sum, W& carry) {
+	W partial = a ^ b;
+	sum = partial ^ c;
+	carry = (a & b) | (partial & c);
+}
+
+// shifting a row left by one moves the west neighbour of every pixel into
+// place, with bit 63 of the previous word carried into bit 0
+template <typename W>
+inline W west(const uint64_t* words) {
+	return (load_words<W>(words) << 1) | (load_words<W>(words - 1) >> 63);
+}
+
+template <typename W>
+inline W east(const uint64_t* words) {
+	return (load_words<W>(words) >> 1) | (load_words<W>(words + 1) << 63);
+}
+
+// carry-save adder tree over the eight neighbour planes
+template <typename W>
+inline NeighbourCount<W> count_neighbours(const uint64_t* above, const uint64_t* centre, const uint64_t* below) {
+	W s1, k1, s2, k2;
+	full_add(west<W>(above), load_words<W>(above), east<W>(above), s1, k1);
+	full_add(west<W>(centre), east<W>(centre), west<W>(below), s2, k2);
+	W south = load_words<W>(below);
+	W south_east = east<W>(below);
+	W s3 = south ^ south_east;
+	W k3 = south & south_east;
+
+	NeighbourCount<W> count;
+	W k4, twos, k5;
+	full_add(s1, s2, s3, count.c0, k4);
+	full_add(k1, k2, k3, twos, k5);
+	count.c1 = twos ^ k4;
+	W k6 = twos & k4;
+	count.c2 = k5 ^ k6;
+	count.c3 = k5 & k6;
+	return count;
+}
+
+// the per-pixel rules of neighbourhood_operations.cpp in terms of the count planes;
+// sigma == 8 is c3 alone since the count never exceeds 8
+struct ShrinkRule {
+	template <typename W>
+	static W apply(const W& centre, const NeighbourCount<W>& count) {
+		return centre & count.c3;
+	}
+};
+
+struct ExpandRule {
+	template <typename W>
+	static W apply(const W& centre, const NeighbourCount<W>& count) {
+		return centre | count.c0 | count.c1 | count.c2 | count.c3;
+	}
+};
+
+// edge and pepper differ only at the border
+struct PepperRule {
+	template <typename W>
+	static W apply(const W& centre, const NeighbourCount<W>& count) {
+		return centre & ~count.c3;
+	}
+};
+
+struct SaltRule {
+	template <typename W>
+	static W apply(const W& centre, const NeighbourCount<W>& count) {
+		return centre | count.c3;
+	}
+};
+
+struct NoiseRule {
+	template <typename W>
+	static W apply(const W& centre, const NeighbourCount<W>& count) {
+		W any = count.c0 | count.c1 | count.c2 | count.c3;
+		return (centre & any) | count.c3;
+	}
+};
+
+// sigma < 2 clears, sigma > 6 sets
+struct NoizeRule {
+	template <typename W>
+	static W apply(const W& centre, const NeighbourCount<W>& count) {
+		W at_least_two = count.c1 | count.c2 | count.c3;
+		W above_six = count.c3 | (count.c2 & count.c1 & count.c0);
+		return (centre & at_least_two) | above_six;
+	}
+};
+
+template <typename Rule>
+void binary_rule_row(uint64_t* out, const uint64_t* above, const uint64_t* centre, const uint64_t* below, int words) {
+	int j = 0;
+	for (; j + vector_words <= words; j += vector_words) {
+		store_words(out + j, Rule::apply(load_words<WordVector>(centre + j),
+			count_neighbours<WordVector>(above + j, centre + j, below + j)));
+	}
+	for (; j < words; ++j)
+		out[j] = Rule::apply(centre[j], count_neighbours<uint64_t>(above + j, centre + j, below + j));
+}
+
+void binary_row(BinaryRule rule, uint64_t* out, const uint64_t* above, const uint64_t* centre,
+	const uint64_t* below, int words)
+{
+	switch (rule) {
+	case BinaryRule::shrink:
+		binary_rule_row<ShrinkRule>(out, above, centre, below, words);
+		break;
+	case BinaryRule::expand:
+		binary_rule_row<ExpandRule>(out, above, centre, below, words);
+		break;
+	case BinaryRule::edge:
+	case BinaryRule::pepper:
+		binary_rule_row<PepperRule>(out, above, centre, below, words);
+		break;
+	case BinaryRule::salt:
+		binary_rule_row<SaltRule>(out, above, centre, below, words);
+		break;
+	case BinaryRule::noise:
+		binary_rule_row<NoiseRule>(out, above, centre, below, words);
+		break;
+	case BinaryRule::noize:
+		binary_rule_row<NoizeRule>(out, above, centre, below, words);
+		break;
+	}
+}
+
+// the rules of neighbourhood_operations.h, with internal linkage here
+#include "neighbourhood_rules.h"
+
+// Each column's three-row sum is made once and shared by the three windows
+// that cover it, so a pixel costs a few adds; both loops vectorize.
+template <typename Rule>
+void neighbourhood_rule_row(uint8_t* __restrict out, const uint8_t* above, const uint8_t* centre,
+	const uint8_t* below, int count)
+{
+	const int chunk = 256;
+	int16_t columns[chunk + 2];
+	for (int x0 = 0; x0 < count; x0 += chunk) {
+		int length = count - x0 < chunk ? count - x0 : chunk;
+		const uint8_t* a = above + x0 - 1;
+		const uint8_t* c = centre + x0 - 1;
+		const uint8_t* b = below + x0 - 1;
+		for (int i = 0; i < length + 2; ++i)
+			columns[i] = static_cast<int16_t>(a[i] + c[i] + b[i]);
+		const uint8_t* middle = centre + x0;
+		uint8_t* destination = out + x0;
+		for (int i = 0; i < length; ++i) {
+			int sigma = columns[i] + columns[i + 1] + columns[i + 2] - middle[i];
+			destination[i] = static_cast<uint8_t>(Rule::apply(middle[i], sigma));
+		}
+	}
+}
+
+void neighbourhood_row(BinaryRule rule, uint8_t* out, const uint8_t* above, const uint8_t* centre,
+	const uint8_t* below, int count)
+{
+	switch (rule) {
+	case BinaryRule::shrink:
+		neighbourhood_rule_row<ShrinkNeighbourhood>(out, above, centre, below, count);
+		break;
+	case BinaryRule::expand:
+		neighbourhood_rule_row<ExpandNeighbourhood>(out, above, centre, below, count);
+		break;
+	case BinaryRule::edge:
+		neighbourhood_rule_row<EdgeNeighbourhood>(out, above, centre, below, count);
+		break;
+	case BinaryRule::pepper:
+		neighbourhood_rule_row<PepperNeighbourhood>(out, above, centre, below, count);
+		break;
+	case BinaryRule::salt:
+		neighbourhood_rule_row<SaltNeighbourhood>(out, above, centre, below, count);
+		break;
+	case BinaryRule::noise:
+		neighbourhood_rule_row<NoiseNeighbourhood>(out, above, centre, below, count);
+		break;
+	case BinaryRule::noize:
+		neighbourhood_rule_row<NoizeNeighbourhood>(out, above, centre, below, count);
+		break;
+	}
+}
+
+// The inner loops run over x with the tap fixed, over plain arrays, so GCC
+// vectorizes them into widening multiply-adds at the level's width. Floats
+// are built with -ffp-contract=off, so no level fuses the multiply and add
+// and every level rounds the same way.
+template <typename Weight, typename Input, typename Accumulator>
+inline void accumulate_row(Accumulator* __restrict accumulator, const Input* __restrict input,
+	const Weight* weights, int taps, int width)
+{
+	for (int i = 0; i < taps; ++i) {
+		Accumulator weight = weights[i];
+		const Input* __restrict source = input + i;
+		for (int x = 0; x < width; ++x)
+			accumulator[x] += weight * static_cast<Accumulator>(source[x]);
+	}
+}
+
+void accumulate_u8_i16(int32_t* accumulator, const uint8_t* input, const int16_t* weights, int taps, int width) {
+	accumulate_row(accumulator, input, weights, taps, width);
+}
+
+void accumulate_i16_i16(int32_t* accumulator, const int16_t* input, const int16_t* weights, int taps, int width) {
+	accumulate_row(accumulator, input, weights, taps, width);
+}
+
+void accumulate_u8_f32(float* accumulator, const uint8_t* input, const float* weights, int taps, int width) {
+	accumulate_row(accumulator, input, weights, taps, width);
+}
+
+void accumulate_f32_f32(float* accumulator, const float* input, const float* weights, int taps, int width) {
+	accumulate_row(accumulator, input, weights, taps, width);
+}
+
+#if __SSE4_1__
+// pmaddwd multiplies pairs of samples, so pixels are widened to 16 bits
+// with 3 channels padded to 4, and phaddd adds the pairs of each pixel.
+// 3-channel loads read 4 bytes past the pixels they convert.
+inline __m128i widen_low(int channels) {
+	return channels == 3 ? _mm_setr_epi8(0, -1, 1, -1, 2, -1, -1, -1, 3, -1, 4, -1, 5, -1, -1, -1)
+		: _mm_setr_epi8(0, -1, 1, -1, 2, -1, 3, -1, 4, -1, 5, -1, 6, -1, 7, -1);
+}
+
+inline __m128i widen_high(int channels) {
+	return channels == 3 ? _mm_setr_epi8(6, -1, 7, -1, 8, -1, -1, -1, 9, -1, 10, -1, 11, -1, -1, -1)
+		: _mm_setr_epi8(8, -1, 9, -1, 10, -1, 11, -1, 12, -1, 13, -1, 14, -1, 15, -1);
+}
+#endif
+
+#if __AVX2__
+// weighted sums of 8 pixels, in order, before the bias
+inline __m256i gray_sums(const uint8_t* in, int channels, __m256i weights, __m256i low, __m256i high) {
+	if (channels == 2)
+		return _mm256_madd_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in))), weights);
+	// pixels 0-3 in the low lane and 4-7 in the high one
+	__m256i pixels = _mm256_inserti128_si256(
+		_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in))),
+		_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 4 * channels)), 1);
+	return _mm256_hadd_epi32(
+		_mm256_madd_epi16(_mm256_shuffle_epi8(pixels, low), weights),
+		_mm256_madd_epi16(_mm256_shuffle_epi8(pixels, high), weights));
+}
+
+int gray_row_simd(uint8_t* out, const uint8_t* in, int width, int channels, const int16_t* w, int bias) {
+	__m256i weights = channels == 2
+		? _mm256_set1_epi32((static_cast<uint16_t>(w[1]) << 16) | static_cast<uint16_t>(w[0]))
+		: _mm256_setr_epi16(w[0], w[1], w[2], w[3], w[0], w[1], w[2], w[3], w[0], w[1], w[2], w[3], w[0], w[1], w[2], w[3]);
+	__m256i low = _mm256_broadcastsi128_si256(widen_low(channels));
+	__m256i high = _mm256_broadcastsi128_si256(widen_high(channels));
+	__m256i bias_vector = _mm256_set1_epi32(bias);
+	const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	int end = width - 32 - (channels == 3 ? 2 : 0);
+	int x = 0;
+	for (; x <= end; x += 32) {
+		const uint8_t* source = in + x * channels;
+		__m256i sums[4];
+		for (int group = 0; group < 4; ++group) {
+			sums[group] = _mm256_srli_epi32(_mm256_add_epi32(
+				gray_sums(source + 8 * group * channels, channels, weights, low, high), bias_vector), 14);
+		}
+		// the packs work within lanes, so the 4-byte groups come out interleaved
+		__m256i bytes = _mm256_packus_epi16(_mm256_packus_epi32(sums[0], sums[1]), _mm256_packus_epi32(sums[2], sums[3]));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + x), _mm256_permutevar8x32_epi32(bytes, order));
+	}
+	return x;
+}
+#elif __SSE4_1__
+// weighted sums of 4 pixels, before the bias
+inline __m128i gray_sums(const uint8_t* in, int channels, __m128i weights, __m128i low, __m128i high) {
+	if (channels == 2)
+		return _mm_madd_epi16(_mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(in))), weights);
+	__m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+	return _mm_hadd_epi32(
+		_mm_madd_epi16(_mm_shuffle_epi8(pixels, low), weights),
+		_mm_madd_epi16(_mm_shuffle_epi8(pixels, high), weights));
+}
+
+int gray_row_simd(uint8_t* out, const uint8_t* in, int width, int channels, const int16_t* w, int bias) {
+	__m128i weights = channels == 2
+		? _mm_set1_epi32((static_cast<uint16_t>(w[1]) << 16) | static_cast<uint16_t>(w[0]))
+		: _mm_setr_epi16(w[0], w[1], w[2], w[3], w[0], w[1], w[2], w[3]);
+	__m128i low = widen_low(channels);
+	__m128i high = widen_high(channels);
+	__m128i bias_vector = _mm_set1_epi32(bias);
+	int end = width - 16 - (channels == 3 ? 2 : 0);
+	int x = 0;
+	for (; x <= end; x += 16) {
+		const uint8_t* source = in + x * channels;
+		__m128i sums[4];
+		for (int group = 0; group < 4; ++group) {
+			sums[group] = _mm_srli_epi32(_mm_add_epi32(
+				gray_sums(source + 4 * group * channels, channels, weights, low, high), bias_vector), 14);
+		}
+		__m128i bytes = _mm_packus_epi16(_mm_packus_epi32(sums[0], sums[1]), _mm_packus_epi32(sums[2], sums[3]));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), bytes);
+	}
+	return x;
+}
+#else
+int gray_row_simd(uint8_t*, const uint8_t*, int, int, const int16_t*, int) {
+	return 0;
+}
+#endif
+
+void gray_row(uint8_t* out, const uint8_t* in, int width, int channels, const int16_t* weights, int bias) {
+	int x = gray_row_simd(out, in, width, channels, weights, bias);
+	for (; x < width; ++x) {
+		const uint8_t* pixel = in + x * channels;
+		int sum = bias;
+		for (int channel = 0; channel < channels; ++channel)
+			sum += pixel[channel] * weights[channel];
+		out[x] = static_cast<uint8_t>(sum >> 14);
+	}
+}
+
+void prefix_sum_row(uint32_t* out, const uint8_t* in, int width) {
+	out[0] = 0;
+	int x = 0;
+#if __SSE4_1__
+	// four pixels at a time: a log-step scan within the register, then the
+	// running total carried in from the previous four
+	__m128i carry = _mm_setzero_si128();
+	for (; x + 4 <= width; x += 4) {
+		int32_t bytes;
+		std::memcpy(&bytes, in + x, sizeof(bytes));
+		__m128i sums = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes));
+		sums = _mm_add_epi32(sums, _mm_slli_si128(sums, 4));
+		sums = _mm_add_epi32(sums, _mm_slli_si128(sums, 8));
+		sums = _mm_add_epi32(sums, carry);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + x + 1), sums);
+		carry = _mm_shuffle_epi32(sums, _MM_SHUFFLE(3, 3, 3, 3));
+	}
+#endif
+	for (; x < width; ++x)
+		out[x + 1] = out[x] + in[x];
+}
+
+// Plain loops over 16- and 32-bit lanes, which GCC vectorizes at the
+// level's width; the shift is a register operand, so it stays uniform.
+void background_row(uint16_t* __restrict model, const uint8_t* __restrict frame, uint8_t* __restrict mask,
+	int width, int shift, int threshold)
+{
+	int rounding = shift > 0 ? 1 << (shift - 1) : 0;
+	for (int x = 0; x < width; ++x) {
+		int average = model[x];
+		int value = frame[x];
+		int difference = value - ((average + 128) >> 8);
+		mask[x] = static_cast<uint8_t>(difference >= threshold || -difference >= threshold);
+		model[x] = static_cast<uint16_t>(average + (((value << 8) - average + rounding) >> shift));
+	}
+}
+
+// Plain loops again, one for each norm since GCC leaves a select between
+// them unvectorized. The direction tests compare |gy| against |gx| times
+// tan 22.5 and tan 67.5 in Q15, in 32-bit lanes.
+template <bool euclidean>
+void gradient_loop(uint16_t* __restrict magnitude, uint8_t* __restrict direction, const uint8_t* above,
+	const uint8_t* centre, const uint8_t* below, int width, int side, int middle)
+{
+	for (int x = 0; x < width; ++x) {
+		int gx = side * (above[x + 1] - above[x - 1] + below[x + 1] - below[x - 1]) + middle * (centre[x + 1] - centre[x - 1]);
+		int gy = side * (below[x - 1] - above[x - 1] + below[x + 1] - above[x + 1]) + middle * (below[x] - above[x]);
+		int ax = gx < 0 ? -gx : gx;
+		int ay = gy < 0 ? -gy : gy;
+		int diagonal = 1 + (((gx ^ gy) >> 30) & 2);
+		int code = (ay << 15) >= ax * 79109 ? 2 : diagonal;
+		direction[x] = static_cast<uint8_t>((ay << 15) <= ax * 13573 ? 0 : code);
+		if (euclidean)
+			magnitude[x] = static_cast<uint16_t>(__builtin_sqrtf(static_cast<float>(gx * gx + gy * gy)) + 0.5f);
+		else
+			magnitude[x] = static_cast<uint16_t>(ax + ay);
+	}
+}
+
+void gradient_row(uint16_t* magnitude, uint8_t* direction, const uint8_t* above, const uint8_t* centre,
+	const uint8_t* below, int width, bool scharr, bool l2)
+{
+	if (l2)
+		gradient_loop<true>(magnitude, direction, above, centre, below, width, scharr ? 3 : 1, scharr ? 10 : 2);
+	else
+		gradient_loop<false>(magnitude, direction, above, centre, below, width, scharr ? 3 : 1, scharr ? 10 : 2);
+}
+
+// A compare-exchange is one min and one max per vector of lanes, the whole
+// wire in a single register at AVX-512.
+void compare_exchange(uint8_t* wires, const uint8_t* pairs, int count) {
+	for (int i = 0; i < count; ++i) {
+		uint8_t* a = wires + network_lanes * pairs[2 * i];
+		uint8_t* b = wires + network_lanes * pairs[2 * i + 1];
+#if __AVX512BW__
+		__m512i lhs = _mm512_loadu_si512(a);
+		__m512i rhs = _mm512_loadu_si512(b);
+		_mm512_storeu_si512(a, _mm512_min_epu8(lhs, rhs));
+		_mm512_storeu_si512(b, _mm512_max_epu8(lhs, rhs));
+#elif __AVX2__
+		for (int x = 0; x < network_lanes; x += 32) {
+			__m256i lhs = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + x));
+			__m256i rhs = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + x));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(a + x), _mm256_min_epu8(lhs, rhs));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(b + x), _mm256_max_epu8(lhs, rhs));
+		}
+#elif __SSE4_1__
+		for (int x = 0; x < network_lanes; x += 16) {
+			__m128i lhs = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + x));
+			__m128i rhs = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + x));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(a + x), _mm_min_epu8(lhs, rhs));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(b + x), _mm_max_epu8(lhs, rhs));
+		}
+#else
+		for (int x = 0; x < network_lanes; ++x) {
+			uint8_t lhs = a[x];
+			uint8_t rhs = b[x];
+			a[x] = lhs < rhs ? lhs : rhs;
+			b[x] = lhs < rhs ? rhs : lhs;
+		}
+#endif
+	}
+}
+
+}
+
+#define PIXEL_KERNELS_TABLE(level) PIXEL_KERNELS_TABLE_NAME(level)
+#define PIXEL_KERNELS_TABLE_NAME(level) pixel_kernels_##level
+
+extern const PixelKernels PIXEL_KERNELS_TABLE(PIXEL_KERNELS_LEVEL) = {
+	IsaLevel::PIXEL_KERNELS_LEVEL,
+	lut_row,
+	threshold_row,
+	binary_row,
+	neighbourhood_row,
+	accumulate_u8_i16,
+	accumulate_i16_i16,
+	accumulate_u8_f32,
+	accumulate_f32_f32,
+	gray_row,
+	prefix_sum_row,
+	background_row,
+	compare_exchange,
+	gradient_row
+};
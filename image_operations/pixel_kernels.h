@@ -0,0 +1,77 @@
+#ifndef PIXEL_KERNELS_H
+#define PIXEL_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "cpu_dispatch.h"
+
+// bytes per wire of compare_exchange
+const int network_lanes = 64;
+
+// the 3x3 rules of the neighbourhood operators, on bits and on 8-bit pixels
+enum class BinaryRule {
+	shrink,
+	expand,
+	edge,
+	salt,
+	pepper,
+	noise,
+	noize
+};
+
+// The hot row loops, built once per IsaLevel from pixel_kernels.cpp, each
+// time with that level's compiler flags. Callers go through pixel_kernels(),
+// which picks the table for isa_level(). Every table computes exactly what
+// the scalar one does.
+struct PixelKernels {
+	IsaLevel level;
+	// row[x] = table[row[x]]
+	void (*lut_row)(const uint8_t* table, uint8_t* row, size_t count);
+	// one bit per pixel of value >= threshold
+	void (*threshold_row)(uint64_t* words, const uint8_t* pixels, int width, int threshold);
+	// the rule applied to words of a row from the rows around it; the
+	// neighbours of the first and last word come from words -1 and words
+	void (*binary_row)(BinaryRule rule, uint64_t* out, const uint64_t* above, const uint64_t* centre,
+		const uint64_t* below, int words);
+	// the rule of an 8-bit neighbourhood operator on count pixels of the
+	// centre row, each from the sum of its eight neighbours; the rows are
+	// read from -1 to count
+	void (*neighbourhood_row)(BinaryRule rule, uint8_t* out, const uint8_t* above, const uint8_t* centre,
+		const uint8_t* below, int count);
+	// accumulator[x] += sum over i < taps of weights[i] * input[x + i]
+	void (*accumulate_u8_i16)(int32_t* accumulator, const uint8_t* input, const int16_t* weights, int taps, int width);
+	void (*accumulate_i16_i16)(int32_t* accumulator, const int16_t* input, const int16_t* weights, int taps, int width);
+	void (*accumulate_u8_f32)(float* accumulator, const uint8_t* input, const float* weights, int taps, int width);
+	void (*accumulate_f32_f32)(float* accumulator, const float* input, const float* weights, int taps, int width);
+	// 8-bit pixels of 2 to 4 channels to gray: (sum of weights[c] * sample c
+	// + bias) >> 14, for Q14 weights that sum to at most 16384
+	void (*gray_row)(uint8_t* out, const uint8_t* in, int width, int channels, const int16_t* weights, int bias);
+	// out[0] = 0 and out[x + 1] = out[x] + in[x]
+	void (*prefix_sum_row)(uint32_t* out, const uint8_t* in, int width);
+	// model holds averages in 8.8 fixed point: mask[x] = 1 where frame[x] is
+	// at least threshold from the rounded average, else 0, then model[x]
+	// moves 1/2^shift of the way to frame[x], rounded to nearest
+	void (*background_row)(uint16_t* model, const uint8_t* frame, uint8_t* mask, int width, int shift, int threshold);
+	// runs a sorting network on network_lanes columns at once: wires holds
+	// network_lanes bytes per wire, and each pair (a, b) of pairs, in order,
+	// leaves the lane-wise minimum of wires a and b in a and the maximum in b
+	void (*compare_exchange)(uint8_t* wires, const uint8_t* pairs, int count);
+	// the Sobel, or with scharr the Scharr, gradient of the centre row:
+	// magnitude |gx| + |gy|, or the rounded Euclidean length with l2, and
+	// direction 0 (within 22.5 degrees of horizontal), 1 (down and right),
+	// 2 (vertical) or 3 (down and left); the rows are read from -1 to width
+	void (*gradient_row)(uint16_t* magnitude, uint8_t* direction, const uint8_t* above, const uint8_t* centre,
+		const uint8_t* below, int width, bool scharr, bool l2);
+};
+
+const PixelKernels& pixel_kernels();
+// nullptr for a level the CPU lacks
+const PixelKernels* pixel_kernels_for(IsaLevel level);
+
+// Runs every level the CPU supports against the scalar table on random rows
+// of awkward widths, printing each mismatch to std::cerr. Returns the number
+// of kernels that disagree.
+int validate_pixel_kernels();
+
+#endif
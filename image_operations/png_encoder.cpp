@@ -0,0 +1,351 @@
+#include "png_encoder.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <iostream>
+#include <utility>
+#include <vector>
+#include <zlib.h>
+
+#include "histogram.h"
+#include "profiler.h"
+#include "thread_pool.h"
+
+namespace {
+
+PngOptions current_options;
+
+// libpng's filter heuristic: each byte taken as signed, so 255 costs 1
+uint32_t filter_cost(const uint8_t* bytes, size_t count) {
+	uint32_t sum = 0;
+	for (size_t x = 0; x < count; ++x) {
+		uint8_t value = bytes[x];
+		uint8_t negated = static_cast<uint8_t>(-value);
+		sum += value < negated ? value : negated;
+	}
+	return sum;
+}
+
+// The loops only read the unfiltered rows, so every byte is independent and
+// GCC vectorizes them; the first bpp bytes have no left neighbour.
+void filter_row(PngFilter filter, uint8_t* out, const uint8_t* row, const uint8_t* prior, size_t count, size_t bpp) {
+	size_t head = std::min(bpp, count);
+	switch (filter) {
+	case PngFilter::sub:
+		std::memcpy(out, row, head);
+		for (size_t x = head; x < count; ++x)
+			out[x] = static_cast<uint8_t>(row[x] - row[x - bpp]);
+		break;
+	case PngFilter::up:
+		for (size_t x = 0; x < count; ++x)
+			out[x] = static_cast<uint8_t>(row[x] - prior[x]);
+		break;
+	case PngFilter::average:
+		for (size_t x = 0; x < head; ++x)
+			out[x] = static_cast<uint8_t>(row[x] - (prior[x] >> 1));
+		for (size_t x = head; x < count; ++x)
+			out[x] = static_cast<uint8_t>(row[x] - ((row[x - bpp] + prior[x]) >> 1));
+		break;
+	case PngFilter::paeth:
+		for (size_t x = 0; x < head; ++x)
+			out[x] = static_cast<uint8_t>(row[x] - prior[x]);
+		for (size_t x = head; x < count; ++x) {
+			int a = row[x - bpp];
+			int b = prior[x];
+			int c = prior[x - bpp];
+			int pa = std::abs(b - c);
+			int pb = std::abs(a - c);
+			int pc = std::abs(a + b - 2 * c);
+			int predicted = pa <= pb && pa <= pc ? a : (pb <= pc ? b : c);
+			out[x] = static_cast<uint8_t>(row[x] - predicted);
+		}
+		break;
+	default:
+		std::memcpy(out, row, count);
+		break;
+	}
+}
+
+// out[0] is the filter type and out[1..count] the filtered bytes
+void filter_png_row(PngFilter filter, uint8_t* out, const uint8_t* row, const uint8_t* prior, size_t count, size_t bpp,
+	std::vector<uint8_t>& candidate)
+{
+	if (filter != PngFilter::adaptive) {
+		out[0] = static_cast<uint8_t>(filter);
+		filter_row(filter, out + 1, row, prior, count, bpp);
+		return;
+	}
+	out[0] = 0;
+	std::memcpy(out + 1, row, count);
+	uint32_t best = filter_cost(row, count);
+	for (PngFilter other : {PngFilter::sub, PngFilter::up, PngFilter::average, PngFilter::paeth}) {
+		filter_row(other, candidate.data(), row, prior, count, bpp);
+		uint32_t cost = filter_cost(candidate.data(), count);
+		if (cost < best) {
+			best = cost;
+			out[0] = static_cast<uint8_t>(other);
+			std::memcpy(out + 1, candidate.data(), count);
+		}
+	}
+}
+
+// eight pixels a byte, the first in the high bit, nonzero as 1
+void pack_bits(uint8_t* out, const uint8_t* row, int width) {
+	int whole = width / 8;
+	for (int j = 0; j < whole; ++j) {
+		const uint8_t* pixels = row + 8 * j;
+		uint8_t bits = 0;
+		for (int i = 0; i < 8; ++i)
+			bits = static_cast<uint8_t>(bits | ((pixels[i] != 0) << (7 - i)));
+		out[j] = bits;
+	}
+	if (whole * 8 < width) {
+		uint8_t bits = 0;
+		for (int i = 0; whole * 8 + i < width; ++i)
+			bits = static_cast<uint8_t>(bits | ((row[whole * 8 + i] != 0) << (7 - i)));
+		out[whole] = bits;
+	}
+}
+
+// only 0 and 255, which 1-bit gray reads back as unchanged
+bool display_valued(const Image8& image) {
+	Histogram histogram;
+	grayscale_histogram(histogram, image);
+	for (int value = 1; value < 255; ++value)
+		if (histogram.count[value] != 0)
+			return false;
+	return true;
+}
+
+int color_channels(png_byte color_type) {
+	switch (color_type) {
+	case PNG_COLOR_TYPE_GRAY:
+		return 1;
+	case PNG_COLOR_TYPE_GRAY_ALPHA:
+		return 2;
+	case PNG_COLOR_TYPE_RGB:
+		return 3;
+	case PNG_COLOR_TYPE_RGB_ALPHA:
+		return 4;
+	}
+	return 0;
+}
+
+void put_u32(uint8_t* out, uint32_t value) {
+	out[0] = static_cast<uint8_t>(value >> 24);
+	out[1] = static_cast<uint8_t>(value >> 16);
+	out[2] = static_cast<uint8_t>(value >> 8);
+	out[3] = static_cast<uint8_t>(value);
+}
+
+// a chunk whose data is the parts in order
+bool write_chunk(FILE* file, const char* type, std::initializer_list<std::pair<const uint8_t*, size_t>> parts) {
+	size_t length = 0;
+	for (const auto& part : parts)
+		length += part.second;
+	uint8_t header[8];
+	put_u32(header, static_cast<uint32_t>(length));
+	std::memcpy(header + 4, type, 4);
+	uLong crc = crc32(0L, header + 4, 4);
+	bool written = std::fwrite(header, 1, 8, file) == 8;
+	for (const auto& part : parts) {
+		if (part.second == 0)
+			continue;
+		crc = crc32(crc, part.first, static_cast<uInt>(part.second));
+		written = written && std::fwrite(part.first, 1, part.second, file) == part.second;
+	}
+	uint8_t trailer[4];
+	put_u32(trailer, static_cast<uint32_t>(crc));
+	return written && std::fwrite(trailer, 1, 4, file) == 4;
+}
+
+struct Strip {
+	int begin;
+	int end;
+	std::vector<uint8_t> deflated;
+	uLong adler;
+	bool failed;
+};
+
+}
+
+bool parse_png_preset(const std::string& name, PngOptions& options) {
+	PngOptions preset;
+	if (name == "fast") {
+		preset.level = 1;
+		preset.filter = PngFilter::none;
+		preset.run_length = true;
+		preset.one_bit = true;
+	} else if (name == "small") {
+		preset.level = 9;
+	} else if (name != "default") {
+		return false;
+	}
+	options = preset;
+	return true;
+}
+
+bool parse_png_filter(const std::string& name, PngFilter& filter) {
+	const char* names[] = {"none", "sub", "up", "average", "paeth", "adaptive"};
+	for (int index = 0; index < 6; ++index) {
+		if (name == names[index]) {
+			filter = static_cast<PngFilter>(index);
+			return true;
+		}
+	}
+	return false;
+}
+
+void set_png_options(const PngOptions& options) {
+	current_options = options;
+}
+
+const PngOptions& png_options() {
+	return current_options;
+}
+
+bool png_encoder_supports(png_byte color_type, png_byte bit_depth, const Image8& image) {
+	int channels = color_channels(color_type);
+	return channels > 0 && (bit_depth == 8 || bit_depth == 16) && !image.empty()
+		&& image.row_bytes() == static_cast<size_t>(image.width()) * channels * (bit_depth / 8);
+}
+
+int write_png_parallel(const char* file_name, png_byte color_type, png_byte bit_depth, const Image8& image,
+	const PngOptions& options)
+{
+	ProfileScope scope("write_png_parallel", static_cast<size_t>(image.width()) * image.height(), image.row_bytes() * image.height());
+	int width = image.width();
+	int height = image.height();
+	bool one_bit = options.one_bit && color_type == PNG_COLOR_TYPE_GRAY && bit_depth == 8 && display_valued(image);
+	size_t row_bytes = one_bit ? (width + 7) / 8 : image.row_bytes();
+	size_t bpp = one_bit ? 1 : std::max<size_t>(1, image.row_bytes() / width);
+	PngFilter filter = options.filter;
+	int level = std::max(0, std::min(9, options.level));
+
+	int strip_rows = options.strip_rows > 0 ? options.strip_rows : static_cast<int>(std::max<size_t>(1, (256 << 10) / (row_bytes + 1)));
+	int strip_count = (height + strip_rows - 1) / strip_rows;
+	std::vector<Strip> strips(strip_count);
+	for (int index = 0; index < strip_count; ++index) {
+		strips[index].begin = index * strip_rows;
+		strips[index].end = std::min(height, (index + 1) * strip_rows);
+		strips[index].failed = false;
+	}
+
+	// every row filtered, with its filter type byte, as the zlib stream holds them
+	size_t filtered_pitch = row_bytes + 1;
+	std::vector<uint8_t> filtered(filtered_pitch * height);
+	default_thread_pool().parallel_for(0, strip_count, 1, [&](int begin, int end) {
+		std::vector<uint8_t> zeros(row_bytes, 0), candidate(row_bytes), packed(one_bit ? row_bytes : 0), packed_prior(packed.size());
+		for (int index = begin; index < end; ++index) {
+			const Strip& strip = strips[index];
+			if (one_bit && strip.begin > 0)
+				pack_bits(packed_prior.data(), image[strip.begin - 1], width);
+			for (int y = strip.begin; y < strip.end; ++y) {
+				const uint8_t* row = image[y];
+				const uint8_t* prior = y > 0 ? image[y - 1] : zeros.data();
+				if (one_bit) {
+					pack_bits(packed.data(), row, width);
+					row = packed.data();
+					prior = y > 0 ? packed_prior.data() : zeros.data();
+				}
+				filter_png_row(filter, &filtered[filtered_pitch * y], row, prior, row_bytes, bpp, candidate);
+				if (one_bit)
+					packed.swap(packed_prior);
+			}
+		}
+	});
+
+	// libpng deflates filtered rows with Z_FILTERED
+	int strategy = options.run_length ? Z_RLE : (filter == PngFilter::none ? Z_DEFAULT_STRATEGY : Z_FILTERED);
+	default_thread_pool().parallel_for(0, strip_count, 1, [&](int begin, int end) {
+		for (int index = begin; index < end; ++index) {
+			Strip& strip = strips[index];
+			const uint8_t* input = &filtered[filtered_pitch * strip.begin];
+			size_t length = filtered_pitch * (strip.end - strip.begin);
+			strip.adler = adler32(adler32(0L, Z_NULL, 0), input, static_cast<uInt>(length));
+
+			z_stream stream;
+			std::memset(&stream, 0, sizeof(stream));
+			if (deflateInit2(&stream, level, Z_DEFLATED, -15, 8, strategy) != Z_OK) {
+				strip.failed = true;
+				continue;
+			}
+			// the window the previous strip leaves, so strips compress almost as well as one stream
+			size_t before = filtered_pitch * strip.begin;
+			if (before > 0) {
+				size_t dictionary = std::min<size_t>(before, 32768);
+				deflateSetDictionary(&stream, input - dictionary, static_cast<uInt>(dictionary));
+			}
+			bool last = index == strip_count - 1;
+			int flush = last ? Z_FINISH : Z_SYNC_FLUSH;
+			stream.next_in = const_cast<Bytef*>(input);
+			stream.avail_in = static_cast<uInt>(length);
+			strip.deflated.resize(deflateBound(&stream, static_cast<uLong>(length)) + 16);
+			size_t used = 0;
+			while (true) {
+				if (used == strip.deflated.size())
+					strip.deflated.resize(2 * strip.deflated.size());
+				stream.next_out = strip.deflated.data() + used;
+				stream.avail_out = static_cast<uInt>(strip.deflated.size() - used);
+				int result = deflate(&stream, flush);
+				used = strip.deflated.size() - stream.avail_out;
+				if (result == Z_STREAM_END || (!last && result == Z_OK && stream.avail_out > 0))
+					break;
+				if (result != Z_OK && result != Z_BUF_ERROR) {
+					strip.failed = true;
+					break;
+				}
+			}
+			strip.deflated.resize(used);
+			deflateEnd(&stream);
+		}
+	});
+	for (const Strip& strip : strips) {
+		if (strip.failed) {
+			std::cerr << "[write_png_parallel] Deflating " << file_name << " failed" << std::endl;
+			return 6;
+		}
+	}
+
+	// the zlib header for the level, as zlib writes it, and the Adler-32 of
+	// the whole stream from those of the strips
+	uint8_t zlib_header[2] = {0x78, static_cast<uint8_t>((level < 2 ? 0 : (level < 6 ? 1 : (level == 6 ? 2 : 3))) << 6)};
+	zlib_header[1] = static_cast<uint8_t>(zlib_header[1] + 31 - (zlib_header[0] * 256 + zlib_header[1]) % 31);
+	uLong adler = strips[0].adler;
+	for (int index = 1; index < strip_count; ++index)
+		adler = adler32_combine(adler, strips[index].adler, static_cast<z_off_t>(filtered_pitch * (strips[index].end - strips[index].begin)));
+	uint8_t zlib_trailer[4];
+	put_u32(zlib_trailer, static_cast<uint32_t>(adler));
+
+	FILE* file = std::fopen(file_name, "wb");
+	if (!file) {
+		std::cerr << "[write_png_parallel] File " << file_name << " could not be opened for writing" << std::endl;
+		return 1;
+	}
+	static const uint8_t signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+	uint8_t ihdr[13];
+	put_u32(ihdr, static_cast<uint32_t>(width));
+	put_u32(ihdr + 4, static_cast<uint32_t>(height));
+	ihdr[8] = one_bit ? 1 : bit_depth;
+	ihdr[9] = one_bit ? PNG_COLOR_TYPE_GRAY : color_type;
+	ihdr[10] = 0;
+	ihdr[11] = 0;
+	ihdr[12] = 0;
+	bool written = std::fwrite(signature, 1, 8, file) == 8 && write_chunk(file, "IHDR", {{ihdr, 13}});
+	for (int index = 0; written && index < strip_count; ++index) {
+		const Strip& strip = strips[index];
+		written = write_chunk(file, "IDAT", {
+			{zlib_header, index == 0 ? 2u : 0u},
+			{strip.deflated.data(), strip.deflated.size()},
+			{zlib_trailer, index == strip_count - 1 ? 4u : 0u}});
+	}
+	written = written && write_chunk(file, "IEND", {});
+	if (std::fclose(file) != 0 || !written) {
+		std::cerr << "[write_png_parallel] Writing " << file_name << " failed" << std::endl;
+		return 7;
+	}
+	return 0;
+}
@@ -0,0 +1,57 @@
+#ifndef PNG_ENCODER_H
+#define PNG_ENCODER_H
+
+#include <string>
+
+#include "image.h"
+#include "png_io.h"
+
+// The per-row filters of PNG; adaptive tries all five on every row and keeps
+// the one with the smallest sum of absolute differences, as libpng does.
+enum class PngFilter {
+	none,
+	sub,
+	up,
+	average,
+	paeth,
+	adaptive
+};
+
+struct PngOptions {
+	// zlib's 0 (stored) to 9
+	int level = 6;
+	PngFilter filter = PngFilter::adaptive;
+	// zlib's run-length strategy, which suits images of long flat runs
+	bool run_length = false;
+	// gray images of only 0 and 255 go out as 1-bit; any other values keep
+	// the image at 8 bits
+	bool one_bit = false;
+	// rows per independently deflated strip; 0 picks about 256 KB of rows
+	int strip_rows = 0;
+};
+
+// "default" is libpng's level 6 with adaptive filters, "small" level 9 and
+// "fast" level 1 run-length deflate of unfiltered rows with 1-bit output,
+// for bit_display masks and other mostly flat images
+bool parse_png_preset(const std::string& name, PngOptions& options);
+// none, sub, up, average, paeth or adaptive
+bool parse_png_filter(const std::string& name, PngFilter& filter);
+
+// What write_png_file encodes with; set at startup, before any writes.
+void set_png_options(const PngOptions& options);
+const PngOptions& png_options();
+
+// 8 and 16-bit gray, gray alpha, RGB and RGBA whose rows hold exactly the
+// samples of one PNG row; palettes and lower depths go through libpng
+bool png_encoder_supports(png_byte color_type, png_byte bit_depth, const Image8& image);
+
+// Filters the rows, then deflates strips of them on the default pool, pigz
+// style: every strip is a raw deflate stream primed with the 32 KB before
+// it and ended by a sync flush, so the strips concatenate into one zlib
+// stream, whose Adler-32 is combined from theirs. Each strip goes out as
+// its own IDAT chunk. Returns 0 on success, 1 if the file cannot be opened,
+// 6 if deflate fails and 7 if writing fails.
+int write_png_parallel(const char* file_name, png_byte color_type, png_byte bit_depth, const Image8& image,
+	const PngOptions& options);
+
+#endif
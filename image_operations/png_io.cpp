@@ -0,0 +1,223 @@
+#include "png_io.h"
+
+#include <iostream>
+
+#include "png_encoder.h"
+#include "profiler.h"
+
+std::vector<png_bytep> image_row_pointers(const Image8& image) {
+	// libpng takes non-const row pointers even when it only reads from them
+	std::vector<png_bytep> row_pointers(image.height());
+	for (int y = 0; y < image.height(); ++y)
+		row_pointers[y] = const_cast<png_bytep>(image[y]);
+	return row_pointers;
+}
+
+int read_png_file(
+	const char* filename,
+	int& width,
+	int& height,
+	png_byte& color_type,
+	png_byte& bit_depth,
+	int& number_of_passes,
+	int& stride,
+	Image8& image)
+{
+	ProfileScope scope("read_png_file");
+	// open file and test for it being a png
+	FILE *fp = fopen(filename, "rb");
+	if (!fp) {
+		std::cerr << "[read_png_file] File " << filename << " could not be opened for reading" << std::endl;
+		return 1;
+	}
+	char header[8];
+	fread(header, 1, 8, fp);
+	if (png_sig_cmp(reinterpret_cast<unsigned char*>(header), 0, 8)) {
+		std::cerr << "[read_png_file] File " << filename << " is not recognized as a PNG file" << std::endl;
+		fclose(fp);
+		return 2;
+	}
+
+	// initialize stuff
+	png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+
+	if (!png_ptr) {
+		std::cerr << "[read_png_file] png_create_read_struct failed" << std::endl;
+		fclose(fp);
+		return 4;
+	}
+
+	png_infop info_ptr = png_create_info_struct(png_ptr);
+	if (!info_ptr)
+	{
+		std::cerr << "[read_png_file] png_create_info_struct failed" << std::endl;
+		png_destroy_read_struct(&png_ptr, NULL, NULL);
+		fclose(fp);
+		return 5;
+	}
+
+	if (setjmp(png_jmpbuf(png_ptr)))
+	{
+		std::cerr << "[read_png_file] Error during init_io" << std::endl;
+		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+		fclose(fp);
+		return 6;
+	}
+
+
+	png_init_io(png_ptr, fp);
+	png_set_sig_bytes(png_ptr, 8);
+
+	png_read_info(png_ptr, info_ptr);
+
+	width = png_get_image_width(png_ptr, info_ptr);
+	height = png_get_image_height(png_ptr, info_ptr);
+	color_type = png_get_color_type(png_ptr, info_ptr);
+
+	number_of_passes = png_set_interlace_handling(png_ptr);
+	if (color_type == PNG_COLOR_TYPE_PALETTE) {
+		png_set_palette_to_rgb(png_ptr);
+	} else if (png_get_bit_depth(png_ptr, info_ptr) < 8) {
+		png_set_expand_gray_1_2_4_to_8(png_ptr);
+	}
+	png_read_update_info(png_ptr, info_ptr);
+	bit_depth = png_get_bit_depth(png_ptr, info_ptr);
+
+	// declared before the setjmp, so the error return below destroys it
+	std::vector<png_bytep> row_pointers;
+
+	// read file
+	if (setjmp(png_jmpbuf(png_ptr)))
+	{
+		std::cerr << "[read_png_file] Error during read_png_file" << std::endl;
+		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+		fclose(fp);
+		return 7;
+	}
+
+	// one contiguous plane; samples deeper than 8 bits stay as big-endian byte pairs
+	int pixel_bytes = (png_get_channels(png_ptr, info_ptr) * bit_depth + 7) / 8;
+	image.resize(width, height, pixel_bytes);
+	row_pointers = image_row_pointers(image);
+
+	scope.set_work(static_cast<size_t>(width) * height, image.row_bytes() * height);
+	png_read_image(png_ptr, row_pointers.data());
+
+	stride = png_get_channels(png_ptr, info_ptr);
+
+	png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+	fclose(fp);
+
+
+	return 0;
+}
+
+int write_png_file(
+	const char* file_name,
+	png_byte color_type,
+	png_byte bit_depth,
+	const Image8& image)
+{
+	if (png_encoder_supports(color_type, bit_depth, image)) {
+		return write_png_parallel(file_name, color_type, bit_depth, image, png_options());
+	}
+	ProfileScope scope("write_png_file", static_cast<size_t>(image.width()) * image.height(), image.row_bytes() * image.height());
+	// create file
+	FILE *fp = fopen(file_name, "wb");
+	if (!fp) {
+		std::cerr << "[write_png_file] File " << file_name << " could not be opened for writing" << std::endl;
+		return 1;
+	}
+
+	// initialize stuff
+	png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+
+	if (!png_ptr)
+	{
+		std::cerr << "[write_png_file] png_create_write_struct failed" << std::endl;
+		fclose(fp);
+		return 2;
+	}
+
+	png_infop info_ptr = png_create_info_struct(png_ptr);
+	if (!info_ptr)
+	{
+		std::cerr << "[write_png_file] png_create_info_struct failed" << std::endl;
+		png_destroy_write_struct(&png_ptr, NULL);
+		fclose(fp);
+		return 3;
+	}
+
+	if (setjmp(png_jmpbuf(png_ptr)))
+	{
+		std::cerr << "[write_png_file] Error during init_io" << std::endl;
+		png_destroy_write_struct(&png_ptr, &info_ptr);
+		fclose(fp);
+		return 4;
+	}
+
+	png_init_io(png_ptr, fp);
+
+
+	// write header
+	if (setjmp(png_jmpbuf(png_ptr)))
+	{
+		std::cerr << "[write_png_file] Error during writing header" << std::endl;
+		png_destroy_write_struct(&png_ptr, &info_ptr);
+		fclose(fp);
+		return 5;
+	}
+
+	png_set_IHDR(png_ptr, info_ptr, image.width(), image.height(),
+			bit_depth, color_type, PNG_INTERLACE_NONE,
+			PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+
+	png_write_info(png_ptr, info_ptr);
+
+	// declared before the setjmp, so the error returns below destroy it
+	std::vector<png_bytep> row_pointers;
+
+	// write bytes
+	if (setjmp(png_jmpbuf(png_ptr)))
+	{
+		std::cerr << "[write_png_file] Error during writing bytes" << std::endl;
+		png_destroy_write_struct(&png_ptr, &info_ptr);
+		fclose(fp);
+		return 6;
+	}
+
+	row_pointers = image_row_pointers(image);
+	png_write_image(png_ptr, row_pointers.data());
+
+
+	// end write
+	if (setjmp(png_jmpbuf(png_ptr)))
+	{
+		std::cerr << "[write_png_file] Error during end of write" << std::endl;
+		png_destroy_write_struct(&png_ptr, &info_ptr);
+		fclose(fp);
+		return 7;
+	}
+
+	png_write_end(png_ptr, NULL);
+	png_destroy_write_struct(&png_ptr, &info_ptr);
+
+	fclose(fp);
+	return 0;
+}
+
+const char* color_type_name(png_byte color_type) {
+	switch (color_type) {
+	case PNG_COLOR_TYPE_PALETTE:
+		return "Palette";
+	case PNG_COLOR_TYPE_RGB:
+		return "RGB";
+	case PNG_COLOR_TYPE_RGBA:
+		return "RGBA";
+	case PNG_COLOR_TYPE_GRAY_ALPHA:
+		return "Gray alpha";
+	case PNG_COLOR_TYPE_GRAY:
+		return "Gray";
+	}
+	return "Unknown";
+}
@@ -0,0 +1,41 @@
+#ifndef PNG_IO_H
+#define PNG_IO_H
+
+#include <vector>
+
+#include "image.h"
+
+extern "C"
+{
+	#include <png.h>
+}
+
+std::vector<png_bytep> image_row_pointers(const Image8& image);
+
+// Decodes a whole PNG into image, one row per image row with channels() bytes
+// per pixel. stride is the number of samples per pixel and bit_depth their
+// size, 8 or 16: palette and 1, 2 and 4-bit gray images are expanded to
+// 8-bit samples. Returns 0 on success.
+// Every failure releases the file and the libpng state, so batches can carry
+// on past a bad file.
+int read_png_file(
+	const char* filename,
+	int& width,
+	int& height,
+	png_byte& color_type,
+	png_byte& bit_depth,
+	int& number_of_passes,
+	int& stride,
+	Image8& image);
+
+// Encodes with write_png_parallel and png_options() when it supports the
+// format, else with libpng's defaults. Returns 0 on success.
+int write_png_file(
+	const char* file_name,
+	png_byte color_type,
+	png_byte bit_depth,
+	const Image8& image);
+
+const char* color_type_name(png_byte color_type);
+
+#endif
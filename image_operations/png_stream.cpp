@@ -0,0 +1,224 @@
+#include "png_stream.h"
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include <zlib.h>
+
+#include "png_encoder.h"
+#include "png_io.h"
+#include "profiler.h"
+
+namespace {
+
+// png_set_filter's mask for one of our filters
+int png_filter_mask(PngFilter filter) {
+	switch (filter) {
+	case PngFilter::none:
+		return PNG_FILTER_NONE;
+	case PngFilter::sub:
+		return PNG_FILTER_SUB;
+	case PngFilter::up:
+		return PNG_FILTER_UP;
+	case PngFilter::average:
+		return PNG_FILTER_AVG;
+	case PngFilter::paeth:
+		return PNG_FILTER_PAETH;
+	case PngFilter::adaptive:
+		break;
+	}
+	return PNG_ALL_FILTERS;
+}
+
+// png_write_end behind a setjmp of its own, so no local of the caller is
+// live across the longjmp
+int end_png_write(png_structp png) {
+	if (setjmp(png_jmpbuf(png))) {
+		std::cerr << "[PngRowWriter::close] Error during end of write" << std::endl;
+		return 7;
+	}
+	png_write_end(png, NULL);
+	return 0;
+}
+
+}
+
+PngRowReader::~PngRowReader() {
+	if (png_)
+		png_destroy_read_struct(&png_, &info_, NULL);
+	if (file_)
+		fclose(file_);
+}
+
+int PngRowReader::open(const char* filename) {
+	file_ = fopen(filename, "rb");
+	if (!file_) {
+		std::cerr << "[PngRowReader::open] File " << filename << " could not be opened for reading" << std::endl;
+		return 1;
+	}
+	unsigned char header[8];
+	if (fread(header, 1, 8, file_) != 8 || png_sig_cmp(header, 0, 8)) {
+		std::cerr << "[PngRowReader::open] File " << filename << " is not recognized as a PNG file" << std::endl;
+		return 2;
+	}
+
+	png_ = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	if (!png_) {
+		std::cerr << "[PngRowReader::open] png_create_read_struct failed" << std::endl;
+		return 4;
+	}
+	info_ = png_create_info_struct(png_);
+	if (!info_) {
+		std::cerr << "[PngRowReader::open] png_create_info_struct failed" << std::endl;
+		return 5;
+	}
+	if (setjmp(png_jmpbuf(png_))) {
+		std::cerr << "[PngRowReader::open] Error during init_io" << std::endl;
+		return 6;
+	}
+
+	png_init_io(png_, file_);
+	png_set_sig_bytes(png_, 8);
+	png_read_info(png_, info_);
+
+	width_ = png_get_image_width(png_, info_);
+	height_ = png_get_image_height(png_, info_);
+	color_type_ = png_get_color_type(png_, info_);
+	if (png_set_interlace_handling(png_) != 1) {
+		return 8;
+	}
+	if (color_type_ == PNG_COLOR_TYPE_PALETTE) {
+		png_set_palette_to_rgb(png_);
+	} else if (png_get_bit_depth(png_, info_) < 8) {
+		png_set_expand_gray_1_2_4_to_8(png_);
+	}
+	png_read_update_info(png_, info_);
+	bit_depth_ = png_get_bit_depth(png_, info_);
+	channels_ = png_get_channels(png_, info_);
+	pixel_bytes_ = (channels_ * bit_depth_ + 7) / 8;
+	return 0;
+}
+
+int PngRowReader::read_row(png_bytep row) {
+	if (setjmp(png_jmpbuf(png_))) {
+		std::cerr << "[PngRowReader::read_row] Error during read_row" << std::endl;
+		return 7;
+	}
+	png_read_row(png_, row, NULL);
+	return 0;
+}
+
+int read_png_gray(
+	const char* filename,
+	int& width,
+	int& height,
+	png_byte& color_type,
+	png_byte& bit_depth,
+	int& number_of_passes,
+	int& stride,
+	GrayWeights weights,
+	Image8& gray)
+{
+	ProfileScope scope("read_png_gray");
+	PngRowReader reader;
+	int result = reader.open(filename);
+	if (result == 8) {
+		Image8 decoded;
+		result = read_png_file(filename, width, height, color_type, bit_depth, number_of_passes, stride, decoded);
+		if (result != 0) {
+			return result;
+		}
+		gray.resize(width, height);
+		for (int y = 0; y < height; ++y) {
+			gray_row(gray[y], decoded[y], width, stride, bit_depth, weights);
+		}
+		return 0;
+	}
+	if (result != 0) {
+		return result;
+	}
+
+	width = reader.width();
+	height = reader.height();
+	color_type = reader.color_type();
+	bit_depth = reader.bit_depth();
+	number_of_passes = 1;
+	stride = reader.channels();
+	gray.resize(width, height);
+	scope.set_work(static_cast<size_t>(width) * height, (reader.row_bytes() + gray.row_bytes()) * height);
+	std::vector<png_byte> row(reader.row_bytes());
+	for (int y = 0; y < height; ++y) {
+		result = reader.read_row(row.data());
+		if (result != 0) {
+			return result;
+		}
+		gray_row(gray[y], row.data(), width, stride, bit_depth, weights);
+	}
+	return 0;
+}
+
+PngRowWriter::~PngRowWriter() {
+	close();
+}
+
+int PngRowWriter::open(const char* filename, int width, int height, png_byte color_type, png_byte bit_depth) {
+	file_ = fopen(filename, "wb");
+	if (!file_) {
+		std::cerr << "[PngRowWriter::open] File " << filename << " could not be opened for writing" << std::endl;
+		return 1;
+	}
+	png_ = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	if (!png_) {
+		std::cerr << "[PngRowWriter::open] png_create_write_struct failed" << std::endl;
+		return 2;
+	}
+	info_ = png_create_info_struct(png_);
+	if (!info_) {
+		std::cerr << "[PngRowWriter::open] png_create_info_struct failed" << std::endl;
+		return 3;
+	}
+	if (setjmp(png_jmpbuf(png_))) {
+		std::cerr << "[PngRowWriter::open] Error during writing header" << std::endl;
+		return 5;
+	}
+
+	png_init_io(png_, file_);
+	// the level, filter and strategy write_png_parallel would use; rows
+	// stay at their own depth, as 1-bit output needs the whole image
+	const PngOptions& options = png_options();
+	png_set_compression_level(png_, std::max(0, std::min(9, options.level)));
+	png_set_filter(png_, PNG_FILTER_TYPE_BASE, png_filter_mask(options.filter));
+	png_set_compression_strategy(png_, options.run_length ? Z_RLE : (options.filter == PngFilter::none ? Z_DEFAULT_STRATEGY : Z_FILTERED));
+	png_set_IHDR(png_, info_, width, height,
+			bit_depth, color_type, PNG_INTERLACE_NONE,
+			PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+	png_write_info(png_, info_);
+	writing_ = true;
+	return 0;
+}
+
+int PngRowWriter::write_row(png_const_bytep row) {
+	if (setjmp(png_jmpbuf(png_))) {
+		std::cerr << "[PngRowWriter::write_row] Error during writing bytes" << std::endl;
+		writing_ = false;
+		return 6;
+	}
+	png_write_row(png_, row);
+	return 0;
+}
+
+int PngRowWriter::close() {
+	int result = 0;
+	if (png_) {
+		if (writing_)
+			result = end_png_write(png_);
+		writing_ = false;
+		png_destroy_write_struct(&png_, &info_);
+	}
+	if (file_) {
+		fclose(file_);
+		file_ = nullptr;
+	}
+	return result;
+}
@@ -0,0 +1,86 @@
+#ifndef PNG_STREAM_H
+#define PNG_STREAM_H
+
+#include <cstdio>
+
+#include "gray_conversion.h"
+#include "image.h"
+
+extern "C"
+{
+	#include <png.h>
+}
+
+// Decodes a PNG one row at a time with png_read_row instead of holding the
+// whole image. Interlaced files need every pass before any row is final, so
+// open refuses them and they go through read_png_file instead. Palette and
+// 1, 2 and 4-bit gray images are expanded to 8-bit samples.
+class PngRowReader {
+public:
+	~PngRowReader();
+
+	// 0 on success, 8 without a message for an interlaced file, otherwise
+	// the same codes as read_png_file
+	int open(const char* filename);
+	// 0 on success; row must hold row_bytes()
+	int read_row(png_bytep row);
+
+	int width() const { return width_; }
+	int height() const { return height_; }
+	png_byte color_type() const { return color_type_; }
+	// of the decoded samples: 8 or 16
+	png_byte bit_depth() const { return bit_depth_; }
+	// bytes per pixel, as Image8::channels() after read_png_file
+	int pixel_bytes() const { return pixel_bytes_; }
+	// samples per pixel
+	int channels() const { return channels_; }
+	size_t row_bytes() const { return static_cast<size_t>(width_) * pixel_bytes_; }
+
+private:
+	FILE* file_ = nullptr;
+	png_structp png_ = nullptr;
+	png_infop info_ = nullptr;
+	int width_ = 0;
+	int height_ = 0;
+	png_byte color_type_ = 0;
+	png_byte bit_depth_ = 0;
+	int pixel_bytes_ = 0;
+	int channels_ = 0;
+};
+
+// read_png_file followed by the grayscale conversion, but each row is
+// converted as soon as it is decoded, while it is still in cache, instead of
+// in a second pass over the whole decoded frame. Interlaced files are
+// decoded whole first. Returns 0 on success or read_png_file's codes.
+int read_png_gray(
+	const char* filename,
+	int& width,
+	int& height,
+	png_byte& color_type,
+	png_byte& bit_depth,
+	int& number_of_passes,
+	int& stride,
+	GrayWeights weights,
+	Image8& gray);
+
+// Encodes a PNG one row at a time with png_write_row, so a row can be
+// written as soon as it is final.
+class PngRowWriter {
+public:
+	~PngRowWriter();
+
+	// 0 on success, otherwise the same codes as write_png_file
+	int open(const char* filename, int width, int height, png_byte color_type, png_byte bit_depth);
+	int write_row(png_const_bytep row);
+	// writes the end of the file; called by the destructor if need be
+	int close();
+
+private:
+	FILE* file_ = nullptr;
+	png_structp png_ = nullptr;
+	png_infop info_ = nullptr;
+	// the header is out and no write has failed, so the file can be finished
+	bool writing_ = false;
+};
+
+#endif
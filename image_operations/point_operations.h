@@ -0,0 +1,179 @@
+#ifndef POINT_OPERATIONS_H
+#define POINT_OPERATIONS_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "image.h"
+#include "pixel_kernels.h"
+#include "profiler.h"
+#include "thread_pool.h"
+
+inline int grayscale_copy(int, int rhs) {
+	return rhs;
+}
+
+inline int grayscale_add(int lhs, int rhs) {
+	return lhs + rhs;
+}
+
+inline int grayscale_average(int lhs, int rhs) {
+	return (lhs + rhs) / 2;
+}
+
+// lhs moved 1/16 of the way to rhs, rounded
+inline int grayscale_learn_average(int lhs, int rhs) {
+	return (lhs * 15 + rhs + 8) / 16;
+}
+
+inline int grayscale_set(int, int alpha) {
+	return alpha;
+}
+
+inline int grayscale_brighten(int value, int beta) {
+	return value + beta;
+}
+
+inline int grayscale_stretch(int value, float gamma, int beta) {
+	return static_cast<int>(static_cast<float>(value) * gamma) + beta;
+}
+
+inline int grayscale_invert(int value) {
+	return 255 - value;
+}
+
+inline int grayscale_threshold(int value, int threshold) {
+	return value < threshold ? 0 : 1;
+}
+
+inline int grayscale_invert_threshold(int value, int threshold) {
+	return value < threshold ? 1 : 0;
+}
+
+inline int bit_display(int value) {
+	return value > 0 ? 255 : 0;
+}
+
+inline int bit_invert_display(int value) {
+	return value <= 0 ? 255 : 0;
+}
+
+inline int bit_not(int value) {
+	return !value;
+}
+
+inline int bit_invert(int value) {
+	return 1 - value;
+}
+
+inline int bit_and(int lhs, int rhs) {
+	return lhs && rhs;
+}
+
+inline uint8_t clamp_byte(int value) {
+	return static_cast<uint8_t>(value < 0 ? 0 : (value > 255 ? 255 : value));
+}
+
+// fn is taken by type rather than through std::function so that it inlines
+// into the row loop and the loop can be vectorized
+template <typename Fn>
+void single_channel_apply(Fn fn, Image8& image) {
+	size_t pixels = static_cast<size_t>(image.width()) * image.height();
+	ProfileScope scope("single_channel_apply", pixels, 2 * pixels);
+	parallel_rows(image.height(), [&image, fn](int begin, int end) {
+		// locals, since the byte stores could otherwise alias anything captured by reference
+		int width = image.width();
+		for (int y = begin; y < end; ++y) {
+			uint8_t* row = image[y];
+			for (int x = 0; x < width; ++x) {
+				row[x] = clamp_byte(fn(row[x]));
+			}
+		}
+	});
+}
+
+template <typename Fn>
+void single_channel_apply(Fn fn, Image8& lhs, const Image8& rhs) {
+	size_t pixels = static_cast<size_t>(lhs.width()) * lhs.height();
+	ProfileScope scope("single_channel_apply", pixels, 3 * pixels);
+	parallel_rows(lhs.height(), [&lhs, &rhs, fn](int begin, int end) {
+		int width = lhs.width();
+		for (int y = begin; y < end; ++y) {
+			uint8_t* lhs_row = lhs[y];
+			const uint8_t* rhs_row = rhs[y];
+			for (int x = 0; x < width; ++x) {
+				lhs_row[x] = clamp_byte(fn(lhs_row[x], rhs_row[x]));
+			}
+		}
+	});
+}
+
+// Any unary 8-bit point operation tabulated over all 256 inputs, clamped the
+// same way single_channel_apply clamps.
+struct PointLut {
+	uint8_t table[256];
+};
+
+template <typename Fn>
+PointLut make_point_lut(Fn fn) {
+	PointLut lut;
+	for (int value = 0; value < 256; ++value)
+		lut.table[value] = clamp_byte(fn(value));
+	return lut;
+}
+
+inline PointLut identity_point_lut() {
+	PointLut lut;
+	for (int value = 0; value < 256; ++value)
+		lut.table[value] = static_cast<uint8_t>(value);
+	return lut;
+}
+
+// Chains compose into one table: appending fn to lut gives a table equal to
+// running lut's pass followed by an fn pass, clamped in between as each
+// single_channel_apply pass would clamp.
+template <typename Fn>
+void append_point_operation(PointLut& lut, Fn fn) {
+	for (int value = 0; value < 256; ++value)
+		lut.table[value] = clamp_byte(fn(lut.table[value]));
+}
+
+inline void append_point_operation(PointLut& lut, const PointLut& next) {
+	for (int value = 0; value < 256; ++value)
+		lut.table[value] = next.table[lut.table[value]];
+}
+
+// each of fns in turn, left to right
+template <typename... Fns>
+void append_point_operations(PointLut& lut, Fns... fns) {
+	int in_order[] = {0, (append_point_operation(lut, fns), 0)...};
+	(void)in_order;
+}
+
+// e.g. make_point_chain(stretch, threshold, bit_display) runs as one pass
+template <typename... Fns>
+PointLut make_point_chain(Fns... fns) {
+	PointLut lut = identity_point_lut();
+	append_point_operations(lut, fns...);
+	return lut;
+}
+
+inline void apply_point_lut_row_scalar(const PointLut& lut, uint8_t* row, size_t count) {
+	for (size_t x = 0; x < count; ++x)
+		row[x] = lut.table[row[x]];
+}
+
+// pshufb lookups at the widest level the CPU supports
+inline void apply_point_lut_row(const PointLut& lut, uint8_t* row, size_t count) {
+	pixel_kernels().lut_row(lut.table, row, count);
+}
+
+inline void apply_point_lut(const PointLut& lut, Image8& image) {
+	ProfileScope scope("apply_point_lut", image.row_elements() * image.height(), 2 * image.row_elements() * image.height());
+	parallel_rows(image.height(), [&](int begin, int end) {
+		for (int y = begin; y < end; ++y)
+			apply_point_lut_row(lut, image[y], image.row_elements());
+	});
+}
+
+#endif
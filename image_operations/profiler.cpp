@@ -0,0 +1,346 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace profiler_detail {
+std::atomic<bool> enabled(false);
+}
+
+namespace {
+
+const int counter_count = 4;
+const char* const counter_names[counter_count] = {"cycles", "instructions", "cache_misses", "branch_misses"};
+const uint64_t counter_configs[counter_count] = {
+	PERF_COUNT_HW_CPU_CYCLES,
+	PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_CACHE_MISSES,
+	PERF_COUNT_HW_BRANCH_MISSES
+};
+
+struct ProfileRecord {
+	std::string name;
+	int thread;
+	int64_t start;
+	int64_t duration;
+	size_t pixels;
+	size_t bytes;
+	uint64_t allocations;
+	uint64_t allocated_bytes;
+	uint64_t counters[counter_count];
+	bool have_counters;
+};
+
+std::mutex records_mutex;
+std::vector<ProfileRecord> records;
+std::atomic<uint64_t> allocation_count(0);
+std::atomic<uint64_t> allocation_bytes(0);
+std::atomic<int> thread_indices(0);
+bool hardware_counters_wanted = false;
+const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+int64_t now_ns() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+// Counters follow a thread rather than the process, so each thread opens its
+// own the first time it runs a scope.
+struct ThreadState {
+	int index = -1;
+	int fds[counter_count] = {-1, -1, -1, -1};
+	bool tried = false;
+
+	~ThreadState() {
+		for (int fd : fds)
+			if (fd >= 0)
+				close(fd);
+	}
+
+	bool open_counters() {
+		if (tried)
+			return fds[0] >= 0;
+		tried = true;
+		for (int counter = 0; counter < counter_count; ++counter) {
+			perf_event_attr attributes;
+			std::memset(&attributes, 0, sizeof(attributes));
+			attributes.size = sizeof(attributes);
+			attributes.type = PERF_TYPE_HARDWARE;
+			attributes.config = counter_configs[counter];
+			attributes.exclude_kernel = 1;
+			attributes.exclude_hv = 1;
+			fds[counter] = static_cast<int>(syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0));
+			if (fds[counter] < 0) {
+				for (int opened = 0; opened < counter; ++opened) {
+					close(fds[opened]);
+					fds[opened] = -1;
+				}
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool read_counters(uint64_t values[counter_count]) {
+		for (int counter = 0; counter < counter_count; ++counter)
+			if (read(fds[counter], &values[counter], sizeof(uint64_t)) != sizeof(uint64_t))
+				return false;
+		return true;
+	}
+};
+
+thread_local ThreadState thread_state;
+
+int thread_index() {
+	if (thread_state.index < 0)
+		thread_state.index = thread_indices++;
+	return thread_state.index;
+}
+
+std::string json_string(const std::string& text) {
+	std::string quoted = "\"";
+	for (char character : text) {
+		if (character == '"' || character == '\\')
+			quoted += '\\';
+		if (static_cast<unsigned char>(character) >= 0x20)
+			quoted += character;
+	}
+	return quoted + "\"";
+}
+
+double per_second(double amount, int64_t nanoseconds) {
+	return nanoseconds > 0 ? amount * 1e9 / nanoseconds : 0.0;
+}
+
+void write_counters_json(FILE* file, const ProfileRecord& record) {
+	for (int counter = 0; counter < counter_count; ++counter) {
+		if (record.have_counters)
+			std::fprintf(file, ", \"%s\": %llu", counter_names[counter], static_cast<unsigned long long>(record.counters[counter]));
+		else
+			std::fprintf(file, ", \"%s\": null", counter_names[counter]);
+	}
+}
+
+int write_csv(FILE* file, const std::vector<ProfileRecord>& snapshot) {
+	std::fprintf(file, "name,thread,start_us,wall_us,pixels,pixels_per_second,bytes,allocations,allocated_bytes");
+	for (const char* name : counter_names)
+		std::fprintf(file, ",%s", name);
+	std::fprintf(file, "\n");
+	for (const ProfileRecord& record : snapshot) {
+		std::string name = record.name;
+		for (char& character : name)
+			if (character == ',' || character == '"')
+				character = ';';
+		std::fprintf(file, "%s,%d,%.3f,%.3f,%zu,%.0f,%zu,%llu,%llu", name.c_str(), record.thread,
+			record.start / 1e3, record.duration / 1e3, record.pixels, per_second(record.pixels, record.duration),
+			record.bytes, static_cast<unsigned long long>(record.allocations),
+			static_cast<unsigned long long>(record.allocated_bytes));
+		for (int counter = 0; counter < counter_count; ++counter) {
+			if (record.have_counters)
+				std::fprintf(file, ",%llu", static_cast<unsigned long long>(record.counters[counter]));
+			else
+				std::fprintf(file, ",");
+		}
+		std::fprintf(file, "\n");
+	}
+	return 0;
+}
+
+int write_json(FILE* file, const std::vector<ProfileRecord>& snapshot) {
+	std::fprintf(file, "{\n\t\"stages\": [");
+	for (size_t index = 0; index < snapshot.size(); ++index) {
+		const ProfileRecord& record = snapshot[index];
+		std::fprintf(file, "%s\n\t\t{\"name\": %s, \"thread\": %d, \"start_us\": %.3f, \"wall_us\": %.3f, "
+			"\"pixels\": %zu, \"pixels_per_second\": %.0f, \"bytes\": %zu, \"allocations\": %llu, \"allocated_bytes\": %llu",
+			index ? "," : "", json_string(record.name).c_str(), record.thread, record.start / 1e3, record.duration / 1e3,
+			record.pixels, per_second(record.pixels, record.duration), record.bytes,
+			static_cast<unsigned long long>(record.allocations), static_cast<unsigned long long>(record.allocated_bytes));
+		write_counters_json(file, record);
+		std::fprintf(file, "}");
+	}
+	std::fprintf(file, "\n\t],\n\t\"totals\": [");
+
+	// per stage name, in order of first appearance
+	std::vector<std::string> order;
+	std::map<std::string, ProfileRecord> totals;
+	std::map<std::string, int> calls;
+	for (const ProfileRecord& record : snapshot) {
+		auto found = totals.find(record.name);
+		if (found == totals.end()) {
+			order.push_back(record.name);
+			totals[record.name] = record;
+			calls[record.name] = 1;
+			continue;
+		}
+		ProfileRecord& total = found->second;
+		total.duration += record.duration;
+		total.pixels += record.pixels;
+		total.bytes += record.bytes;
+		total.allocations += record.allocations;
+		total.allocated_bytes += record.allocated_bytes;
+		for (int counter = 0; counter < counter_count; ++counter)
+			total.counters[counter] += record.counters[counter];
+		total.have_counters = total.have_counters && record.have_counters;
+		++calls[record.name];
+	}
+	for (size_t index = 0; index < order.size(); ++index) {
+		const ProfileRecord& total = totals[order[index]];
+		std::fprintf(file, "%s\n\t\t{\"name\": %s, \"calls\": %d, \"wall_us\": %.3f, \"pixels\": %zu, "
+			"\"pixels_per_second\": %.0f, \"bytes\": %zu, \"allocations\": %llu, \"allocated_bytes\": %llu",
+			index ? "," : "", json_string(total.name).c_str(), calls[total.name], total.duration / 1e3, total.pixels,
+			per_second(total.pixels, total.duration), total.bytes,
+			static_cast<unsigned long long>(total.allocations), static_cast<unsigned long long>(total.allocated_bytes));
+		write_counters_json(file, total);
+		std::fprintf(file, "}");
+	}
+	std::fprintf(file, "\n\t]\n}\n");
+	return 0;
+}
+
+// records are added as scopes end, so nested scopes come before their
+// parents until sorted by start
+std::vector<ProfileRecord> snapshot_records() {
+	std::vector<ProfileRecord> snapshot;
+	{
+		std::lock_guard<std::mutex> lock(records_mutex);
+		snapshot = records;
+	}
+	std::stable_sort(snapshot.begin(), snapshot.end(), [](const ProfileRecord& lhs, const ProfileRecord& rhs) {
+		return lhs.start < rhs.start;
+	});
+	return snapshot;
+}
+
+bool ends_with(const std::string& text, const std::string& suffix) {
+	return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+}
+
+void profiler_enable(bool hardware_counters) {
+	hardware_counters_wanted = hardware_counters;
+	profiler_detail::enabled = true;
+}
+
+void profiler_disable() {
+	profiler_detail::enabled = false;
+}
+
+void profiler_reset() {
+	std::lock_guard<std::mutex> lock(records_mutex);
+	records.clear();
+}
+
+void profile_allocation(size_t bytes) {
+	allocation_count.fetch_add(1, std::memory_order_relaxed);
+	allocation_bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void ProfileScope::begin(const char* name, size_t pixels, size_t bytes) {
+	active_ = true;
+	name_ = name;
+	pixels_ = pixels;
+	bytes_ = bytes;
+	allocations_ = allocation_count.load(std::memory_order_relaxed);
+	allocated_bytes_ = allocation_bytes.load(std::memory_order_relaxed);
+	have_counters_ = hardware_counters_wanted && thread_state.open_counters() && thread_state.read_counters(counters_);
+	start_ = now_ns();
+}
+
+void ProfileScope::end() {
+	int64_t finish = now_ns();
+	uint64_t counters[counter_count];
+	bool have_counters = have_counters_ && thread_state.read_counters(counters);
+	uint64_t allocations = allocation_count.load(std::memory_order_relaxed) - allocations_;
+	uint64_t allocated_bytes = allocation_bytes.load(std::memory_order_relaxed) - allocated_bytes_;
+
+	ProfileRecord record;
+	record.name = name_;
+	record.thread = thread_index();
+	record.start = start_;
+	record.duration = finish - start_;
+	record.pixels = pixels_;
+	record.bytes = bytes_;
+	record.allocations = allocations;
+	record.allocated_bytes = allocated_bytes;
+	record.have_counters = have_counters;
+	for (int counter = 0; counter < counter_count; ++counter)
+		record.counters[counter] = have_counters ? counters[counter] - counters_[counter] : 0;
+	std::lock_guard<std::mutex> lock(records_mutex);
+	records.push_back(record);
+}
+
+int profiler_write_report(const char* path) {
+	FILE* file = std::fopen(path, "w");
+	if (!file) {
+		std::cerr << "[profiler_write_report] File " << path << " could not be opened for writing" << std::endl;
+		return 1;
+	}
+	std::vector<ProfileRecord> snapshot = snapshot_records();
+	int result = ends_with(path, ".csv") ? write_csv(file, snapshot) : write_json(file, snapshot);
+	bool failed = std::ferror(file) != 0;
+	if (std::fclose(file) != 0 || failed || result != 0) {
+		std::cerr << "[profiler_write_report] Writing " << path << " failed" << std::endl;
+		return 3;
+	}
+	return 0;
+}
+
+int profiler_write_trace(const char* path) {
+	FILE* file = std::fopen(path, "w");
+	if (!file) {
+		std::cerr << "[profiler_write_trace] File " << path << " could not be opened for writing" << std::endl;
+		return 1;
+	}
+	std::vector<ProfileRecord> snapshot = snapshot_records();
+	std::fprintf(file, "{\"traceEvents\": [");
+	for (size_t index = 0; index < snapshot.size(); ++index) {
+		const ProfileRecord& record = snapshot[index];
+		std::fprintf(file, "%s\n{\"name\": %s, \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, "
+			"\"args\": {\"pixels\": %zu, \"bytes\": %zu, \"allocations\": %llu",
+			index ? "," : "", json_string(record.name).c_str(), record.thread, record.start / 1e3, record.duration / 1e3,
+			record.pixels, record.bytes, static_cast<unsigned long long>(record.allocations));
+		if (record.have_counters)
+			write_counters_json(file, record);
+		std::fprintf(file, "}}");
+	}
+	std::fprintf(file, "\n]}\n");
+	bool failed = std::ferror(file) != 0;
+	if (std::fclose(file) != 0 || failed) {
+		std::cerr << "[profiler_write_trace] Writing " << path << " failed" << std::endl;
+		return 3;
+	}
+	return 0;
+}
+
+// Allocations are counted by replacing the global allocator; with profiling
+// off it is malloc behind one branch.
+void* operator new(size_t size) {
+	if (profiling_enabled())
+		profile_allocation(size);
+	void* pointer = std::malloc(size ? size : 1);
+	if (!pointer)
+		throw std::bad_alloc();
+	return pointer;
+}
+
+void operator delete(void* pointer) noexcept {
+	std::free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+	std::free(pointer);
+}
@@ -0,0 +1,77 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Per-stage instrumentation. A ProfileScope around a stage records its wall
+// time, the pixels and bytes it covers, the allocations made while it ran and,
+// where perf_event_open is allowed, the cycles, instructions, cache misses and
+// branch misses of the thread running it (work stolen by pool workers is not
+// counted, so run with --threads 1 for exact counters). While profiling is
+// off a scope costs one load and branch at either end.
+
+namespace profiler_detail {
+extern std::atomic<bool> enabled;
+}
+
+inline bool profiling_enabled() {
+	return profiler_detail::enabled.load(std::memory_order_relaxed);
+}
+
+// hardware_counters asks for perf counters too; they are left out of the
+// report if the kernel refuses them
+void profiler_enable(bool hardware_counters = true);
+void profiler_disable();
+// drops everything recorded so far
+void profiler_reset();
+
+// called for every allocation while profiling is on
+void profile_allocation(size_t bytes);
+
+class ProfileScope {
+public:
+	// name must outlive the scope
+	ProfileScope(const char* name, size_t pixels = 0, size_t bytes = 0) {
+		if (profiling_enabled())
+			begin(name, pixels, bytes);
+	}
+
+	~ProfileScope() {
+		if (active_)
+			end();
+	}
+
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
+
+	// for stages that only learn their size once they have started
+	void set_work(size_t pixels, size_t bytes) {
+		pixels_ = pixels;
+		bytes_ = bytes;
+	}
+
+private:
+	void begin(const char* name, size_t pixels, size_t bytes);
+	void end();
+
+	bool active_ = false;
+	const char* name_ = nullptr;
+	size_t pixels_ = 0;
+	size_t bytes_ = 0;
+	int64_t start_ = 0;
+	uint64_t allocations_ = 0;
+	uint64_t allocated_bytes_ = 0;
+	uint64_t counters_[4] = {0, 0, 0, 0};
+	bool have_counters_ = false;
+};
+
+// One record per scope: .csv paths get CSV, anything else JSON with the
+// records and per-stage totals. Return 0 on success, 1 if the file cannot be
+// opened and 3 if writing it fails.
+int profiler_write_report(const char* path);
+// Chrome trace-event JSON, for chrome://tracing or Perfetto
+int profiler_write_trace(const char* path);
+
+#endif
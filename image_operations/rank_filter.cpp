@@ -0,0 +1,335 @@
+#include "rank_filter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "border.h"
+#include "morphology.h"
+#include "pixel_kernels.h"
+#include "profiler.h"
+#include "thread_pool.h"
+
+namespace {
+
+const int max_radius = 32767;
+// output columns of one Perreault-Hebert tile, whose column histograms then
+// stay in L2
+const int tile_columns = 512;
+// how far ahead of the window a column histogram moves down: far enough that
+// its narrow stores have retired before the window's wide loads, near enough
+// that it is still in L1
+const int move_ahead = 16;
+
+struct Network {
+	// two wires per compare-exchange, as compare_exchange takes them
+	std::vector<uint8_t> pairs;
+	// the wire holding the rank once the network has run
+	int output = 0;
+};
+
+// Batcher's odd-even merge sort of the next power of two up from the n
+// inputs, with the wires past n taken to hold 255: an exchange with such a
+// wire either does nothing or moves the other wire's value, so it is
+// resolved here rather than run. Then only the exchanges the output wire
+// depends on are kept.
+Network make_network(int inputs, int rank) {
+	int size = 1;
+	while (size < inputs)
+		size <<= 1;
+	std::vector<int> wire(size);
+	std::vector<bool> top(size);
+	for (int index = 0; index < size; ++index) {
+		wire[index] = index;
+		top[index] = index >= inputs;
+	}
+	std::vector<int> exchanges;
+	for (int p = 1; p < size; p <<= 1) {
+		for (int k = p; k >= 1; k >>= 1) {
+			for (int j = k % p; j + k < size; j += 2 * k) {
+				for (int i = 0; i < k && i + j + k < size; ++i) {
+					int a = i + j;
+					int b = i + j + k;
+					if (a / (2 * p) != b / (2 * p) || top[b])
+						continue;
+					if (top[a]) {
+						std::swap(wire[a], wire[b]);
+						top[a] = false;
+						top[b] = true;
+						continue;
+					}
+					exchanges.push_back(wire[a]);
+					exchanges.push_back(wire[b]);
+				}
+			}
+		}
+	}
+
+	Network network;
+	network.output = wire[rank];
+	std::vector<bool> live(inputs);
+	live[network.output] = true;
+	std::vector<uint8_t> kept;
+	for (size_t index = exchanges.size(); index > 0; index -= 2) {
+		int a = exchanges[index - 2];
+		int b = exchanges[index - 1];
+		if (!live[a] && !live[b])
+			continue;
+		live[a] = live[b] = true;
+		kept.push_back(static_cast<uint8_t>(b));
+		kept.push_back(static_cast<uint8_t>(a));
+	}
+	network.pairs.assign(kept.rbegin(), kept.rend());
+	return network;
+}
+
+// row, or the constant when it is null, with radius columns either side
+// read in the border mode and network_lanes more past the end
+void pad_row(uint8_t* padded, const uint8_t* row, int width, int radius, BorderMode border, uint8_t constant) {
+	int span = width + 2 * radius + network_lanes;
+	if (!row) {
+		std::memset(padded, constant, span);
+		return;
+	}
+	std::memcpy(padded + radius, row, width);
+	for (int j = 0; j < span; ++j) {
+		if (j == radius)
+			j += width;
+		int index = border_index(j - radius, width, border);
+		padded[j] = index < 0 ? constant : row[index];
+	}
+}
+
+// The rank of every window along one output row, from the 2 radius + 1
+// padded rows around it, network_lanes windows at a time.
+void network_row(uint8_t* out, const uint8_t* const* rows, int width, int radius, const Network& network,
+	uint8_t* wires)
+{
+	const PixelKernels& kernels = pixel_kernels();
+	int side = 2 * radius + 1;
+	int count = static_cast<int>(network.pairs.size() / 2);
+	for (int x0 = 0; x0 < width; x0 += network_lanes) {
+		for (int dy = 0; dy < side; ++dy)
+			for (int dx = 0; dx < side; ++dx)
+				std::memcpy(wires + network_lanes * (dy * side + dx), rows[dy] + x0 + dx, network_lanes);
+		kernels.compare_exchange(wires, network.pairs.data(), count);
+		std::memcpy(out + x0, wires + network_lanes * network.output, std::min(network_lanes, width - x0));
+	}
+}
+
+void network_rank(Image8& out, const Image8& in, int radius, int rank) {
+	int side = 2 * radius + 1;
+	Network network = make_network(side * side, rank);
+	int width = in.width();
+	int height = in.height();
+	parallel_rows(height, [&](int begin, int end) {
+		int span = width + 2 * radius + network_lanes;
+		std::vector<uint8_t> padded(static_cast<size_t>(side) * span);
+		std::vector<uint8_t> wires(side * side * network_lanes);
+		std::vector<const uint8_t*> rows(side);
+		for (int y = begin; y < end; ++y) {
+			for (int dy = 0; dy < side; ++dy) {
+				int row = border_index(y + dy - radius, height, BorderMode::replicate);
+				pad_row(&padded[dy * span], in[row], width, radius, BorderMode::replicate, 0);
+				rows[dy] = &padded[dy * span];
+			}
+			network_row(out[y], rows.data(), width, radius, network, wires.data());
+		}
+	});
+}
+
+// Output columns [x0, x1) of rows [y0, y1). Each column of the tile and
+// radius either side keeps a coarse and a fine histogram of the 2 radius + 1
+// rows around the output row, moved down a row as the window nears it by
+// taking one pixel out and putting one in. Along the row the window's coarse
+// histogram takes in one column and lets one go; a fine segment is only
+// brought up to date when the rank falls in it, from where it was last used
+// or from scratch, whichever is less work. Column counts fit 16 bits; Count
+// holds the window's.
+template <typename Count>
+void histogram_rank_tile(Image8& out, const Image8& in, int radius, int rank, int x0, int x1, int y0, int y1) {
+	int width = in.width();
+	int height = in.height();
+	int side = 2 * radius + 1;
+	int columns = x1 - x0 + 2 * radius;
+	std::vector<int> source(columns);
+	for (int c = 0; c < columns; ++c)
+		source[c] = border_index(x0 - radius + c, width, BorderMode::replicate);
+	std::vector<uint16_t> coarse(16 * static_cast<size_t>(columns));
+	std::vector<uint16_t> fine(256 * static_cast<size_t>(columns));
+	for (int y = y0 - radius; y <= y0 + radius; ++y) {
+		const uint8_t* row = in[border_index(y, height, BorderMode::replicate)];
+		for (int c = 0; c < columns; ++c) {
+			int value = row[source[c]];
+			++coarse[16 * c + (value >> 4)];
+			++fine[256 * c + value];
+		}
+	}
+
+	Count window_coarse[16];
+	Count window_fine[256];
+	int updated[16];
+	const uint8_t* leaving_row = nullptr;
+	const uint8_t* entering_row = nullptr;
+	auto move_column = [&](int c) {
+		if (!entering_row)
+			return;
+		int leaving = leaving_row[source[c]];
+		int entering = entering_row[source[c]];
+		--coarse[16 * c + (leaving >> 4)];
+		--fine[256 * c + leaving];
+		++coarse[16 * c + (entering >> 4)];
+		++fine[256 * c + entering];
+	};
+	for (int y = y0; y < y1; ++y) {
+		if (y > y0) {
+			leaving_row = in[border_index(y - radius - 1, height, BorderMode::replicate)];
+			entering_row = in[border_index(y + radius, height, BorderMode::replicate)];
+		}
+		for (int c = 0; c < std::min(columns, side + move_ahead); ++c)
+			move_column(c);
+		std::fill(window_coarse, window_coarse + 16, 0);
+		for (int c = 0; c < side; ++c)
+			for (int k = 0; k < 16; ++k)
+				window_coarse[k] += coarse[16 * c + k];
+		std::fill(updated, updated + 16, -side);
+		uint8_t* destination = out[y] + x0;
+		for (int i = 0; i < x1 - x0; ++i) {
+			if (i > 0) {
+				if (i + 2 * radius + move_ahead < columns)
+					move_column(i + 2 * radius + move_ahead);
+				const uint16_t* entering = &coarse[16 * (i + 2 * radius)];
+				const uint16_t* leaving = &coarse[16 * (i - 1)];
+				for (int k = 0; k < 16; ++k)
+					window_coarse[k] += entering[k] - leaving[k];
+			}
+			Count remaining = static_cast<Count>(rank);
+			int bin = 0;
+			while (remaining >= window_coarse[bin])
+				remaining -= window_coarse[bin++];
+
+			Count* segment = window_fine + 16 * bin;
+			if (2 * (i - updated[bin]) > side) {
+				std::fill(segment, segment + 16, 0);
+				for (int c = i; c < i + side; ++c) {
+					const uint16_t* column = &fine[256 * c + 16 * bin];
+					for (int k = 0; k < 16; ++k)
+						segment[k] += column[k];
+				}
+			} else {
+				for (int t = updated[bin] + 1; t <= i; ++t) {
+					const uint16_t* entering = &fine[256 * (t + 2 * radius) + 16 * bin];
+					const uint16_t* leaving = &fine[256 * (t - 1) + 16 * bin];
+					for (int k = 0; k < 16; ++k)
+						segment[k] += entering[k] - leaving[k];
+				}
+			}
+			updated[bin] = i;
+			int value = 0;
+			while (remaining >= segment[value])
+				remaining -= segment[value++];
+			destination[i] = static_cast<uint8_t>(16 * bin + value);
+		}
+	}
+}
+
+// Tiles across and, when there are too few of them to share out, bands down
+// as well, each band at least a few windows tall so that filling its column
+// histograms stays a small part of the work.
+template <typename Count>
+void histogram_rank(Image8& out, const Image8& in, int radius, int rank) {
+	int width = in.width();
+	int height = in.height();
+	int side = 2 * radius + 1;
+	int tile = std::max(tile_columns, 4 * radius);
+	int tiles = (width + tile - 1) / tile;
+	ThreadPool& threads = default_thread_pool();
+	int wanted = (4 * threads.thread_count() + tiles - 1) / tiles;
+	int bands = std::max(1, std::min(wanted, height / (4 * side)));
+	int band = (height + bands - 1) / bands;
+	threads.parallel_for(0, tiles * bands, 1, [&](int begin, int end) {
+		for (int task = begin; task < end; ++task) {
+			int x0 = task % tiles * tile;
+			int y0 = task / tiles * band;
+			histogram_rank_tile<Count>(out, in, radius, rank, x0, std::min(width, x0 + tile), y0, std::min(height, y0 + band));
+		}
+	});
+}
+
+}
+
+void grayscale_rank(Image8& out, const Image8& in, int radius, int rank) {
+	radius = std::max(0, std::min(radius, max_radius));
+	long long side = 2 * radius + 1;
+	long long last = side * side - 1;
+	if (radius == 0 || rank <= 0) {
+		grayscale_erode(out, in, radius);
+		return;
+	}
+	if (rank >= last) {
+		grayscale_dilate(out, in, radius);
+		return;
+	}
+	if (out.width() != in.width() || out.height() != in.height() || out.channels() != 1)
+		out.resize(in.width(), in.height());
+	if (in.empty())
+		return;
+	size_t pixels = static_cast<size_t>(in.width()) * in.height();
+	ProfileScope scope("grayscale_rank", pixels, 2 * pixels);
+	if (radius <= 2)
+		network_rank(out, in, radius, rank);
+	else if (last < 65536)
+		histogram_rank<uint16_t>(out, in, radius, rank);
+	else
+		histogram_rank<uint32_t>(out, in, radius, rank);
+}
+
+void grayscale_median(Image8& out, const Image8& in, int radius) {
+	grayscale_percentile(out, in, radius, 50.0);
+}
+
+void grayscale_percentile(Image8& out, const Image8& in, int radius, double percent) {
+	radius = std::max(0, std::min(radius, max_radius));
+	long long side = 2 * radius + 1;
+	double fraction = std::max(0.0, std::min(percent, 100.0)) / 100.0;
+	grayscale_rank(out, in, radius, static_cast<int>(std::llround(fraction * (side * side - 1))));
+}
+
+void median_row(uint8_t* out, const uint8_t* above, const uint8_t* centre, const uint8_t* below,
+	int width, const NeighbourhoodOptions& options)
+{
+	if (width <= 0)
+		return;
+	if (!options.extend && (!above || !below)) {
+		std::memcpy(out, centre, width);
+		return;
+	}
+	// rows past the top or bottom as neighbourhood_row reads them
+	if (options.border == BorderMode::reflect) {
+		const uint8_t* reflected_above = above ? above : (below ? below : centre);
+		const uint8_t* reflected_below = below ? below : (above ? above : centre);
+		above = reflected_above;
+		below = reflected_below;
+	} else if (options.border == BorderMode::replicate) {
+		above = above ? above : centre;
+		below = below ? below : centre;
+	}
+	static const Network network = make_network(9, 4);
+	int span = width + 2 + network_lanes;
+	std::vector<uint8_t> padded(3 * span);
+	uint8_t wires[9 * network_lanes];
+	const uint8_t* sources[3] = {above, centre, below};
+	const uint8_t* rows[3];
+	for (int dy = 0; dy < 3; ++dy) {
+		pad_row(&padded[dy * span], sources[dy], width, 1, options.border, options.constant);
+		rows[dy] = &padded[dy * span];
+	}
+	uint8_t first = centre[0];
+	uint8_t final = centre[width - 1];
+	network_row(out, rows, width, 1, network, wires);
+	if (!options.extend) {
+		out[0] = first;
+		out[width - 1] = final;
+	}
+}
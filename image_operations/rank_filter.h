@@ -0,0 +1,29 @@
+#ifndef RANK_FILTER_H
+#define RANK_FILTER_H
+
+#include <cstdint>
+
+#include "image.h"
+#include "neighbourhood_operations.h"
+
+// Rank filters over the (2 radius + 1)^2 square around each pixel, reading
+// past the edge in replicate mode. Rank 0 is the minimum and the last rank
+// the maximum; those two run as grayscale_erode and grayscale_dilate, which
+// give the same results. Radius 1 and 2 sort the window with a
+// compare-exchange network over 64 columns at once, pruned to the rank
+// wanted. Larger radii keep a histogram of every column and slide a window
+// histogram along the row, Perreault-Hebert style: a 16-bin coarse level
+// finds the bin of the rank, and only that bin's 16 fine counts are brought
+// up to date, so the cost per pixel does not grow with the radius. The
+// radius is at most 32767.
+void grayscale_rank(Image8& out, const Image8& in, int radius, int rank);
+void grayscale_median(Image8& out, const Image8& in, int radius);
+// the rank nearest percent (0 to 100) of the way from minimum to maximum
+void grayscale_percentile(Image8& out, const Image8& in, int radius, double percent);
+
+// The 3x3 median as a NeighbourhoodRowFn, for the median operator of
+// neighbourhood_operations.h.
+void median_row(uint8_t* out, const uint8_t* above, const uint8_t* centre, const uint8_t* below,
+	int width, const NeighbourhoodOptions& options);
+
+#endif
@@ -0,0 +1,141 @@
+#include "row_pipeline.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "neighbourhood_operations.h"
+
+RowStage point_stage(const PointLut& lut) {
+	RowStage stage;
+	stage.radius = 0;
+	stage.apply = [lut](uint8_t* out, const uint8_t* const* rows, int width) {
+		std::memcpy(out, rows[0], width);
+		apply_point_lut_row(lut, out, width);
+	};
+	return stage;
+}
+
+RowStage kernel_stage(void (*fn)(Image8&, const Image8&, int, int)) {
+	RowStage stage;
+	stage.radius = 1;
+	if (NeighbourhoodRowFn row = neighbourhood_row_function(fn)) {
+		stage.apply = [row](uint8_t* out, const uint8_t* const* rows, int width) {
+			row(out, rows[0], rows[1], rows[2], width, NeighbourhoodOptions());
+		};
+		return stage;
+	}
+	Image8 window;
+	Image8 result;
+	stage.apply = [fn, window, result](uint8_t* out, const uint8_t* const* rows, int width) mutable {
+		// only the rows that exist go in the window, so fn sees the image
+		// edge exactly where the whole image has one
+		int first = rows[0] ? 0 : 1;
+		int last = rows[2] ? 2 : 1;
+		window.resize(width, last - first + 1);
+		result.resize(width, last - first + 1);
+		for (int j = first; j <= last; ++j)
+			std::memcpy(window[j - first], rows[j], width);
+		int centre = 1 - first;
+		for (int x = 0; x < width; ++x)
+			fn(result, window, x, centre);
+		std::memcpy(out, result[centre], width);
+	};
+	return stage;
+}
+
+RowPipeline::RowPipeline(int width, int height, const std::vector<RowStage>& stages, Sink sink)
+	: width_(width), height_(height), sink_(sink)
+{
+	int widest = 0;
+	rings_.resize(stages.size());
+	for (size_t index = 0; index < stages.size(); ++index) {
+		rings_[index].stage = stages[index];
+		rings_[index].rows.resize(width, 2 * stages[index].radius + 1);
+		rings_[index].output.resize(width, 1);
+		widest = std::max(widest, stages[index].radius);
+	}
+	window_.resize(2 * widest + 1);
+}
+
+void RowPipeline::push(const uint8_t* row) {
+	feed(0, row);
+}
+
+int RowPipeline::depth() const {
+	int rows = 0;
+	for (const Ring& ring : rings_)
+		rows += ring.rows.height();
+	return rows;
+}
+
+void RowPipeline::feed(size_t stage, const uint8_t* row) {
+	if (stage == rings_.size()) {
+		sink_(row, delivered_++);
+		return;
+	}
+	Ring& ring = rings_[stage];
+	std::memcpy(ring.rows[ring.received % ring.rows.height()], row, width_);
+	++ring.received;
+	// every output row whose window is now complete; the last input row
+	// completes all the rest
+	int radius = ring.stage.radius;
+	while (ring.emitted < height_ && (ring.emitted + radius < ring.received || ring.received == height_))
+		emit(stage, ring.emitted++);
+}
+
+void RowPipeline::emit(size_t stage, int y) {
+	Ring& ring = rings_[stage];
+	int radius = ring.stage.radius;
+	for (int j = -radius; j <= radius; ++j) {
+		int source = y + j;
+		window_[j + radius] = source < 0 || source >= height_ ? nullptr : ring.rows[source % ring.rows.height()];
+	}
+	ring.stage.apply(ring.output[0], window_.data(), width_);
+	feed(stage + 1, ring.output[0]);
+}
+
+RowQueue::RowQueue(size_t row_bytes, int capacity)
+	: rows_(static_cast<int>(row_bytes), capacity), capacity_(capacity)
+{
+}
+
+uint8_t* RowQueue::begin_write() {
+	std::unique_lock<std::mutex> lock(mutex_);
+	changed_.wait(lock, [this]{ return count_ < capacity_ || closed_; });
+	if (closed_)
+		return nullptr;
+	return rows_[(head_ + count_) % capacity_];
+}
+
+void RowQueue::end_write() {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		++count_;
+	}
+	changed_.notify_all();
+}
+
+void RowQueue::close() {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		closed_ = true;
+	}
+	changed_.notify_all();
+}
+
+const uint8_t* RowQueue::begin_read() {
+	std::unique_lock<std::mutex> lock(mutex_);
+	changed_.wait(lock, [this]{ return count_ > 0 || closed_; });
+	if (count_ == 0)
+		return nullptr;
+	return rows_[head_];
+}
+
+void RowQueue::end_read() {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		head_ = (head_ + 1) % capacity_;
+		--count_;
+	}
+	changed_.notify_all();
+}
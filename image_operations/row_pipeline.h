@@ -0,0 +1,89 @@
+#ifndef ROW_PIPELINE_H
+#define ROW_PIPELINE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "image.h"
+#include "point_operations.h"
+
+// One step of a streaming chain over 8-bit single channel rows. apply gets
+// the 2 * radius + 1 input rows centred on the output row, with null for rows
+// past the top or bottom of the image.
+struct RowStage {
+	int radius = 0;
+	std::function<void(uint8_t* out, const uint8_t* const* rows, int width)> apply;
+};
+
+RowStage point_stage(const PointLut& lut);
+// runs one of the 3x3 operators from neighbourhood_operations.h with the
+// same results at the image border as single_channel_kernel
+RowStage kernel_stage(void (*fn)(Image8&, const Image8&, int, int));
+
+// Pushes rows through a chain of stages one at a time. Each stage keeps a ring
+// of only the 2 * radius + 1 rows it reads, and a row is handed to the sink as
+// soon as every stage has seen enough of the rows below it, so memory is
+// O(width * depth) whatever the height of the image.
+class RowPipeline {
+public:
+	typedef std::function<void(const uint8_t* row, int y)> Sink;
+
+	RowPipeline(int width, int height, const std::vector<RowStage>& stages, Sink sink);
+
+	// rows must arrive in order, height of them in all
+	void push(const uint8_t* row);
+	// rows held in the stages' rings
+	int depth() const;
+
+private:
+	struct Ring {
+		RowStage stage;
+		Image8 rows;
+		Image8 output;
+		int received = 0;
+		int emitted = 0;
+	};
+
+	void feed(size_t stage, const uint8_t* row);
+	void emit(size_t stage, int y);
+
+	int width_;
+	int height_;
+	std::vector<Ring> rings_;
+	std::vector<const uint8_t*> window_;
+	Sink sink_;
+	int delivered_ = 0;
+};
+
+// A bounded queue of fixed-size rows between one producer and one consumer
+// thread, so decoding can run ahead of processing without buffering the image.
+class RowQueue {
+public:
+	RowQueue(size_t row_bytes, int capacity);
+
+	// the producer fills the row begin_write returns, then calls end_write;
+	// begin_write returns null if the consumer closed the queue
+	uint8_t* begin_write();
+	void end_write();
+	// either side: no more rows will be written or read
+	void close();
+
+	// null once the queue is closed and drained
+	const uint8_t* begin_read();
+	void end_read();
+
+private:
+	Image8 rows_;
+	int capacity_;
+	int head_ = 0;
+	int count_ = 0;
+	bool closed_ = false;
+	std::mutex mutex_;
+	std::condition_variable changed_;
+};
+
+#endif
@@ -0,0 +1,149 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+ThreadPool::ThreadPool(int threads) : queued_(0), next_worker_(0) {
+	for (int index = 0; index < threads - 1; ++index)
+		workers_.emplace_back(new Worker);
+	for (int index = 0; index < threads - 1; ++index)
+		workers_[index]->thread = std::thread(&ThreadPool::worker_loop, this, index);
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex_);
+		stop_ = true;
+	}
+	wake_.notify_all();
+	for (auto& worker : workers_)
+		worker->thread.join();
+}
+
+void ThreadPool::parallel_for(int begin, int end, int grain, const std::function<void(int, int)>& fn) {
+	if (grain < 1)
+		grain = 1;
+	int chunks = (end - begin + grain - 1) / grain;
+	if (chunks <= 0)
+		return;
+	if (workers_.empty() || chunks == 1) {
+		fn(begin, end);
+		return;
+	}
+
+	Job job;
+	job.fn = &fn;
+	job.remaining = chunks;
+
+	// deal the chunks round-robin, keeping the first one for this thread
+	for (int chunk = 1; chunk < chunks; ++chunk) {
+		int chunk_begin = begin + chunk * grain;
+		Task task = {&job, chunk_begin, std::min(end, chunk_begin + grain)};
+		Worker& worker = *workers_[next_worker_++ % workers_.size()];
+		std::lock_guard<std::mutex> lock(worker.mutex);
+		worker.tasks.push_back(task);
+	}
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex_);
+		queued_ += chunks - 1;
+	}
+	wake_.notify_all();
+
+	run(Task{&job, begin, std::min(end, begin + grain)});
+
+	// help out until every chunk has been taken, then wait for the stragglers
+	Task task;
+	while (take(-1, task))
+		run(task);
+	std::unique_lock<std::mutex> lock(job.mutex);
+	job.done.wait(lock, [&]{ return job.remaining == 0; });
+}
+
+bool ThreadPool::take(int worker, Task& task) {
+	if (worker >= 0) {
+		Worker& own = *workers_[worker];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.tasks.empty()) {
+			task = own.tasks.back();
+			own.tasks.pop_back();
+			--queued_;
+			return true;
+		}
+	}
+	int count = static_cast<int>(workers_.size());
+	for (int offset = 1; offset <= count; ++offset) {
+		int victim = ((worker < 0 ? 0 : worker) + offset) % count;
+		if (victim == worker)
+			continue;
+		Worker& other = *workers_[victim];
+		std::lock_guard<std::mutex> lock(other.mutex);
+		if (!other.tasks.empty()) {
+			task = other.tasks.front();
+			other.tasks.pop_front();
+			--queued_;
+			return true;
+		}
+	}
+	return false;
+}
+
+void ThreadPool::run(const Task& task) {
+	(*task.job->fn)(task.begin, task.end);
+	// the job lives on the caller's stack, so it must not be touched once the
+	// caller can see remaining reach zero
+	std::lock_guard<std::mutex> lock(task.job->mutex);
+	if (--task.job->remaining == 0)
+		task.job->done.notify_all();
+}
+
+void ThreadPool::worker_loop(int worker) {
+	while (true) {
+		Task task;
+		if (take(worker, task)) {
+			run(task);
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(sleep_mutex_);
+		wake_.wait(lock, [&]{ return stop_ || queued_ > 0; });
+		if (stop_ && queued_ == 0)
+			return;
+	}
+}
+
+namespace {
+
+std::unique_ptr<ThreadPool> pool;
+int requested_threads = 0;
+
+int environment_thread_count() {
+	const char* value = std::getenv("IMAGE_OPERATIONS_THREADS");
+	if (value && std::atoi(value) > 0)
+		return std::atoi(value);
+	int hardware = static_cast<int>(std::thread::hardware_concurrency());
+	return hardware > 0 ? hardware : 1;
+}
+
+}
+
+ThreadPool& default_thread_pool() {
+	if (!pool)
+		pool.reset(new ThreadPool(requested_threads > 0 ? requested_threads : environment_thread_count()));
+	return *pool;
+}
+
+void set_thread_count(int threads) {
+	requested_threads = threads;
+	pool.reset();
+}
+
+int thread_count() {
+	return default_thread_pool().thread_count();
+}
+
+void parallel_rows(int rows, const std::function<void(int, int)>& fn) {
+	// a few bands per thread balances uneven rows; very short bands are not worth a task
+	ThreadPool& threads = default_thread_pool();
+	const int minimum_band = 16;
+	int band = (rows + threads.thread_count() * 4 - 1) / (threads.thread_count() * 4);
+	threads.parallel_for(0, rows, band < minimum_band ? minimum_band : band, fn);
+}
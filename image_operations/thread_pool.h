@@ -0,0 +1,76 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A persistent pool of worker threads. Each worker owns a deque of chunks: it
+// takes work from the back of its own deque and steals from the front of the
+// others' when it runs dry. The thread calling parallel_for works on the job
+// too, so a pool of n threads has n - 1 workers and parallel_for may nest.
+class ThreadPool {
+public:
+	explicit ThreadPool(int threads);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	int thread_count() const { return static_cast<int>(workers_.size()) + 1; }
+
+	// calls fn(chunk_begin, chunk_end) over [begin, end) in chunks of at most
+	// grain and returns once every chunk has run
+	void parallel_for(int begin, int end, int grain, const std::function<void(int, int)>& fn);
+
+private:
+	struct Job {
+		const std::function<void(int, int)>* fn;
+		int remaining;
+		std::mutex mutex;
+		std::condition_variable done;
+	};
+
+	struct Task {
+		Job* job;
+		int begin;
+		int end;
+	};
+
+	struct Worker {
+		std::mutex mutex;
+		std::deque<Task> tasks;
+		std::thread thread;
+	};
+
+	bool take(int worker, Task& task);
+	void run(const Task& task);
+	void worker_loop(int worker);
+
+	std::vector<std::unique_ptr<Worker>> workers_;
+	std::atomic<int> queued_;
+	std::atomic<unsigned int> next_worker_;
+	std::mutex sleep_mutex_;
+	std::condition_variable wake_;
+	bool stop_ = false;
+};
+
+// The pool the image operators run on. Its size comes from set_thread_count,
+// else the IMAGE_OPERATIONS_THREADS environment variable, else the number of
+// hardware threads. Changing it must not race with running operators.
+ThreadPool& default_thread_pool();
+void set_thread_count(int threads);
+int thread_count();
+
+// Splits [0, rows) into bands of whole rows on the default pool. Operators
+// only ever write their own rows and read the shared input, so neighbourhood
+// operators read the rows either side of a band straight from the input as
+// their halo, and the output is identical to the serial loop.
+void parallel_rows(int rows, const std::function<void(int, int)>& fn);
+
+#endif